@@ -0,0 +1,63 @@
+#ifndef _BOUNDEDQUEUE_H_
+#define _BOUNDEDQUEUE_H_
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/**
+*	@class		BoundedQueue
+*	@brief		Queue between two threads with a maximum number of items.
+*	@detail
+*	Push blocks while the queue is full and Pop blocks while it is empty, so a fast producer cannot run ahead of the consumer
+*	by more than capacity items. After Close, Push fails and Pop returns the remaining items and then false.
+*/
+template<typename T>
+class BoundedQueue {
+
+	public:
+		BoundedQueue(int capacity = 1) : capacity_(capacity < 1 ? 1 : capacity), closed_(false) {}
+
+		BoundedQueue(const BoundedQueue&) = delete;
+		BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+		bool Push(T item) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_not_full_.wait(lock, [this] { return closed_ or (int) items_.size() < capacity_; });
+			if (closed_) return false;
+			items_.push_back(std::move(item));
+			lock.unlock();
+			cv_not_empty_.notify_one();
+			return true;
+		}
+
+		bool Pop(T& item) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_not_empty_.wait(lock, [this] { return closed_ or !items_.empty(); });
+			if (items_.empty()) return false;
+			item = std::move(items_.front());
+			items_.pop_front();
+			lock.unlock();
+			cv_not_full_.notify_one();
+			return true;
+		}
+
+		void Close() {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				closed_ = true;
+			}
+			cv_not_full_.notify_all();
+			cv_not_empty_.notify_all();
+		}
+
+	private:
+		int capacity_;
+		bool closed_;
+		std::deque<T> items_;
+		std::mutex mutex_;
+		std::condition_variable cv_not_full_;
+		std::condition_variable cv_not_empty_;
+};
+
+#endif
@@ -39,6 +39,163 @@
 #include <EdbVertex.h>
 #include <EdbEDA.h>
 
+#include<TRandom3.h>
+
+#include "FnuMomKernel.hpp"
+
+#include<cstdint>
+#include<new>
+
+// allocator aligned to 64 bytes (one cache line, one AVX-512 register)
+template<typename T, std::size_t Align = 64>
+struct FnuAlignedAllocator {
+    typedef T value_type;
+    template<typename U> struct rebind { typedef FnuAlignedAllocator<U, Align> other; };
+
+    FnuAlignedAllocator() {}
+    template<typename U> FnuAlignedAllocator(const FnuAlignedAllocator<U, Align>&) {}
+
+    T* allocate(std::size_t n) {
+        void *p = 0;
+        if(posix_memalign(&p, Align, n * sizeof(T) > 0 ? n * sizeof(T) : Align) != 0) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, std::size_t) { free(p); }
+
+    template<typename U> bool operator==(const FnuAlignedAllocator<U, Align>&) const { return true; }
+    template<typename U> bool operator!=(const FnuAlignedAllocator<U, Align>&) const { return false; }
+};
+
+// Positions of a track on each plate, index = plate - first plate (struct of arrays).
+// present[i] is 1 if the track has a segment on the plate, 0 if the plate is missing (x, y, z are 0).
+struct FnuMomTrackBuffer {
+    FnuMomTrackBuffer() : n(0) {}
+
+    // start a new track
+    void Clear() { n = 0; }
+
+    // use the plates [0, size), new plates are missing
+    void Extend(int size) {
+        if(size <= n) return;
+        if(size > (int)x.size()){
+            int capacity = x.size() < 64 ? 64 : x.size();
+            while(capacity < size) capacity *= 2;
+            x.resize(capacity);
+            y.resize(capacity);
+            z.resize(capacity);
+            present.resize(capacity);
+        }
+        for(int i = n; i < size; i++){
+            x[i] = y[i] = z[i] = 0.0;
+            present[i] = 0;
+        }
+        n = size;
+    }
+
+    void Set(int i, double xi, double yi, double zi) {
+        Extend(i + 1);
+        x[i] = xi;
+        y[i] = yi;
+        z[i] = zi;
+        present[i] = 1;
+    }
+
+    std::vector<double, FnuAlignedAllocator<double> > x, y, z;
+    std::vector<uint8_t, FnuAlignedAllocator<uint8_t> > present;
+    int n; // number of plates in use
+};
+
+// Segments of a track used in the measurement (struct of arrays), in the order of EdbTrackP::GetSegment.
+// Filled from an EdbTrackP with Set, or directly from the branches of linked_tracks.root by LinkedTracksLiteReader
+// without building the FEDRA objects. seg_id, mcevt and scan_plate are not used in the measurement but identify the segments.
+struct FnuMomTrackData {
+    FnuMomTrackData() : id(0), p(0), npl(0) {}
+
+    void Clear() {
+        x.clear(); y.clear(); z.clear(); tx.clear(); ty.clear();
+        plate.clear(); seg_id.clear(); mcevt.clear(); scan_plate.clear();
+    }
+    void AddSegment(float xi, float yi, float zi, float txi, float tyi, int platei, int seg_idi, int mcevti, int scan_platei) {
+        x.push_back(xi); y.push_back(yi); z.push_back(zi); tx.push_back(txi); ty.push_back(tyi);
+        plate.push_back(platei); seg_id.push_back(seg_idi); mcevt.push_back(mcevti); scan_plate.push_back(scan_platei);
+    }
+    void Set(EdbTrackP *t);
+    int N() const { return x.size(); }
+
+    int id; // track ID
+    float p; // momentum of the track (true momentum in MC)
+    int npl;
+    std::vector<float> x, y, z, tx, ty; // Float_t as EdbSegP
+    std::vector<int> plate, seg_id, mcevt, scan_plate;
+};
+
+// one row of nt (one fitted cell length)
+struct FnuMomCell {
+    float Ptrue;
+    float Prec_Coord;
+    float sigma_error_Coord;
+    float Prec_inv_Coord;
+    float sigma_error_inv_Coord;
+    float Prec_inv_Coord_error;
+    float Prec_Lat;
+    float sigma_error_Lat;
+    float Prec_inv_Lat;
+    float sigma_error_inv_Lat;
+    int nicell;
+    int itype;
+};
+
+// points of the RMS vs cell length graph, x: cell length, y: RMS, ey: error of RMS
+struct FnuMomGraph {
+    FnuMomGraph() : n(0) {}
+
+    void Clear() { n = 0; }
+    void AddPoint(double xi, double yi, double eyi) {
+        if(n >= 40) return;
+        x[n] = xi;
+        y[n] = yi;
+        ey[n] = eyi;
+        n++;
+    }
+
+    double x[40];
+    double y[40];
+    double ey[40];
+    int n;
+};
+
+// result of the kink scan of a track (FnuMomCoord::ScanTrackAngleDiff)
+struct FnuMomKink {
+    double angle_diff_max; // maximum angle difference (mrad), -1 if the track is too short
+    int plate; // plate of the segment with the maximum
+    int index; // index of the segment with the maximum
+};
+
+// Scratch state of one momentum measurement.
+// FnuMomCoord is only read while measuring, so tracks can be measured concurrently with one workspace per thread.
+struct FnuMomWorkspace {
+    FnuMomWorkspace() : icell_cut(0), ncell(0) {}
+
+    FnuMomTrackData data; // the track converted from EdbTrackP
+    FnuMomTrackBuffer track;
+    double cal_CoordArray[40]; // Coordでs_rmsをtrack,cell lengthに入れてる
+    double cal_LateralArray[40];
+    int allentryArray[40]; // keep allentry
+    int LateralEntryArray[40];
+    int icell_cut;
+    FnuMomGraph grCoord;
+    FnuMomGraph grLat;
+
+    // result of the last measured track
+    int trid;
+    double angle_diff_max;
+    float slope;
+    FnuMomCell cell[40];
+    int ncell;
+
+    TRandom3 rand; // smearing for file_type==1, seeded for each track
+};
+
 class FnuMomCoord {
 
     public:
@@ -49,12 +206,19 @@ class FnuMomCoord {
         void SetDataPar();
         void SetMCPar(double first_mom, double first_smear);
         void SetIniMom(double first_mom);
+        // maximum number of segments (nseg) and plates (npl) of a track used in the measurement, normally from the parameter file
+        void SetPlateLimits(int max_seg, int max_plate) { nseg = max_seg; npl = max_plate; }
+        int NSeg() const { return nseg; }
+        int NPl() const { return npl; }
         void ReadParFile(TString file_name);
-        std::pair<double, double> CalcTrackAngle(EdbTrackP* t, int index);
-        double CalcTrackAngleDiff(EdbTrackP* t, int index);
-        double CalcTrackAngleDiffMax(EdbTrackP* t);
+        std::pair<double, double> CalcTrackAngle(EdbTrackP* t, int index) const;
+        double CalcTrackAngleDiff(EdbTrackP* t, int index) const;
+        double CalcTrackAngleDiffMax(EdbTrackP* t) const;
+        // CalcTrackAngleDiff of all the segments in one pass, profile gets (plate, angle difference) of each segment if given
+        FnuMomKink ScanTrackAngleDiff(EdbTrackP* t, std::vector<std::pair<int, double> > *profile = 0) const;
+        FnuMomKink ScanTrackAngleDiff(const FnuMomTrackData &t, std::vector<std::pair<int, double> > *profile = 0) const;
         // double CalcDistance(TVector2 a, TVector2 b, TVector2 p);
-        double CalcDistance(TVector3 a, TVector3 b, TVector3 p);
+        double CalcDistance(TVector3 a, TVector3 b, TVector3 p) const;
         // void VertexSetTrackVector(EdbPVRec *pvr);
         // void DataSetTrackVector(EdbPVRec *pvr);
         void SetZArray(char* fname);
@@ -67,16 +231,53 @@ class FnuMomCoord {
         void DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name);
         // void DrawDataMomGraphCoord(EdbTrackP *t, TCanvas *c1, TNtuple *nt, TString file_name, int plate_num);
         void WriteRootFile(TString file_name);
+        // ntuple filled by CalcMomentum (one row per fitted cell length)
+        TNtuple* GetNtuple() const { return nt; }
+
+        // reentrant measurement: all the state of a track is kept in ws, nothing in FnuMomCoord is modified.
+        // nt is not filled, call FillNtuple(ws) from a single thread if needed.
+        float Measure(EdbTrackP *t, FnuMomWorkspace &ws, int file_type = 0) const;
+        float Measure(const FnuMomTrackData &t, FnuMomWorkspace &ws, int file_type = 0) const;
+        int SetTrackArray(EdbTrackP *t, int file_type, FnuMomWorkspace &ws) const;
+        int SetTrackArray(const FnuMomTrackData &t, int file_type, FnuMomWorkspace &ws) const;
+        void CalcPosDiff(int plate_num, FnuMomWorkspace &ws) const;
+        void CalcLatPosDiff(int plate_num, FnuMomWorkspace &ws) const;
+        void CalcPosDiffCell(int plate_num, int icell, FnuMomWorkspace &ws) const;
+        void CalcLatPosDiffCell(int plate_num, int icell, FnuMomWorkspace &ws) const;
+        void CalcCellDiffCell(int plate_num, int icell, FnuMomWorkspace &ws) const;
+        void CalcCellRMS(int plate_num, FnuMomWorkspace &ws) const;
+        float CalcMomCoord(EdbTrackP *t, int file_type, FnuMomWorkspace &ws) const;
+        float CalcMomCoord(const FnuMomTrackData &t, int file_type, FnuMomWorkspace &ws) const;
+        void FillNtuple(const FnuMomWorkspace &ws);
+        bool IsThreadSafe() const { return fit_engine == kAnalytic; }
+
+        // fitting engine for the RMS vs cell length graph
+        enum FitEngine { kMinuit = 0, kAnalytic = 1 };
+        void SetFitEngine(int engine) { fit_engine = engine; }
+        void SetNewtonRefine(bool refine) { newton_refine = refine; }
+
+        // kernel of CalcPosDiff and CalcCellRMS (FnuMomKernel), kKernelAuto takes the best one of the CPU
+        void SetKernel(int kernel) { simd_kernel = FnuMomKernelSelect(kernel); }
+        void SetKernelVerify(bool verify) { simd_verify = verify; }
+
+        // cell lengths used in the fit, CalcCellRMS computes only them if fitted_only
+        void SetFitCells(const std::vector<int> &cells);
+        void SetFittedCellsOnly(bool fitted_only) { fitted_cells_only = fitted_only; }
+        bool IsFitCell(int icell) const { return icell >= 1 && icell <= 40 && fit_cell[icell]; }
 
         // member function
     private:
+        double CalcScatteringTerm(double x, double z_eff) const;
+        void FitAnalytic(const double *gx, const double *gy, const double *gey, int npoint, int icell, double z_eff, double first_mom, float &Prec, float &sigma_error, float &inverse, float &inverse_error) const;
+        void FitMinuit(const FnuMomGraph &gr, int icell, double z_eff, double first_mom, float &Prec, float &sigma_error, float &inverse, float &inverse_error, float &sigma_error_inv) const;
+        ULong64_t TrackSeed(const FnuMomTrackData &t) const;
+
         // plate number 48 ~ 142
         // static const int nseg;  //number of segments
         // static const int icellMax;  //maximum of cell length
         int nseg;  //number of segments
         int npl; // number of plates
         int icellMax;  //maximum of cell length
-        int icell_cut;
         double ini_mom;
         double pos_reso;
         double smearing;  //smearing (micron)
@@ -87,16 +288,21 @@ class FnuMomCoord {
         double z;
         char *type;
         char *cal_s; // modify log, radiation length and typeAB error
+        int fit_engine; // kAnalytic (default) or kMinuit
+        bool newton_refine; // one Newton step on the chi2 after the linear solution
+        ULong64_t rand_seed; // base seed of the per-track smearing
+        int simd_kernel; // FnuMomKernel used in CalcPosDiff and CalcCellRMS
+        bool simd_verify; // compare the SIMD kernel with the scalar one for every track
+        bool fit_cell[41]; // fit_cell[icell] is true if icell is used in the fit
+        bool fitted_cells_only; // cell_mode fitted: RMS of the other cell lengths is not computed
         // std::vector<EdbTrackP*> v_TrackP;  //keep EdbTrackP
-        double cal_CoordArray[40]; // Coordでs_rmsをtrack,cell lengthに入れてる
-        double cal_LateralArray[40];
         double zArray[300];
-        double track_array[300][3];
-        double delta_array[600];
-        int allentryArray[40]; // keep allentry
-        int nentryArray[40];
-        int LateralEntryArray[40];
+        FnuMomWorkspace ws_; // workspace of the single thread interface
+        // fitting context of kMinuit, created once and reused for all the tracks (not in gROOT's list of functions)
+        TF1 *fit_mom; // Da1, Da3: momentum
+        TF1 *fit_inv; // Da2, Da4: inverse momentum
+        TGraphErrors *fit_graph;
         TNtuple *nt;
 };
 
-#endif
\ No newline at end of file
+#endif
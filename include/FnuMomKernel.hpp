@@ -0,0 +1,27 @@
+#ifndef _FNUMOMKERNEL_H_
+#define _FNUMOMKERNEL_H_
+
+#include<stdint.h>
+
+// Kernels of CalcPosDiff.
+// Sum of the squares of the second differences in X and Y over the triplets (i, i+icell, i+2*icell), 0 <= i < ntriplet,
+// where all the 3 plates are present:
+//     delta = x2 - x1 - (x1 - x0)/(z1 - z0) * (z2 - z1)
+// The SIMD kernels compute X and Y in one pass, the sum is the same as the scalar kernel except for the order of the additions.
+enum FnuMomKernel { kKernelAuto = -1, kKernelScalar = 0, kKernelAVX2 = 1, kKernelAVX512 = 2 };
+
+// best kernel supported by the CPU if request is kKernelAuto, otherwise request (or scalar if the CPU does not support it)
+int FnuMomKernelSelect(int request);
+int FnuMomKernelFromName(const char *name);
+const char* FnuMomKernelName(int kernel);
+
+void FnuMomSecondDiff(int kernel, const double *x, const double *y, const double *z, const uint8_t *present,
+                      int ntriplet, int icell, double &sum_square, int &nentry);
+
+// Kernels of CalcCellRMS: the second differences above and, from the same triplets in the same pass, the lateral
+// distance of (x2, y2) from the line through (x0, y0) and (x1, y1) (FnuMomCoord::CalcDistance, same operations as TVector3):
+//     sum_lateral = sum of distance^2, nlateral = number of the triplets
+void FnuMomCellDiff(int kernel, const double *x, const double *y, const double *z, const uint8_t *present,
+                    int ntriplet, int icell, double &sum_square, int &nentry, double &sum_lateral, int &nlateral);
+
+#endif
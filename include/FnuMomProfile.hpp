@@ -0,0 +1,103 @@
+#ifndef FNUMOMPROFILE_H_
+#define FNUMOMPROFILE_H_
+
+#include <string>
+#include <ostream>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Timed sections of the momentum measurement and its I/O. Sections do not nest, so the times add up.
+enum FnuMomTimer {
+	kTimeFileOpen = 0,	// open linked_tracks.root and set up the branches
+	kTimeIndex,			// load or build the MCEvt index (LinkedTracksIndex)
+	kTimeTreeRead,		// read the tracks from the tree
+	kTimeMatch,			// match the tracks of the vertex file / the truth (track index, TruthManager::IsTrack)
+	kTimeArrayFill,		// FnuMomCoord::SetTrackArray
+	kTimeDiff,			// FnuMomCoord::CalcCellRMS (the diff kernels)
+	kTimeKink,			// FnuMomCoord::ScanTrackAngleDiff in the measurement and CalcTrackAngleDiffMax
+	kTimeFit,			// fits of FnuMomCoord::CalcMomCoord
+	kTimeOutput,		// write the results
+	kNTimer
+};
+
+/**
+*	@class		FnuMomProfile
+*	@brief		Counters of the timed sections, summed over the threads.
+*	@detail
+*	Disabled by default, then a timer costs one relaxed atomic load. Each thread adds to its own slot, so the
+*	timers do not contend; the slots are summed when the report is printed (after the worker threads are idle).
+*	Times are thread seconds, with several threads they can exceed the wall time.
+*/
+class FnuMomProfile {
+  public:
+	static void Enable(bool enable = true) { enabled_.store(enable, std::memory_order_relaxed); }
+	static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+	static void Add(int timer, int64_t ns, long calls = 1);
+	static const char* Name(int timer);
+
+	// table of calls, total time, mean time per call and fraction of wall_seconds
+	static void Print(std::ostream& os, double wall_seconds);
+	// same as JSON, throws std::runtime_error if the file cannot be written
+	static void WriteJSON(std::string path, double wall_seconds);
+
+	struct Slot; // counters of one thread
+
+  private:
+	static Slot& LocalSlot();
+	static void Sum(int64_t* ns, long* calls);
+
+	static std::atomic<bool> enabled_;
+};
+
+/**
+*	@class		FnuMomScopedTimer
+*	@brief		Adds the time from the construction to the destruction to a FnuMomTimer if the profile is enabled.
+*/
+class FnuMomScopedTimer {
+  public:
+	explicit FnuMomScopedTimer(int timer) : timer_(timer), active_(FnuMomProfile::Enabled()) {
+		if (active_) start_ = std::chrono::steady_clock::now();
+	}
+	~FnuMomScopedTimer() {
+		if (!active_) return;
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+		FnuMomProfile::Add(timer_, ns);
+	}
+
+	FnuMomScopedTimer(const FnuMomScopedTimer&) = delete;
+	FnuMomScopedTimer& operator=(const FnuMomScopedTimer&) = delete;
+
+  private:
+	int timer_;
+	bool active_;
+	std::chrono::steady_clock::time_point start_;
+};
+
+/**
+*	@class		FnuMomStatusLine
+*	@brief		Progress on one line of stderr, rewritten at most every interval seconds.
+*	@detail
+*	On a terminal the line is overwritten in place, otherwise (e.g. a log file) a new line is written every
+*	log_interval seconds. Update is cheap when the line is not due, so it can be called for every item.
+*/
+class FnuMomStatusLine {
+  public:
+	FnuMomStatusLine(double interval = 0.5, double log_interval = 30);
+
+	// printf-like, the text is formatted only when the line is written
+	bool Due();
+	void Print(const char* format, ...);
+	// write the last line and end it
+	void Finish(const char* format, ...);
+
+  private:
+	void Write(const char* text, bool final);
+
+	bool tty_;
+	double interval_;
+	std::chrono::steady_clock::time_point last_;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef FNUMOMTRACKSIM_H_
+#define FNUMOMTRACKSIM_H_
+
+#include <string>
+#include <cstdint>
+#include <random>
+
+#include <EdbDataSet.h>
+
+#include "FnuMomCoord.hpp"
+
+/**
+*	@struct		FnuMomSimConfig
+*	@brief		Geometry and detector effects of FnuMomTrackSim
+*/
+struct FnuMomSimConfig {
+	FnuMomSimConfig() : z(1350.0), X0(4.677), pos_reso(0.2), missing(0.1), angle_sigma(0.05), kink_prob(0.0), kink_angle(0.05), first_plate(1) {}
+
+	// z, X0 and pos_reso of a parameter file of FnuMomCoord, the others are left as they are
+	void ReadParFile(std::string path);
+
+	double z;			// plate pitch (micron)
+	double X0;			// radiation length of one plate (mm)
+	double pos_reso;	// position resolution (micron)
+	double missing;		// probability that a segment is missing, never on the first and the last plate
+	double angle_sigma;	// RMS of the initial angle (rad)
+	double kink_prob;	// probability that a track has a kink
+	double kink_angle;	// RMS of the kink angle (rad) in each projection
+	int first_plate;
+};
+
+/**
+*	@class		FnuMomTrackSim
+*	@brief		Deterministic simulator of tracks for the momentum measurement, without MC files.
+*	@detail
+*	Straight tracks with multiple scattering: at each plate the angle gets a kick of the Highland theta0 for
+*	z / X0 in X and Y, the position is smeared by pos_reso, segments are dropped with the probability missing,
+*	and a kink (a larger kick on one plate in the middle half of the track) is added with the probability kink_prob.
+*	The random numbers come from std::mt19937_64 (its sequence is fixed by the standard) with a Box-Muller transform
+*	written here, and each track is seeded from (seed, id), so a track depends only on the seed and its arguments,
+*	not on the compiler, the ROOT version or the order of the generation.
+*/
+class FnuMomTrackSim {
+  public:
+	FnuMomTrackSim(const FnuMomSimConfig& config, uint64_t seed = 1);
+
+	// Track of momentum p (GeV) crossing nplate plates, t.mcevt = 100000 + id.
+	void Generate(double p, int nplate, int id, FnuMomTrackData& t);
+	// Same track as an EdbTrackP, delete it with LinkedTracksReader::DeleteTrack.
+	EdbTrackP* GenerateTrack(double p, int nplate, int id);
+	static EdbTrackP* MakeTrack(const FnuMomTrackData& t);
+
+	// kink of the last generated track, plate -1 if it has no kink
+	int KinkPlate() const { return kink_plate_; }
+	double KinkAngle() const { return kink_angle_; }
+
+	// theta0 of one plate for momentum p (GeV)
+	double Theta0(double p) const;
+
+	const FnuMomSimConfig& Config() const { return config_; }
+
+  private:
+	double Uniform();
+	double Gaus(double sigma);
+
+	FnuMomSimConfig config_;
+	uint64_t seed_;
+	std::mt19937_64 engine_;
+	bool has_spare_;
+	double spare_;
+	int kink_plate_;
+	double kink_angle_;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef LINKEDTRACKSFILE_H_
+#define LINKEDTRACKSFILE_H_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TEntryList.h>
+#include <TClonesArray.h>
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
+#include <TTreeReaderArray.h>
+
+#include <EdbDataSet.h>
+
+#include "FnuMomCoord.hpp"
+
+/**
+*	@struct		LinkedTracksFileInfo
+*	@brief		Health of a linked_tracks.root, one line of the manifest written by scan_files
+*/
+struct LinkedTracksFileInfo {
+	std::string path;
+	int event_id;		// Event ID in the path (evt_<ID>_), -1 if not found
+	long entries;		// Number of the tracks
+	long size;			// File size (bytes)
+	int mcevt_min;		// Range of s.eMCEvt, -1 if not scanned
+	int mcevt_max;
+	std::string status;	// "ok" or why the file cannot be used (no_event_id, cannot_open, zombie, no_tracks_tree, empty, index_failed)
+
+	bool IsValid() const { return status == "ok"; }
+};
+
+// "evt_(\d+)_" in str, the first match
+bool ExtractEventID(const std::string& str, int& event_id);
+
+// Open the file and check the tracks tree. The MCEvt range needs a pass over s.eMCEvt, skip it with mcevt_range = false.
+LinkedTracksFileInfo ScanLinkedTracksFile(std::string path, bool mcevt_range = true);
+
+// Manifest: tab separated path, event ID, entries, size, MCEvt min, MCEvt max, status. Lines starting with # are comments.
+void WriteManifest(std::string path, const std::vector<LinkedTracksFileInfo>& infos);
+std::vector<LinkedTracksFileInfo> ReadManifest(std::string path);
+
+/**
+*	@class		LinkedTracksReader
+*	@brief		Chunked reader of the tracks tree of linked_tracks.root.
+*	@detail
+*	Tracks are built in the same way as EdbDataProc::ReadTracksTree (segments and fitted segments are copied),
+*	but they are returned in chunks and are not kept in an EdbPVRec, so only one chunk is in memory.
+*	Tracks returned by ReadChunk are owned by the caller, delete them with DeleteTrack.
+*/
+class LinkedTracksReader {
+  public:
+	LinkedTracksReader(std::string path, std::string cut = "");
+	// read only the given entries (sorted), e.g. LinkedTracksIndex::Entries
+	LinkedTracksReader(std::string path, const std::vector<long>& entries);
+	~LinkedTracksReader();
+
+	LinkedTracksReader(const LinkedTracksReader&) = delete;
+	LinkedTracksReader& operator=(const LinkedTracksReader&) = delete;
+
+	// number of the tracks passing the cut
+	long NTracks() const { return ntrack_; }
+	long NRead() const { return next_; }
+
+	// Read the next tracks until max_tracks tracks or max_bytes (0: no limit) are read. Returns the number of the tracks, 0 at the end.
+	int ReadChunk(std::vector<EdbTrackP*>& tracks, int max_tracks, std::size_t max_bytes = 0);
+
+	// approximate memory of a track and its segments
+	static std::size_t TrackBytes(EdbTrackP* track);
+	static void DeleteTrack(EdbTrackP* track);
+
+  private:
+	void Open(std::string path);
+	EdbTrackP* ReadTrack(long entry);
+
+	TFile* file_;
+	TTree* tree_;
+	TEntryList* list_;
+	std::vector<long> entries_;
+	bool use_entries_;
+	long ntrack_;
+	long next_;
+
+	EdbSegP* trk_;
+	TClonesArray* seg_;
+	TClonesArray* segf_;
+};
+
+/**
+*	@class		LinkedTracksLiteReader
+*	@brief		Reader of the tracks tree of linked_tracks.root for the momentum measurement, without FEDRA objects.
+*	@detail
+*	Only the branches needed by FnuMomCoord::Measure and to identify the segments are read (t.eID, t.eP, npl and
+*	s.eX, s.eY, s.eZ, s.eTX, s.eTY, s.ePlate, s.eID, s.eMCEvt, s.eScanID.ePlate), directly into FnuMomTrackData.
+*	The fitted segments (sf) and the other members of EdbSegP are never decompressed.
+*	s.eMCEvt is read first and the other branches only for the tracks passing the MCEvt selection.
+*/
+class LinkedTracksLiteReader {
+  public:
+	LinkedTracksLiteReader(std::string path);
+	~LinkedTracksLiteReader();
+
+	LinkedTracksLiteReader(const LinkedTracksLiteReader&) = delete;
+	LinkedTracksLiteReader& operator=(const LinkedTracksLiteReader&) = delete;
+
+	// Append the tracks having a segment with MCEvt in event_ids (all the tracks if empty), same selection as
+	// ReadTracksTree with the cut "s.eMCEvt==a||s.eMCEvt==b||...". Returns the number of the tracks appended.
+	long ReadTracks(const std::vector<int>& event_ids, std::vector<FnuMomTrackData>& tracks);
+	// Append the tracks of the given entries, e.g. LinkedTracksIndex::Entries. Returns the number of the tracks appended.
+	long ReadEntries(const std::vector<long>& entries, std::vector<FnuMomTrackData>& tracks);
+
+	long NEntries() const { return tree_ -> GetEntries(); }
+
+  private:
+	void AddTrack(std::vector<FnuMomTrackData>& tracks);
+
+	TFile* file_;
+	TTree* tree_;
+	TTreeReader* reader_;
+	TTreeReaderValue<Int_t>* trk_id_;
+	TTreeReaderValue<Float_t>* trk_p_;
+	TTreeReaderValue<Int_t>* npl_;
+	TTreeReaderArray<Float_t>* x_;
+	TTreeReaderArray<Float_t>* y_;
+	TTreeReaderArray<Float_t>* z_;
+	TTreeReaderArray<Float_t>* tx_;
+	TTreeReaderArray<Float_t>* ty_;
+	TTreeReaderArray<Int_t>* plate_;
+	TTreeReaderArray<Int_t>* seg_id_;
+	TTreeReaderArray<Int_t>* mcevt_;
+	TTreeReaderArray<Int_t>* scan_plate_;
+};
+
+/**
+*	@class		LinkedTracksWriter
+*	@brief		Incremental writer of the tracks tree, same layout as EdbDataProc::MakeTracksTree.
+*	@detail
+*	Tracks are written one by one with Fill, the baskets are flushed to the file every auto_flush_bytes.
+*/
+class LinkedTracksWriter {
+  public:
+	LinkedTracksWriter(std::string path, long auto_flush_bytes = 32*1024*1024, float xv = 0, float yv = 0);
+	~LinkedTracksWriter();
+
+	LinkedTracksWriter(const LinkedTracksWriter&) = delete;
+	LinkedTracksWriter& operator=(const LinkedTracksWriter&) = delete;
+
+	void Fill(EdbTrackP* track);
+	void Close();
+	long NTracks() const { return ntrack_; }
+
+  private:
+	TFile* file_;
+	TTree* tree_;
+	long ntrack_;
+
+	EdbSegP* trk_;
+	TClonesArray* seg_;
+	TClonesArray* segf_;
+	int trid_, nseg_, npl_, n0_;
+	float xv_, yv_, w_;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef LINKEDTRACKSINDEX_H_
+#define LINKEDTRACKSINDEX_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+*	@class		LinkedTracksIndex
+*	@brief		MCEvt -> entry index of the tracks tree of linked_tracks.root, kept in a sidecar file.
+*	@detail
+*	The index has one (MCEvt, entry) pair for each MCEvt appearing in the segments of an entry, sorted by MCEvt and entry.
+*	It is built once by reading only s.eMCEvt and saved next to the file (<path>.mcidx), later the entries of an event
+*	are found by a binary search instead of evaluating a cut on every entry.
+*	The sidecar records the size and the modification time of linked_tracks.root and is rebuilt when they change.
+*
+*	Sidecar format (version 1), native byte order:
+*	Header, int32 MCEvt [npair], padding to 8 bytes, int64 entry [npair].
+*/
+class LinkedTracksIndex {
+  public:
+	struct Header {
+		char magic[8];		// "FNUMCIX"
+		uint32_t version;
+		uint32_t reserved;
+		uint64_t file_size;	// size of linked_tracks.root
+		int64_t file_mtime;	// modification time of linked_tracks.root
+		uint64_t nentries;	// entries of the tracks tree
+		uint64_t npair;
+	};
+
+	static const uint32_t kVersion = 1;
+
+	// Load the sidecar of path, or build the index if the sidecar is missing or stale (and save it if save).
+	LinkedTracksIndex(std::string path, bool save = true);
+
+	static std::string SidecarPath(std::string path) { return path + ".mcidx"; }
+
+	// Sorted entries having a segment with MCEvt in mcevts, same as the cut "s.eMCEvt==a||s.eMCEvt==b||...".
+	std::vector<long> Entries(const std::vector<int>& mcevts) const;
+	// Sorted entries having a segment with (MCEvt % mod) == event_id, same as the cut "(s.eMCEvt%mod)==event_id".
+	std::vector<long> EntriesMod(int event_id, int mod) const;
+
+	long NEntries() const { return nentries_; }
+	long NPair() const { return mcevt_.size(); }
+	bool Built() const { return built_; }	// true if the index was built, false if it was loaded from the sidecar
+
+  private:
+	bool Load(std::string sidecar, uint64_t file_size, int64_t file_mtime);
+	void Build(std::string path);
+	void Save(std::string sidecar, uint64_t file_size, int64_t file_mtime) const;
+
+	std::vector<int32_t> mcevt_;
+	std::vector<int64_t> entry_;
+	long nentries_;
+	bool built_;
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+/**
+*	@class		ThreadPool
+*	@brief		Fixed number of worker threads for loops over independent items.
+*	@detail
+*	ParallelFor(n, func) calls func(i, worker) for i=0..n-1 and returns after all the calls finished.
+*	worker is 0..NThreads()-1, so per-thread objects (e.g. FnuMomWorkspace) can be indexed with it.
+*	With 1 thread everything runs in the calling thread.
+*/
+class ThreadPool {
+
+	public:
+		ThreadPool(int nthreads = 1) : nthreads_(nthreads < 1 ? 1 : nthreads), generation_(0), running_(0), stop_(false), n_(0), next_(0) {
+			for (int w=1; w<nthreads_; w++) {
+				workers_.emplace_back(&ThreadPool::WorkerLoop, this, w);
+			}
+		}
+
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			cv_start_.notify_all();
+			for (auto& th: workers_) th.join();
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		int NThreads() const { return nthreads_; }
+
+		void ParallelFor(int n, const std::function<void(int, int)>& func) {
+			if (n <= 0) return;
+			if (nthreads_ == 1) {
+				for (int i=0; i<n; i++) func(i, 0);
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				func_ = &func;
+				n_ = n;
+				next_ = 0;
+				running_ = nthreads_ - 1;
+				generation_++;
+			}
+			cv_start_.notify_all();
+
+			// The calling thread works as worker 0.
+			Work(0);
+
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_done_.wait(lock, [this] { return running_ == 0; });
+			func_ = nullptr;
+		}
+
+	private:
+		void Work(int worker) {
+			int i;
+			while ((i = next_.fetch_add(1)) < n_) (*func_)(i, worker);
+		}
+
+		void WorkerLoop(int worker) {
+			long seen = 0;
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					cv_start_.wait(lock, [&] { return stop_ or generation_ != seen; });
+					if (stop_) return;
+					seen = generation_;
+				}
+
+				Work(worker);
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					running_--;
+				}
+				cv_done_.notify_one();
+			}
+		}
+
+		int nthreads_;
+		std::vector<std::thread> workers_;
+		std::mutex mutex_;
+		std::condition_variable cv_start_;
+		std::condition_variable cv_done_;
+		long generation_;	// incremented for each ParallelFor
+		int running_;		// workers which have not finished the current loop
+		bool stop_;
+		const std::function<void(int, int)>* func_ = nullptr;
+		int n_;
+		std::atomic<int> next_;
+};
+
+#endif
@@ -1,22 +1,99 @@
 #ifndef TRUTHMANAGER_H_
 #define TRUTHMANAGER_H_
 
-#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
 
 #include <EdbDataSet.h>
 
+/**
+*	@class		TruthManager
+*	@brief		MC truth of the selected particles, (MCEvt, MC track ID) pairs looked up by binary search.
+*	@detail
+*	The pairs are kept in the same layout as the index file (see Header), built from the truth trees or mapped
+*	from an index file with mmap, so both are accessed in the same way.
+*
+*	Index file format (version 1), native byte order:
+*	Header, then for each source truth file: uint64 size, int64 mtime, uint32 read_hadron, uint32 length, path [length],
+*	padded to 8 bytes. TruthID [npair] at pair_offset and int32 MCEvt [nevent] at event_offset, both sorted and unique.
+*/
 class TruthManager {
+  public:
+	struct TruthID {
+		int32_t event_id;	// MCEvt (event ID + 100000 as in FEDRA)
+		int32_t track_id;	// MC track ID
+
+		bool operator<(const TruthID& rhs) const {
+			return event_id < rhs.event_id or (event_id == rhs.event_id and track_id < rhs.track_id);
+		}
+	};
+
+	// truth file the index was built from, the index is stale if the size or the mtime changed
+	struct Source {
+		std::string path;
+		uint64_t size;
+		int64_t mtime;
+		bool read_hadron;	// 2ry particles of the numu were also read
+	};
+
+	struct Header {
+		char magic[8];		// "FNUTRIX"
+		uint32_t version;
+		uint32_t nsource;
+		uint64_t npair;
+		uint64_t nevent;
+		uint64_t pair_offset;
+		uint64_t event_offset;
+	};
+
+	static const uint32_t kVersion = 1;
+
   private:
-    std::map<int, std::vector<int>> uniqueID_; // <MCEvt, vector<MC track ID>>
+	std::vector<Source> sources_;
+    // (MCEvt, MC track ID) of the selected particles, sorted and unique. Looked up by binary search.
+	const TruthID* uniqueID_;
+	std::size_t npair_;
+	const int32_t* events_; // MCEvt of the selected events (also the ones without any particle), sorted and unique
+	std::size_t nevent_;
 	bool is_read_hadron_;
 
+	std::vector<char> buffer_;	// image built from the truth files
+	void* map_;					// or the index file mapped with mmap
+	std::size_t map_size_;
+
+	// read one truth file into pairs and events (sorted and unique), nothing in TruthManager is modified.
+	// Throws std::runtime_error if the file is not a truth file.
+	void ReadTruthEntries(std::string path, std::vector<std::pair<int, int>>& pairs, std::vector<int>& events) const;
+	// add the sources, the pairs and the events of some files and make them sorted and unique again
+	void Merge(const std::vector<Source>& sources, const std::vector<std::vector<std::pair<int, int>>>& pairs, const std::vector<std::vector<int>>& events);
+	void Attach(const char* data, std::size_t size, std::string path);
+	void Close();
+
+	static std::vector<char> Serialize(const std::vector<Source>& sources, const std::vector<std::pair<int, int>>& pairs, const std::vector<int>& events);
+	static Source StatSource(std::string path, bool read_hadron);
+
   public:
     TruthManager();
-    TruthManager(std::string input_file_path);
+    // Truth files listed in input_file_path are read with nthreads threads (0: number of the cores).
+    // With use_index, the index <input_file_path>.truthidx is loaded if it is up to date, otherwise it is rebuilt and saved.
+    TruthManager(std::string input_file_path, int nthreads = 0, bool use_index = true);
+	~TruthManager();
+
+	TruthManager(const TruthManager&) = delete;
+	TruthManager& operator=(const TruthManager&) = delete;
 
 	void SetReadHadron() { is_read_hadron_ = true; }
     void ReadTruthFile(std::string path);
 
+	static std::string IndexPath(std::string input_file_path) { return input_file_path + ".truthidx"; }
+	// Write the index, throws std::runtime_error if it cannot be written.
+	void WriteIndex(std::string path) const;
+	// Map the index. Returns false (and nothing is loaded) if it is missing, broken, or a source file has changed.
+	bool ReadIndex(std::string path);
+	const std::vector<Source>& Sources() const { return sources_; }
+
     bool IsTrack(EdbTrackP* track);
 
     bool IsNumu(int event_id);
@@ -0,0 +1,191 @@
+#ifndef VERTEXFILE_H_
+#define VERTEXFILE_H_
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+/**
+*	@class		VertexFile
+*	@brief		Vertex file (1ry_vtx / 1ry_trk) shared by the momentum tools.
+*	@detail
+*	Two formats are supported.
+*	- text: the tab separated 1ry_vtx / 1ry_trk lines written by calc_momentum.
+*	- binary (*.vtxb): columns of the vertices and the tracks, see Column for the layout.
+*
+*	Open() maps a binary file with mmap and the columns point into the mapping, nothing is copied.
+*	A text file is parsed and converted to the same layout in memory, so both formats are accessed in the same way.
+*	Tracks are stored in vertex order and tracks of vertex i are [TrackBegin(i), TrackEnd(i)).
+*	Tracks of no vertex (1ry_trk lines before the first 1ry_vtx) are kept in [0, TrackBegin(0)) with ivertex = -1.
+*/
+class VertexFile {
+  public:
+	struct Track {
+		int event_id;		// Event ID
+		int plate_id;		// Plate of first segment
+		int seg_id;			// Segment ID of first segment
+		double x_first;		// X of first segment
+		double y_first;		// Y of first segment
+		int plate_id_last;	// Plate of last segment
+		int npl;			// Number of plates
+		int pdg_id;			// PDG ID
+		double p_true;		// Truth momenum
+		double p_reco;		// Reconstructed momentum
+		int ivertex;		// Index of the vertex
+	};
+
+	struct Vertex {
+		int area_id;		// Area ID
+		double vx;
+		double vy;
+		int plate;
+		int ntrk;
+		int ivertex;		// Index of the vertex
+	};
+
+	/**
+	*	Binary format (version 1), native byte order.
+	*	Header, then the byte offset (uint64) of each column from the beginning of the file.
+	*	Each column starts at a multiple of 8 bytes. A reader accepts files with more columns than it knows.
+	*/
+	enum Column {
+		kVtxAreaID = 0,		// int32 [nvertex]
+		kVtxX,				// double [nvertex]
+		kVtxY,				// double [nvertex]
+		kVtxPlate,			// int32 [nvertex]
+		kVtxNtrk,			// int32 [nvertex]
+		kVtxTrackOffset,	// int64 [nvertex+1], tracks of vertex i are [offset[i], offset[i+1])
+		kTrkIVertex,		// int32 [ntrack]
+		kTrkEventID,		// int32 [ntrack]
+		kTrkPlateID,		// int32 [ntrack]
+		kTrkSegID,			// int32 [ntrack]
+		kTrkX,				// double [ntrack]
+		kTrkY,				// double [ntrack]
+		kTrkPlateIDLast,	// int32 [ntrack]
+		kTrkNpl,			// int32 [ntrack]
+		kTrkPdgID,			// int32 [ntrack]
+		kTrkPTrue,			// double [ntrack]
+		kTrkPReco,			// double [ntrack]
+		kNColumn
+	};
+
+	struct Header {
+		char magic[8];		// "FNUVTXB"
+		uint32_t version;
+		uint32_t ncolumn;
+		uint64_t nvertex;
+		uint64_t ntrack;
+	};
+
+	static const uint32_t kVersion = 1;
+
+	VertexFile();
+	VertexFile(std::string path);
+	~VertexFile();
+
+	VertexFile(const VertexFile&) = delete;
+	VertexFile& operator=(const VertexFile&) = delete;
+
+	void Open(std::string path);
+	void Close();
+	bool IsMapped() const { return map_ != nullptr; }
+
+	long NVertex() const { return nvertex_; }
+	long NTrack() const { return ntrack_; }
+	long TrackBegin(long ivertex) const { return offset_[ivertex]; }
+	long TrackEnd(long ivertex) const { return offset_[ivertex+1]; }
+
+	Vertex GetVertex(long i) const;
+	Track GetTrack(long j) const;
+	void ToVectors(std::vector<Vertex>& verteces, std::vector<Track>& tracks) const;
+
+	// Columns. Valid until Close().
+	const int* VtxAreaID() const { return vtx_area_id_; }
+	const double* VtxX() const { return vtx_x_; }
+	const double* VtxY() const { return vtx_y_; }
+	const int* VtxPlate() const { return vtx_plate_; }
+	const int* VtxNtrk() const { return vtx_ntrk_; }
+	const int* TrkIVertex() const { return trk_ivertex_; }
+	const int* TrkEventID() const { return trk_event_id_; }
+	const int* TrkPlateID() const { return trk_plate_id_; }
+	const int* TrkSegID() const { return trk_seg_id_; }
+	const double* TrkX() const { return trk_x_; }
+	const double* TrkY() const { return trk_y_; }
+	const int* TrkPlateIDLast() const { return trk_plate_id_last_; }
+	const int* TrkNpl() const { return trk_npl_; }
+	const int* TrkPdgID() const { return trk_pdg_id_; }
+	const double* TrkPTrue() const { return trk_p_true_; }
+	const double* TrkPReco() const { return trk_p_reco_; }
+
+	void Write(std::string path) const;
+
+	// Shard (0 ... nshard-1) of vertex i in calc_momentum --shard i/N, decided by the event ID of its first track.
+	int ShardOf(long ivertex, int nshard) const;
+	static int ShardOfEvent(int event_id, int nshard);
+
+	static bool IsBinaryFile(std::string path);
+	static bool IsBinaryPath(std::string path);
+	static void ReadText(std::string path, std::vector<Vertex>& verteces, std::vector<Track>& tracks);
+	static void Write(std::string path, const std::vector<Vertex>& verteces, const std::vector<Track>& tracks);
+	static void WriteText(std::string path, const std::vector<Vertex>& verteces, const std::vector<Track>& tracks);
+	static void WriteBinary(std::string path, const std::vector<Vertex>& verteces, const std::vector<Track>& tracks);
+	static std::vector<char> Serialize(const std::vector<Vertex>& verteces, const std::vector<Track>& tracks);
+
+  private:
+	void Attach(const char* data, std::size_t size, std::string path);
+
+	void* map_;					// mmap of a binary file
+	std::size_t map_size_;
+	std::vector<char> buffer_;	// binary image of a text file
+
+	long nvertex_;
+	long ntrack_;
+	const int64_t* offset_;
+	const int* vtx_area_id_;
+	const double* vtx_x_;
+	const double* vtx_y_;
+	const int* vtx_plate_;
+	const int* vtx_ntrk_;
+	const int* trk_ivertex_;
+	const int* trk_event_id_;
+	const int* trk_plate_id_;
+	const int* trk_seg_id_;
+	const double* trk_x_;
+	const double* trk_y_;
+	const int* trk_plate_id_last_;
+	const int* trk_npl_;
+	const int* trk_pdg_id_;
+	const double* trk_p_true_;
+	const double* trk_p_reco_;
+};
+
+/**
+*	@class		VertexStream
+*	@brief		Reads a vertex file one vertex at a time, in one pass.
+*	@detail
+*	A text file is parsed line by line and only the current vertex and its tracks are in memory.
+*	A binary file is mapped with VertexFile and read in order, its pages are loaded as they are read.
+*/
+class VertexStream {
+  public:
+	VertexStream(std::string path);
+
+	VertexStream(const VertexStream&) = delete;
+	VertexStream& operator=(const VertexStream&) = delete;
+
+	// Next vertex and its tracks (ivertex is the index in the file), false at the end of the file.
+	bool Next(VertexFile::Vertex& vertex, std::vector<VertexFile::Track>& tracks);
+	long NRead() const { return nread_; }
+
+  private:
+	bool is_binary_;
+	VertexFile binary_;
+	std::ifstream ifs_;
+	std::string line_;
+	bool has_vertex_;					// next_vertex_ is read and its tracks follow
+	VertexFile::Vertex next_vertex_;
+	long nread_;
+};
+
+#endif
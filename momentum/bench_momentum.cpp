@@ -0,0 +1,316 @@
+/**
+*	@file		bench_momentum.cpp
+*	@brief		FnuMomCoordの運動量測定のbenchmark
+*	@detail
+*	par fileのgeometry (z, X0, pos_reso) で直線+多重散乱のtrackをFnuMomTrackSimで生成し、測定の各段階
+*	(SetTrackArray, CalcPosDiff, CalcLatPosDiff, CalcCellRMS, CalcMomCoord, CalcTrackAngleDiffMax, ScanTrackAngleDiff)
+*	と測定全体 (Measure) の時間を、運動量とplate数の組み合わせごとに測る。
+*	各trackは自分のworkspaceを持つので、前の段階の結果を使って各段階を別々に繰り返し測れる。
+*	1 trackあたりの時間 (ns/track)、plateあたりの時間 (ns/plate)、tracks/s、operator newの回数 (allocs/track) を出力する。
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+
+#include <EdbDataSet.h>
+
+#include "FnuMomCoord.hpp"
+#include "LinkedTracksFile.hpp"
+#include "FnuMomTrackSim.hpp"
+
+// operator newの回数。FnuAlignedAllocator (posix_memalign) の確保は数えない。
+std::atomic<long> alloc_count(0);
+
+void* operator new(std::size_t size) {
+	alloc_count.fetch_add(1, std::memory_order_relaxed);
+	void* p = std::malloc(size > 0 ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+
+/**
+*	@struct		BenchResult
+*	@brief		1つのbenchmarkの結果
+*/
+struct BenchResult {
+	std::string stage;
+	double p;			// 生成したtrackの運動量 (GeV)
+	int nplate;			// 生成したtrackのplate数
+	double plates;		// 測定に使われた平均plate数 (SetTrackArrayの戻り値)
+	double ns_per_track;
+	double allocs_per_track;
+	long iterations;	// 全trackを通した回数
+};
+
+FnuMomCoord* mc;
+FnuMomSimConfig sim_config;
+std::vector<double> momenta = {1, 10, 100, 1000};
+std::vector<int> plate_counts = {50, 100, 200, 400, 730};
+int ntrack = 100;
+double min_time = 0.2;
+unsigned int seed = 1;
+bool keep_limits = false;
+std::string filter;
+volatile double sink; // 結果を使って計算が消されないようにする
+
+
+/**
+*	@fn			PrintUsage
+*	@brief		プログラムの使用方法を出力する
+*	@return		void
+*/
+void PrintUsage() {
+	std::cerr << "Usage: " << std::endl;
+	std::cerr << "./bench_momentum -P <par file> [-p 1,10,100,1000] [-n 50,100,200,400,730] [-t <tracks>] [--min-time <s>]" << std::endl;
+	std::cerr << "                 [--missing <fraction>] [--seed <seed>] [--keep-limits] [--filter <stage>] [-O <csv>]" << std::endl;
+	return;
+}
+
+/**
+*	@fn			SplitList
+*	@brief		カンマ区切りの数値を読む
+*	@param[in]	str		"1,10,100"
+*	@return		数値のリスト
+*/
+template<typename T>
+std::vector<T> SplitList(std::string str) {
+	std::vector<T> values;
+	std::stringstream ss(str);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (item.empty()) continue;
+		std::stringstream is(item);
+		T value;
+		if (!(is >> value)) {
+			std::cerr << "Error: Invalid value in the list: " << str << std::endl;
+			exit(1);
+		}
+		values.push_back(value);
+	}
+	return values;
+}
+
+/**
+*	@fn			GenerateTracks
+*	@brief		FnuMomTrackSimでtrackを生成する
+*	@param[in]	p			運動量 (GeV)
+*	@param[in]	nplate		plate数
+*	@param[out]	data		FnuMomTrackData
+*	@param[out]	tracks		同じtrackのEdbTrackP (CalcTrackAngleDiffMax用)、LinkedTracksReader::DeleteTrackで消す
+*	@return		void
+*/
+void GenerateTracks(double p, int nplate, std::vector<FnuMomTrackData>& data, std::vector<EdbTrackP*>& tracks) {
+	FnuMomTrackSim sim(sim_config, seed);
+	data.assign(ntrack, FnuMomTrackData());
+	tracks.assign(ntrack, nullptr);
+	for (int itrk=0; itrk<ntrack; itrk++) {
+		sim.Generate(p, nplate, itrk, data[itrk]);
+		tracks[itrk] = FnuMomTrackSim::MakeTrack(data[itrk]);
+	}
+}
+
+/**
+*	@fn			RunBench
+*	@brief		全trackを通す1回 (pass) をmin_time秒以上繰り返して時間とallocation数を測る
+*	@param[in]	pass	全trackについて測る処理を1回ずつ行う関数
+*	@return		1 trackあたりの時間 (ns) とallocation数、繰り返し回数 (platesは呼び出し側で入れる)
+*	@detail		最初の1回はwarm-upとして測らない。
+*/
+template<typename Pass>
+BenchResult RunBench(Pass pass) {
+	pass();
+
+	long allocs = alloc_count.load();
+	long iterations = 0;
+	double elapsed = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (elapsed < min_time or iterations < 3) {
+		pass();
+		iterations++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	allocs = alloc_count.load() - allocs;
+
+	BenchResult result;
+	result.iterations = iterations;
+	result.ns_per_track = elapsed * 1e9 / (iterations * (double) ntrack);
+	result.allocs_per_track = allocs / (iterations * (double) ntrack);
+	return result;
+}
+
+/**
+*	@fn			BenchConfig
+*	@brief		1つの運動量、plate数で各段階を測る
+*	@param[in]	p
+*	@param[in]	nplate
+*	@param[out]	results		結果を追加する
+*	@return		void
+*/
+void BenchConfig(double p, int nplate, std::vector<BenchResult>& results) {
+	std::vector<FnuMomTrackData> data;
+	std::vector<EdbTrackP*> tracks;
+	GenerateTracks(p, nplate, data, tracks);
+
+	if (!keep_limits) mc -> SetPlateLimits(nplate, nplate);
+
+	std::vector<FnuMomWorkspace> ws(ntrack);
+	std::vector<int> plate_num(ntrack);
+	double plates = 0;
+	for (int i=0; i<ntrack; i++) {
+		plate_num[i] = mc -> SetTrackArray(data[i], 0, ws[i]);
+		mc -> CalcCellRMS(plate_num[i], ws[i]);
+		plates += plate_num[i];
+	}
+	plates /= ntrack;
+
+	auto add = [&](std::string stage, BenchResult result) {
+		result.stage = stage;
+		result.p = p;
+		result.nplate = nplate;
+		result.plates = plates;
+		results.push_back(result);
+
+		char name[128];
+		snprintf(name, sizeof(name), "%s/p:%g/plates:%d", stage.c_str(), p, nplate);
+		printf("%-48s %12.1f %10.2f %12.4g %13.2f %10ld\n", name, result.ns_per_track, result.ns_per_track / plates,
+				1e9 / result.ns_per_track, result.allocs_per_track, result.iterations);
+		fflush(stdout);
+	};
+	auto selected = [&](std::string stage) {
+		return filter.empty() or stage.find(filter) != std::string::npos;
+	};
+
+	// CalcPosDiff, CalcLatPosDiff and CalcMomCoord use the array set by SetTrackArray (and the RMS of CalcCellRMS),
+	// which is kept in the workspace of each track.
+	if (selected("SetTrackArray")) add("SetTrackArray", RunBench([&]() {
+		for (int i=0; i<ntrack; i++) plate_num[i] = mc -> SetTrackArray(data[i], 0, ws[i]);
+	}));
+	if (selected("CalcPosDiff")) add("CalcPosDiff", RunBench([&]() {
+		for (int i=0; i<ntrack; i++) mc -> CalcPosDiff(plate_num[i], ws[i]);
+	}));
+	if (selected("CalcLatPosDiff")) add("CalcLatPosDiff", RunBench([&]() {
+		for (int i=0; i<ntrack; i++) mc -> CalcLatPosDiff(plate_num[i], ws[i]);
+	}));
+	// cell_mode of the parameter file, as in Measure
+	if (selected("CalcCellRMS")) add("CalcCellRMS", RunBench([&]() {
+		for (int i=0; i<ntrack; i++) mc -> CalcCellRMS(plate_num[i], ws[i]);
+	}));
+	if (selected("CalcMomCoord")) add("CalcMomCoord", RunBench([&]() {
+		for (int i=0; i<ntrack; i++) sink = mc -> CalcMomCoord(data[i], 0, ws[i]);
+	}));
+	if (selected("CalcTrackAngleDiffMax")) add("CalcTrackAngleDiffMax", RunBench([&]() {
+		for (int i=0; i<ntrack; i++) sink = mc -> CalcTrackAngleDiffMax(tracks[i]);
+	}));
+	if (selected("ScanTrackAngleDiff")) add("ScanTrackAngleDiff", RunBench([&]() {
+		for (int i=0; i<ntrack; i++) sink = mc -> ScanTrackAngleDiff(data[i]).angle_diff_max;
+	}));
+	// end to end, as in calc_momentum
+	if (selected("Measure")) add("Measure", RunBench([&]() {
+		for (int i=0; i<ntrack; i++) sink = mc -> Measure(data[i], ws[i], 0);
+	}));
+
+	for (EdbTrackP* track: tracks) LinkedTracksReader::DeleteTrack(track);
+}
+
+/**
+*	@fn			WriteCSV
+*	@brief		結果をcsvで書き出す (変更前後の比較用)
+*	@param[in]	path
+*	@param[in]	results
+*	@return		void
+*/
+void WriteCSV(std::string path, const std::vector<BenchResult>& results) {
+	std::ofstream ofs(path);
+	if (ofs.fail()) {
+		std::cerr << "Error! Could not open the file: " << path << std::endl;
+		exit(1);
+	}
+
+	ofs << "stage,p,nplate,plates,ns_per_track,ns_per_plate,tracks_per_s,allocs_per_track,iterations" << std::endl;
+	for (const BenchResult& r: results) {
+		ofs << r.stage << "," << r.p << "," << r.nplate << "," << r.plates << "," << r.ns_per_track << ","
+			<< r.ns_per_track / r.plates << "," << 1e9 / r.ns_per_track << "," << r.allocs_per_track << "," << r.iterations << std::endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string par_file;
+	std::string output_csv;
+
+	// -P: Path of parameter file for momentum measurement
+	// -p: Momenta of the generated tracks (GeV), comma separated
+	// -n: Numbers of plates of the generated tracks, comma separated
+	// -t: Number of tracks of each momentum and number of plates
+	// -O: Path of output csv
+	// --min-time: Minimum time of each benchmark (s)
+	// --missing: Fraction of the missing segments
+	// --seed: Seed of the generation
+	// --keep-limits: Keep nseg and npl of the parameter file (longer tracks are cut), otherwise all the plates are used
+	// --filter: Run only the stages whose name contains the string
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--keep-limits") {
+			keep_limits = true;
+			continue;
+		}
+		if (i+1 >= argc) break;
+		if (arg == "-P") par_file = argv[++i];
+		else if (arg == "-p") momenta = SplitList<double>(argv[++i]);
+		else if (arg == "-n") plate_counts = SplitList<int>(argv[++i]);
+		else if (arg == "-t") ntrack = std::stoi(argv[++i]);
+		else if (arg == "-O") output_csv = argv[++i];
+		else if (arg == "--min-time") min_time = std::stod(argv[++i]);
+		else if (arg == "--missing") sim_config.missing = std::stod(argv[++i]);
+		else if (arg == "--seed") seed = std::stoul(argv[++i]);
+		else if (arg == "--filter") filter = argv[++i];
+		else i++;
+	}
+	if (par_file.empty()) {
+		std::cerr << "Error: Argument missing!" << std::endl;
+		PrintUsage();
+		exit(1);
+	}
+	for (int nplate: plate_counts) {
+		if (nplate < 5) {
+			std::cerr << "Error: Number of plates must be at least 5: " << nplate << std::endl;
+			exit(1);
+		}
+	}
+	if (ntrack < 1) {
+		std::cerr << "Error: Number of tracks must be positive: " << ntrack << std::endl;
+		exit(1);
+	}
+
+	sim_config.ReadParFile(par_file);
+	mc = new FnuMomCoord();
+	mc -> ReadParFile(par_file);
+	mc -> ShowPar();
+	printf("z = %.1f micron, X0 = %.3f mm, pos_reso = %.2f micron, missing = %.2f, %d tracks per configuration%s\n\n",
+			sim_config.z, sim_config.X0, sim_config.pos_reso, sim_config.missing, ntrack,
+			keep_limits ? Form(", nseg = %d, npl = %d", mc -> NSeg(), mc -> NPl()) : "");
+
+	printf("%-48s %12s %10s %12s %13s %10s\n", "Benchmark", "ns/track", "ns/plate", "tracks/s", "allocs/track", "iterations");
+	std::vector<BenchResult> results;
+	for (double p: momenta) {
+		for (int nplate: plate_counts) BenchConfig(p, nplate, results);
+	}
+
+	if (!output_csv.empty()) WriteCSV(output_csv, results);
+
+	return 0;
+}
@@ -12,180 +12,187 @@
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <regex>
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+
+#include <unistd.h>
+#include <sys/stat.h>
 
-#include <TFile.h>
-#include <TTree.h>
 #include <TString.h>
 #include <TCanvas.h>
+#include <TROOT.h>
 
 #include <EdbDataSet.h>
 
 #include "EdbEDAUtil.h"
 #include "FnuMomCoord.hpp"
+#include "ThreadPool.hpp"
+#include "BoundedQueue.hpp"
+#include "VertexFile.hpp"
+#include "LinkedTracksFile.hpp"
+#include "LinkedTracksIndex.hpp"
+#include "FnuMomProfile.hpp"
+
+// Track and Vertex are shared with the other tools through VertexFile.
+using Track = VertexFile::Track;
+using Vertex = VertexFile::Vertex;
+
 
 /**
-*	@struct		Track
-*	@brief		To specify track uniquely
+*	@struct		VertexRange
+*	@brief		Tracks of one vertex, tracks[start, end)
 */
-struct Track {
-	int event_id;		// Event ID
-	int plate_id;		// Plate of first segment
-	int seg_id;			// Segment ID of first segment
-	double x_first;		// X of first segment
-	double y_first;		// Y of first segment
-	int plate_id_last;	// Plate of last segment
-	int npl;			// Number of plates
-	int pdg_id;			// PDG ID
-	double p_true;		// Truth momenum
-	double p_reco;		// Reconstructed momentum
-	int ivertex;		// Index of the vertex
+struct VertexRange {
+	int event_id;		// Event ID of the vertex
+	int start;			// First index in tracks
+	int end;			// Last index in tracks + 1
 };
 
 
 /**
-*	@struct		Vertex
-*	@brief		To specify vertex uniquely
+*	@struct		TrackKey
+*	@brief		Key of a segment in linked_tracks.root, (MCEvt, plate, segment ID)
+*	@detail		MCEvt is compared exactly as in FillMomentum of the baseline. The files evt_{event ID + i*100000} also hold
+*				other events with the same MCEvt%100000, whose segments can share (plate, segment ID) with the vertex.
 */
-struct Vertex {
-	int area_id;		// Area ID
-	double vx;
-	double vy;
-	int plate;
-	int ntrk;
-	int ivertex;		//Index of the vertex
+struct TrackKey {
+	int event_id;		// MCEvt of the segment
+	int plate_id;		// Plate of the segment
+	int seg_id;			// Segment ID
+
+	bool operator==(const TrackKey& rhs) const {
+		return event_id == rhs.event_id and plate_id == rhs.plate_id and seg_id == rhs.seg_id;
+	}
 };
 
-// Global variables.
-std::vector<Track> tracks;
-std::vector<Vertex> verteces;
-std::vector<std::string> files;
-std::vector<std::string> invalid_files;
-FnuMomCoord mc; // For momentum measurement.
-EdbDataProc* dproc;
-EdbPVRec* pvr;
+struct TrackKeyHash {
+	std::size_t operator()(const TrackKey& key) const {
+		std::size_t h = std::hash<int>()(key.event_id);
+		h = h * 31 + std::hash<int>()(key.plate_id);
+		h = h * 31 + std::hash<int>()(key.seg_id);
+		return h;
+	}
+};
 
+using TrackIndex = std::unordered_map<TrackKey, const FnuMomTrackData*, TrackKeyHash>;
 
-// To sort Track structure.
-bool compareTrackId(const Track& track, const Track& target_track) {
-	return track.event_id < target_track.event_id;
-}
 
-// Sort with ivertex.
-template<typename T>
-bool compareIVertex(const T& struct1, const T& struct2) {
-	return struct1.ivertex < struct2.ivertex;
-}
+/**
+*	@struct		FileBatch
+*	@brief		One linked_tracks.root passed through the read -> measure -> write stages
+*/
+struct FileBatch {
+	int event_id;								// Event ID of the file
+	const std::vector<VertexRange>* ranges;		// Verteces measured with the file
+	std::vector<FnuMomTrackData> trks;			// Tracks of the file
+	TrackIndex index;							// Index of trks
+	std::vector<std::pair<int, float>> results;	// <index in tracks, p_reco>
+};
 
-/*
-*	@fn			ExtractEventID
-*	@param[in]	str		文字列
+
+/**
+*	@struct		StageCounter
+*	@brief		Throughput of a pipeline stage, printed at exit
 */
-int ExtractEventID(std::string str, std::string pattern="evt_(\\d+)_") {
-	std::regex regex(pattern);
-	std::smatch match;
-	std::string event_id;
-
-	if (std::regex_search(str, match, regex) && match.size() > 1) {
-		event_id = match.str(1);
-	} else {
+struct StageCounter {
+	const char* name;
+	long nfile = 0;		// Number of the files processed
+	long ntrack = 0;	// Number of the tracks processed
+	double busy = 0;	// Time spent in the stage (s)
+	double wait = 0;	// Time spent waiting for the queues (s)
+};
+
+// Global variables.
+std::vector<Track> tracks;
+std::vector<Vertex> verteces;
+std::vector<long> track_begin; // tracks of verteces[i] are tracks[track_begin[i], track_begin[i+1])
+std::unordered_map<int, std::string> files; // <event ID, path of linked_tracks.root>
+std::vector<std::string> invalid_files;
+bool files_scanned = false; // files were read from a manifest of scan_files.
+FnuMomCoord mc; // For momentum measurement.
+int nthreads = 1; // Number of threads for momentum measurement.
+int queue_depth = 2; // Number of the files read ahead / waiting for the writer.
+int shard_index = 0; // This process measures the verteces of shard shard_index of nshard.
+int nshard = 1;
+EdbDataProc* dproc; // Used only by the read stage with --full-read.
+bool full_read = false; // Read the tracks with EdbDataProc::ReadTracksTree instead of LinkedTracksLiteReader.
+std::string checkpoint_file; // Sidecar of the measured p_reco, <output>.ckpt by default.
+bool resume = false; // Skip the files already in checkpoint_file.
+double checkpoint_interval = 60; // Seconds between the fsync of checkpoint_file.
+FILE* checkpoint = nullptr;
+std::string checkpoint_error; // Set by AppendCheckpoint when a write fails, reported by Run.
+const char* checkpoint_inputs[3] = {nullptr, nullptr, nullptr}; // -V, -I (or -M) and -P, identified in the checkpoint header.
+std::unordered_set<int> done_files; // Event IDs of the files measured in the previous run.
+StageCounter read_counter = {"read"};
+StageCounter measure_counter = {"measure"};
+StageCounter write_counter = {"write"};
+bool profile = false; // Print the time of each section (FnuMomProfile) at exit.
+std::string profile_json; // Write the profile to this file as JSON.
+
+
+int ExtractEventID(const std::string& str) {
+	int event_id;
+	if (!ExtractEventID(str, event_id)) {
 		std::cerr << "Error: Couldn't extract Track ID from the filename." << std::endl;
 		exit(1);
 	}
 
-	return std::stoi(event_id);
+	return event_id;
 }
 
-/*
-*	@fn			compareFile
-*	@brief		To sort path of linked_tracks.root with event ID.
-*	@param[in]
-*	@param[in]
-*	@return		bool
+/**
+*	@fn			ParseShard
+*	@brief		"i/N"をshard_index, nshardに読む
+*	@param[in]	str
+*	@return		void
 */
-bool CompareFile(const std::string& lhs, std::string& rhs) {
-	int lhs_event_id = ExtractEventID(lhs);
-	int rhs_event_id = ExtractEventID(rhs);
-	return lhs_event_id < rhs_event_id;
+void ParseShard(const std::string& str) {
+	std::size_t pos = str.find('/');
+	try {
+		if (pos == std::string::npos) throw std::invalid_argument(str);
+		shard_index = std::stoi(str.substr(0, pos));
+		nshard = std::stoi(str.substr(pos + 1));
+	} catch (const std::exception& e) {
+		std::cerr << "Error: --shard must be i/N, e.g. --shard 0/4." << std::endl;
+		exit(1);
+	}
+	if (nshard < 1 or shard_index < 0 or shard_index >= nshard) {
+		std::cerr << "Error: --shard " << str << " is out of range (0 <= i < N)." << std::endl;
+		exit(1);
+	}
 }
 
 /**
 *	@fn			ReadVertexFile
 *	@brief		Vertex fileを読み込んで構造体に詰める。
-*	@param[in]	vtx_file	Vertex fileのパス
+*	@param[in]	vtx_file	Vertex fileのパス (textまたはbinary)
 *	@return		void
+*	@detail
+*	tracksはvertex順に並んでいて、vertexごとの範囲はtrack_beginに入る。p_recoは-999で初期化する。
 */
 void ReadVertexFile(std::string vtx_file) {
-	std::ifstream ifs(vtx_file);
-
-	if (ifs.fail()) {
-		std::cerr << "Failed to open this file." << std::endl;
+	try {
+		VertexFile vf(vtx_file);
+		vf.ToVectors(verteces, tracks);
+
+		track_begin.resize(vf.NVertex() + 1);
+		for (long i=0; i<=vf.NVertex(); i++) track_begin[i] = vf.TrackBegin(i);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
 		exit(1);
 	}
 
-	std::string type_name; // 1ry_vtx or 1ry_track.
-
-	// Variables for tracks.
-	int plate_id_first, seg_id_first, plate_id_last, npl, pdg_id, event_id;
-	float x_first, y_first, p_true, p_reco;
-
-	// Variables for veteces.
-	int area_id, plate_id, ntrk;
-	double vx, vy;
-
-	// For the matching between vertex and tracks;
-	int ivertex = -1;
-
-	std::string line_buf;
-	while (std::getline(ifs, line_buf)) {
-
-		// Format input data.
-		auto it = std::unique(line_buf.begin(),line_buf.end(),
-            [](char const &lhs, char const &rhs) {
-                return (lhs == rhs) && (lhs == ' ');
-		});
-		//line_buf.erase(it,line_buf.end());
-
-		std::istringstream iss(line_buf);
-		iss >> type_name;
-		if (type_name == "1ry_trk") {
-			iss >> plate_id_first >> seg_id_first >> x_first >> y_first >> plate_id_last >> npl >> pdg_id >> p_true >> p_reco >> event_id;
-
-			Track track;
-			track.event_id = event_id;
-			track.plate_id = plate_id_first;
-			track.seg_id = seg_id_first;
-			track.ivertex = ivertex;
-			track.x_first = x_first;
-			track.y_first = y_first;
-			track.plate_id_last = plate_id_last;
-			track.npl = npl;
-			track.pdg_id = pdg_id;
-			track.p_true = p_true;
-			track.p_reco = -999;
-			track.ivertex = ivertex;
-
-			tracks.push_back(track);
-		} else if (type_name == "1ry_vtx") {
-			ivertex ++;
-			iss >> area_id >> vx >> vy >> plate_id >> ntrk;
-
-			Vertex vertex;
-			vertex.area_id = area_id;
-			vertex.vx = vx;
-			vertex.vy = vy;
-			vertex.plate = plate_id;
-			vertex.ntrk = ntrk;
-			vertex.ivertex = ivertex;
-
-			verteces.push_back(vertex);
-		}
-	}
-
-	// Sort for binary search.
-	//std::sort(tracks.begin(), tracks.end(), compareTrackId);
-	std::sort(tracks.begin(), tracks.end(), compareIVertex<Track>);
+	for (Track& track: tracks) track.p_reco = -999;
 }
 
 /**
@@ -195,6 +202,8 @@ void ReadVertexFile(std::string vtx_file) {
 *	@par		Modify
 *		- files
 *	@return		void
+*	@detail
+*	event IDが同じパスが複数ある場合は最初のものを使う。
 */
 void ReadFilePath(std::string ltlists) {
 	std::ifstream ifs(ltlists);
@@ -207,370 +216,682 @@ void ReadFilePath(std::string ltlists) {
 
 	std::string path;
 	while(std::getline(ifs, path)) {
-		files.push_back(path);
+		if (path.empty()) continue;
+		files.emplace(ExtractEventID(path), path);
 	}
 
-	std::sort(files.begin(), files.end(), CompareFile);
-
 	return;
 }
 
-bool IsTrack(EdbTrackP* track, int event_id, int plate_id, int seg_id) {
-	int nseg = track -> N();
-	for (int i=0; i<nseg; i++) {
-		EdbSegP* seg = track -> GetSegment(i);
-		if ((seg -> MCEvt()%100000)==event_id%100000 and seg -> ScanID().GetPlate() == plate_id and seg -> ID() == seg_id) return true;
+/**
+*	@fn			ReadManifestFile
+*	@brief		scan_filesが書いたmanifestからlinked_tracks.rootのパスを読み、filesに詰める
+*	@param[in]	manifest	manifestのパス
+*	@par		Modify
+*		- files
+*		- invalid_files
+*	@return		void
+*	@detail
+*	scan_filesで壊れていると判定されたファイルはinvalid_filesに入れて測定しない。
+*	manifestのファイルはscan済みなので、Runでの事前チェックは行わない。
+*/
+void ReadManifestFile(std::string manifest) {
+	std::vector<LinkedTracksFileInfo> infos;
+	try {
+		infos = ReadManifest(manifest);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
 	}
 
-	return false;
-}
+	for (const LinkedTracksFileInfo& info: infos) {
+		if (!info.IsValid()) {
+			invalid_files.push_back(info.path + " (" + info.status + ")");
+			continue;
+		}
+		files.emplace(info.event_id, info.path);
+	}
+	files_scanned = true;
 
-bool IsFileValid(std::string input_files) {
-	TFile* file = new TFile(input_files.c_str(), "READ");
-	if (!file->IsOpen() or file->IsZombie()) {
-		invalid_files.push_back(input_files);
-		file -> Close();
-		return false;
+	if (!invalid_files.empty()) {
+		std::cerr << "Warning: " << invalid_files.size() << " invalid files in the manifest are skipped." << std::endl;
 	}
-	TTree* tree = (TTree*) file -> Get("tracks");
+}
 
-	int nentries = tree -> GetEntries();
-	//std::cout << nentries << " entries." << std::endl;
+/**
+*	@fn			ValidateFiles
+*	@brief		測定に使うlinked_tracks.rootを並列に開いてチェックする
+*	@param[in]	requests	CollectFileRequestsの結果
+*	@param[in]	pool
+*	@return		void
+*	@detail
+*	壊れたファイル (開けない、zombie、tracks treeがない、空) が1つでもあれば一覧を出してすぐに終了する。
+*	途中のReadTracksTreeで落ちるより早く気づけるように、測定の前に全部チェックする。
+*/
+void ValidateFiles(const std::map<int, std::vector<VertexRange>>& requests, ThreadPool& pool) {
+	std::vector<std::string> paths;
+	for (auto& request: requests) paths.push_back(files[request.first]);
 
-	if (nentries == 0) {
-		invalid_files.push_back(input_files);
-		file -> Close();
-		return false;
+	std::vector<LinkedTracksFileInfo> infos(paths.size());
+	pool.ParallelFor(paths.size(), [&](int i, int worker) {
+		infos[i] = ScanLinkedTracksFile(paths[i], false);
+	});
+
+	for (const LinkedTracksFileInfo& info: infos) {
+		if (!info.IsValid()) invalid_files.push_back(info.path + " (" + info.status + ")");
 	}
-	file -> Close();
-	return true;
+	if (invalid_files.empty()) return;
+
+	std::cerr << "Error: " << invalid_files.size() << " of " << paths.size() << " files are invalid." << std::endl;
+	for (const std::string& file: invalid_files) std::cerr << "  " << file << std::endl;
+	std::cerr << "Fix or remove them from the list, or make a manifest with scan_files and run with -M." << std::endl;
+	exit(1);
 }
 
 
-/*
-*	@fn			FillMomentum
-*	@param[in]	event_id	探すevent_id
-*	@param[in]	start	tracksの最初のindex
-*	@param[in]	end		tracksの最初のindex
-*	@par		Refer
-*	@return		void
+/**
+*	@fn			CollectFileRequests
+*	@brief		各linked_tracks.rootで探すvertexをまとめる
+*	@return		<event ID of the file, vertices to be measured with the file>
+*	@detail
+*	Vertexのevent IDに対して、event ID + i*100000 (i=-1..5) のファイルを探す。
+*	mapのkeyはファイルのevent ID順なので、元のvertexごとのループと同じ順に測定される。
+*	--shard i/Nの場合はshard iのvertexだけを集める (VertexFile::ShardOfEvent)。
 */
-void FillMomentum(int event_id, int start, int end) {
-	for (int i=-1; i<6; i++) {
-
-		int ev = i * 100000 + event_id;
-		//event idにマッチするpathを取得する
-		auto iter_file = std::find_if(files.begin(), files.end(),
-								   [&](std::string str) {
-									return ExtractEventID(str) == ev;
-								   }
-		);
-		if (iter_file == files.end()) continue;	// File not found.
-		
-		std::string file = *iter_file;
-		std::cout << file << std::endl;
-		
-		TString cut = Form("s.eMCEvt==%d", event_id);
-		dproc -> ReadTracksTree(*pvr, file.c_str(), cut);
-		int ntrk = pvr -> Ntracks();
-
-		for (int j=0; j<ntrk; j++) {
-			EdbTrackP* track = pvr->GetTrack(j);
-			for (int k=start; k<end; k++) {
-				tracks[k];
-				int track_id = tracks[k].seg_id;
-				int plate_id = tracks[k].plate_id;
-				if (IsTrack(track, event_id, plate_id, track_id)) {
-					double mom = mc.CalcMomentum(track, 0);
-					std::cout << "Measured." << std::endl;
-					tracks[k].p_reco = mom;
-				}
-			}
+std::map<int, std::vector<VertexRange>> CollectFileRequests() {
+	std::map<int, std::vector<VertexRange>> requests;
+
+	for (Vertex vertex: verteces) {
+		VertexRange range;
+		range.start = track_begin[vertex.ivertex];
+		range.end = track_begin[vertex.ivertex + 1];
+		if (range.start == range.end) continue; // No track.
+		range.event_id = tracks[range.start].event_id;
+		if (VertexFile::ShardOfEvent(range.event_id, nshard) != shard_index) continue; // Other shard.
+
+		for (int i=-1; i<6; i++) {
+			int ev = i * 100000 + range.event_id;
+			//event idにマッチするpathがあるか
+			if (files.find(ev) == files.end()) continue;	// File not found.
+			if (done_files.count(ev)) continue;				// Measured in the previous run (--resume).
+
+			requests[ev].push_back(range);
 		}
 	}
 
-	//for (Track track: v_trks) {
-	//	std::cout << "1ry_trk" << "\t" << track.plate_id << "\t" << track.seg_id << "\t" << track.x_first << "\t" << track.y_first << "\t" << track.plate_id_last << "\t" << track.npl << "\t" << track.pdg_id << "\t" << track.p_true << "\t" << track.p_reco << "\t" << track.event_id << std::endl;
-	//}
-	//std::cout << std::endl;
-
-	if (pvr->eTracks) pvr->eTracks->Clear();
-
-	return;
+	return requests;
 }
 
+/**
+*	@fn			ReadTracks
+*	@brief		linked_tracks.rootを1回だけ読み、必要なevent全てのtrackをtrksに詰める
+*	@param[in]	file		linked_tracks.rootのパス
+*	@param[in]	ranges		このファイルで測定するvertex
+*	@param[out]	trks		読み込んだtrack
+*	@return		void
+*	@detail
+*	測定に必要なbranchだけをLinkedTracksLiteReaderで読む。EdbTrackP/EdbSegPは作らない。
+*	読むentryはLinkedTracksIndex (<file>.mcidx) から探す。indexがなければs.eMCEvtだけを読んで作り、保存する。
+*	--full-readの場合は従来通りReadTracksTreeで読み、FnuMomTrackDataに変換する (比較用)。
+*	read stageのthreadから呼ばれるので、読めない場合は終了せずstd::runtime_errorを投げる (Runが終了する)。
+*/
+void ReadTracks(std::string file, const std::vector<VertexRange>& ranges, std::vector<FnuMomTrackData>& trks) {
+	std::vector<int> event_ids;
+	for (VertexRange range: ranges) event_ids.push_back(range.event_id);
+	std::sort(event_ids.begin(), event_ids.end());
+	event_ids.erase(std::unique(event_ids.begin(), event_ids.end()), event_ids.end());
+
+	trks.clear();
+
+	if (!full_read) {
+		LinkedTracksIndex index(file);
+		LinkedTracksLiteReader reader(file);
+		reader.ReadEntries(index.Entries(event_ids), trks);
+		return;
+	}
 
-// Old version.
-/*
-void CalcMomentum(std::string linked_tracks_file) {
-	// Extrach Track ID.
-	std::string pattern = "evt_(\\d+)_";
-	std::regex regex(pattern);
-	std::smatch match;
-	std::string event_id;
-
-	if (std::regex_search(linked_tracks_file, match, regex) && match.size() > 1) {
-		event_id = match.str(1);
-	} else {
-		std::cerr << "Error: Couldn't extract Track ID from the filename." << std::endl;
-		exit(1);
+	TString cut;
+	for (int i=0; i<event_ids.size(); i++) {
+		if (i != 0) cut += "||";
+		cut += Form("s.eMCEvt==%d", event_ids[i]);
 	}
 
-	TString cut = Form("(s.eMCEvt%%100000)==%d", std::stoi(event_id)%100000);
+	EdbPVRec pvr;
+	{
+		FnuMomScopedTimer timer(kTimeTreeRead);
+		dproc -> ReadTracksTree(pvr, file.c_str(), cut);
+	}
+	int ntrk = pvr.Ntracks();
+	trks.resize(ntrk);
+	for (int i=0; i<ntrk; i++) trks[i].Set(pvr.GetTrack(i));
 
-	if (pvr->eTracks) pvr->eTracks->Clear();
+	// Tracks do not own the segments, the segments are deleted with the patterns of pvr.
+	if (pvr.eTracks) pvr.eTracks -> Delete();
+}
 
-	if (!IsFileValid(linked_tracks_file)) return;
+/**
+*	@fn			BuildTrackIndex
+*	@brief		trksの全segmentについて (MCEvt, plate, segment ID) -> track の索引を作る
+*	@param[in]	trks
+*	@param[out]	index
+*	@return		void
+*/
+void BuildTrackIndex(const std::vector<FnuMomTrackData>& trks, TrackIndex& index) {
+	FnuMomScopedTimer timer(kTimeMatch);
+	index.clear();
+
+	for (const FnuMomTrackData& track: trks) {
+		int nseg = track.N();
+		for (int j=0; j<nseg; j++) {
+			TrackKey key;
+			key.event_id = track.mcevt[j];
+			key.plate_id = track.scan_plate[j];
+			key.seg_id = track.seg_id[j];
+			index[key] = &track;
+		}
+	}
+}
 
-	dproc -> ReadTracksTree(*pvr, linked_tracks_file.c_str(), cut);
-	int ntrk = pvr -> Ntracks();
-	
-	Track track;
-	track.event_id = std::stoi(event_id);
-	std::vector<Track>::iterator iter_lower = std::lower_bound(tracks.begin(), tracks.end(), track, compareTrackId);
-	std::vector<Track>::iterator iter_upper = std::upper_bound(tracks.begin(), tracks.end(), track, compareTrackId);
-	int idx_lower = std::distance(tracks.begin(), iter_lower);
-	int idx_upper = std::distance(tracks.begin(), iter_upper);
-
-
-	for (int i=idx_lower; i<idx_upper; i++) {
-		Track trk_buf = tracks[i];
-		int eve = trk_buf.event_id;
-		int track_id = trk_buf.seg_id;
-		int plate_id = trk_buf.plate_id;
-
-		for (int itrk=0; itrk<ntrk; itrk++) {
-			EdbTrackP* track = pvr -> GetTrack(itrk);
-			if (IsTrack(track, eve, plate_id, track_id)) {
-				tracks[i].p_reco = mc.CalcMomentum(track, 0);
-				std::cout << "Measured." << std::endl;
-				tracks[i].plate_id_last = track -> GetSegmentLast() -> ScanID().GetPlate();
-				tracks[i].npl = track -> Npl();
-				//mc.DrawMomGraphCoord(track, c, "test");
+/*
+*	@fn			FillMomentum
+*	@brief		索引からvertexのtrackを探して運動量を測定する
+*	@param[in,out]	batch	読み込んだlinked_tracks.root. 結果はbatch.resultsに入る
+*	@param[in]	pool	測定に使うthread
+*	@param[in]	ws		threadごとのworkspace
+*	@return		void
+*	@detail
+*	先に測定するtrackを集め、threadに分けて測定する。tracksへの書き込みはwrite stageで行う。
+*/
+void FillMomentum(FileBatch& batch, ThreadPool& pool, std::vector<FnuMomWorkspace>& ws) {
+	std::vector<std::pair<int, const FnuMomTrackData*>> jobs; // <index in tracks, track>
+	const TrackIndex& index = batch.index;
+
+	{
+		FnuMomScopedTimer timer(kTimeMatch);
+		for (const VertexRange& range: *batch.ranges) {
+			for (int k=range.start; k<range.end; k++) {
+				TrackKey key;
+				key.event_id = range.event_id;
+				key.plate_id = tracks[k].plate_id;
+				key.seg_id = tracks[k].seg_id;
+
+				auto iter = index.find(key);
+				if (iter == index.end()) continue;
+
+				jobs.push_back(std::make_pair(k, iter -> second));
 			}
 		}
 	}
 
+	batch.results.resize(jobs.size());
+	pool.ParallelFor(jobs.size(), [&](int i, int worker) {
+		batch.results[i] = std::make_pair(jobs[i].first, mc.Measure(*jobs[i].second, ws[worker], 0));
+	});
 
+	return;
 }
-*/
 
-void WriteVertexFile(std::string output_file) {
-	std::cout << "Writing ..." << std::endl;
-	std::ofstream ofs(output_file);
+/**
+*	@fn			WriteResults
+*	@brief		測定結果をtracksに書き込み、batchを解放する
+*	@param[in]	batch
+*	@par		Modify
+*		- tracks
+*	@return		void
+*/
+void WriteResults(FileBatch* batch) {
+	for (const std::pair<int, float>& result: batch -> results) {
+		tracks[result.first].p_reco = result.second;
+	}
 
-	// Sort tracks and verteces with ivertex;
-	std::sort(tracks.begin(), tracks.end(), compareIVertex<Track>);
-	std::sort(verteces.begin(), verteces.end(), compareIVertex<Vertex>);
+	delete batch;
+}
 
-	for (int i=0; i<verteces.size(); i++) {
-		Vertex vertex = verteces[i];
-		int ivertex = vertex.ivertex;
+/**
+*	@struct		CheckpointHeader
+*	@brief		Header of the checkpoint file
+*	@detail
+*	The header is followed by one record per linked_tracks.root, appended when its results are written:
+*		int32 event ID of the file, int32 n, int64 index in tracks [n], float p_reco [n], int32 event ID of the file again
+*	The last event ID marks the record as complete, a record cut by a crash is ignored.
+*	The size and mtime of the inputs (checkpoint_inputs) identify the run, a checkpoint of other inputs is not resumed.
+*/
+struct CheckpointHeader {
+	char magic[8];		// "FNUCKPT"
+	uint32_t version;
+	int32_t shard_index;
+	int32_t nshard;
+	int32_t reserved;
+	uint64_t nvertex;
+	uint64_t ntrack;
+	uint64_t input_size[3];	// Size of -V, -I (or -M) and -P
+	int64_t input_mtime[3];	// mtime of them
+};
 
-		ofs << "1ry_vtx\t" << vertex.area_id << "\t" << vertex.vx << "\t" << vertex.vy << "\t" << vertex.plate << "\t" << vertex.ntrk << std::endl;
+const char kCheckpointMagic[8] = {'F', 'N', 'U', 'C', 'K', 'P', 'T', '\0'};
+
+CheckpointHeader MakeCheckpointHeader() {
+	CheckpointHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, kCheckpointMagic, sizeof(kCheckpointMagic));
+	header.version = 2;
+	header.shard_index = shard_index;
+	header.nshard = nshard;
+	header.nvertex = verteces.size();
+	header.ntrack = tracks.size();
+	for (int i=0; i<3; i++) {
+		struct stat st;
+		if (!checkpoint_inputs[i] or stat(checkpoint_inputs[i], &st) != 0) continue;
+		header.input_size[i] = st.st_size;
+		header.input_mtime[i] = st.st_mtime;
+	}
+	return header;
+}
 
-	  	Track trk_buf;
-	  	trk_buf.ivertex = ivertex;
-		std::vector<Track>::iterator iter_lower = std::lower_bound(tracks.begin(), tracks.end(), trk_buf, compareIVertex<Track>);
-		std::vector<Track>::iterator iter_upper = std::upper_bound(tracks.begin(), tracks.end(), trk_buf, compareIVertex<Track>);
-		int idx_lower = std::distance(tracks.begin(), iter_lower);
-		int idx_upper = std::distance(tracks.begin(), iter_upper);
+/**
+*	@fn			LoadCheckpoint
+*	@brief		前回のrunのcheckpointを読み、p_recoをtracksに戻す
+*	@return		void
+*	@par		Modify
+*		- tracks
+*		- done_files
+*	@detail
+*	vertex file, shardが違うcheckpoint、-V, -I (-M), -Pのsizeかmtimeが違うcheckpointはエラー。最後の不完全なrecordは捨て、その位置から追記できるようにファイルを切り詰める。
+*	headerが途中までしかない (作った直後に中断した) checkpointは空にして、最初から測定する。
+*	ファイルはevent ID順に書かれるので測定済みのファイルは先頭から連続しており、続きを測定すると中断しなかった場合と同じ結果になる。
+*/
+void LoadCheckpoint() {
+	FILE* fp = fopen(checkpoint_file.c_str(), "rb");
+	if (!fp) {
+		std::cout << "No checkpoint " << checkpoint_file << ", start from the beginning." << std::endl;
+		return;
+	}
 
-		for (int j=idx_lower; j<idx_upper; j++) {
-			Track track = tracks[j];
-			ofs << "1ry_trk" << "\t" << track.plate_id << "\t" << track.seg_id << "\t" << track.x_first << "\t" << track.y_first << "\t" << track.plate_id_last << "\t" << track.npl << "\t" << track.pdg_id << "\t" << track.p_true << "\t" << track.p_reco << "\t" << track.event_id << std::endl;
+	CheckpointHeader header, expected = MakeCheckpointHeader();
+	std::size_t header_size = fread(&header, 1, sizeof(header), fp);
+	if (header_size < sizeof(header) and !ferror(fp)) {
+		fclose(fp);
+		std::cout << "Checkpoint " << checkpoint_file << " has no complete header, start from the beginning." << std::endl;
+		if (truncate(checkpoint_file.c_str(), 0) != 0) {
+			std::cerr << "Error: cannot truncate " << checkpoint_file << "." << std::endl;
+			exit(1);
 		}
+		return;
+	}
+	if (header_size < sizeof(header) or std::memcmp(&header, &expected, offsetof(CheckpointHeader, input_size)) != 0) {
+		std::cerr << "Error: " << checkpoint_file << " is not a checkpoint of this vertex file and shard." << std::endl;
+		exit(1);
+	}
+	if (std::memcmp(&header, &expected, sizeof(header)) != 0) {
+		std::cerr << "Error: " << checkpoint_file << " was written with other inputs (size or mtime of -V, -I/-M or -P changed)." << std::endl;
+		exit(1);
 	}
 
-	ofs.close();
+	long good_size = sizeof(header);
+	long nmeasured = 0;
+	std::vector<int64_t> index;
+	std::vector<float> p_reco;
+	while (true) {
+		int32_t event_id, n, event_id_end;
+		if (fread(&event_id, sizeof(event_id), 1, fp) != 1) break;
+		if (fread(&n, sizeof(n), 1, fp) != 1 or n < 0) break;
+		index.resize(n);
+		p_reco.resize(n);
+		if (fread(index.data(), sizeof(int64_t), n, fp) != (std::size_t) n) break;
+		if (fread(p_reco.data(), sizeof(float), n, fp) != (std::size_t) n) break;
+		if (fread(&event_id_end, sizeof(event_id_end), 1, fp) != 1 or event_id_end != event_id) break;
+
+		for (int i=0; i<n; i++) {
+			if (index[i] < 0 or index[i] >= (int64_t) tracks.size()) {
+				std::cerr << "Error: broken checkpoint " << checkpoint_file << "." << std::endl;
+				exit(1);
+			}
+			tracks[index[i]].p_reco = p_reco[i];
+		}
+		done_files.insert(event_id);
+		nmeasured += n;
+		good_size = ftell(fp);
+	}
+	fclose(fp);
 
-	std::cout << "Done." << std::endl;
-	return;
-	
+	if (truncate(checkpoint_file.c_str(), good_size) != 0) {
+		std::cerr << "Error: cannot truncate " << checkpoint_file << "." << std::endl;
+		exit(1);
+	}
+	std::cout << "Resume: " << done_files.size() << " files and " << nmeasured << " tracks are measured in " << checkpoint_file << "." << std::endl;
 }
 
-void WriteVertexFileIntoRootFile(std::string output_file) {
-	TFile* file = new TFile(output_file.c_str(), "RECREATE");
-	TTree* tree_vertex = new TTree("vertex", "vertex");
-	TTree* tree_track = new TTree("track", "track");
-
-	TString type;
-	int ivertex;
-	// For verteces.
-	int area_id, v_plate, ntrk;
-	double vx, vy;
-
-	// For tracks.
-	int plate_id, seg_id, plate_id_last, npl, pdg_id, event_id;
-	double x, y, p_true, p_rec;
-
-	Vertex vertex;
-
-	tree_vertex -> Branch("ivertex", &ivertex);
-	tree_vertex -> Branch("area_id", &area_id);
-	tree_vertex -> Branch("vx", &vx);
-	tree_vertex -> Branch("vy", &vy);
-	tree_vertex -> Branch("plate", &v_plate);
-	tree_vertex -> Branch("ntrk", &ntrk);
-
-	tree_track -> Branch("ivertex", &ivertex);
-	tree_track -> Branch("event_id", &event_id);
-	tree_track -> Branch("plate_id", &plate_id);
-	tree_track -> Branch("seg_id", &seg_id);
-	tree_track -> Branch("x", &x);
-	tree_track -> Branch("y", &y);
-	tree_track -> Branch("plate_id_last", &plate_id_last);
-	tree_track -> Branch("npl", &npl);
-	tree_track -> Branch("pdg_id", &pdg_id);
-	tree_track -> Branch("p_true", &p_true);
-	tree_track -> Branch("p_rec", &p_rec);
-
-	std::sort(tracks.begin(), tracks.end(), compareIVertex<Track>);
-	std::sort(verteces.begin(), verteces.end(), compareIVertex<Vertex>);
-
-	for (int i=0; i<verteces.size(); i++) {
-		vertex = verteces[i];
-		ivertex = vertex.ivertex;
-		area_id = vertex.area_id;
-		vx = vertex.vx;
-		vy = vertex.vy;
-		v_plate = vertex.plate;
-		ntrk = vertex.ntrk;
-		
-		tree_vertex -> Fill();
-
-	  	Track trk_buf;
-	  	trk_buf.ivertex = ivertex;
-		std::vector<Track>::iterator iter_lower = std::lower_bound(tracks.begin(), tracks.end(), trk_buf, compareIVertex<Track>);
-		std::vector<Track>::iterator iter_upper = std::upper_bound(tracks.begin(), tracks.end(), trk_buf, compareIVertex<Track>);
-		int idx_lower = std::distance(tracks.begin(), iter_lower);
-		int idx_upper = std::distance(tracks.begin(), iter_upper);
-
-		for (int j=idx_lower; j<idx_upper; j++) {
-			Track track = tracks[j];
-			event_id = track.event_id;
-			plate_id = track.plate_id;
-			seg_id = track.seg_id;
-			x = track.x_first;
-			y = track.y_first;
-			plate_id_last = track.plate_id_last;
-			npl = track.npl;
-			pdg_id = track.pdg_id;
-			p_true = track.p_true;
-			p_rec = track.p_reco;
-			
-			tree_track -> Fill();
+/**
+*	@fn			OpenCheckpoint
+*	@brief		checkpointを書き込み用に開く。--resumeなら追記、そうでなければ新しく作る
+*	@return		void
+*/
+void OpenCheckpoint() {
+	if (resume) LoadCheckpoint();
+
+	checkpoint = fopen(checkpoint_file.c_str(), resume ? "ab" : "wb");
+	if (!checkpoint) {
+		std::cerr << "Error: cannot open " << checkpoint_file << "." << std::endl;
+		exit(1);
+	}
+	if (ftell(checkpoint) == 0) {
+		CheckpointHeader header = MakeCheckpointHeader();
+		if (fwrite(&header, sizeof(header), 1, checkpoint) != 1 or fflush(checkpoint) != 0) {
+			std::cerr << "Error: cannot write " << checkpoint_file << ": " << strerror(errno) << std::endl;
+			exit(1);
 		}
 	}
+}
 
-	tree_vertex -> Write();
-	tree_track -> Write();
-	file -> Close();
-
-	return;
+/**
+*	@fn			CloseCheckpoint
+*	@brief		checkpointを閉じる。書き込みに失敗していればエラーで終了する
+*	@return		void
+*/
+void CloseCheckpoint() {
+	if (fclose(checkpoint) != 0) {
+		std::cerr << "Error: cannot write " << checkpoint_file << ": " << strerror(errno) << std::endl;
+		exit(1);
+	}
+	checkpoint = nullptr;
 }
 
 /**
-*	@fn			Run
-*	@brief		運動量測定を実行する関数
-*	@return void
+*	@fn			AppendCheckpoint
+*	@brief		1ファイル分の結果をcheckpointに追記する
+*	@param[in]	batch
+*	@return		書き込めなければfalse (理由はcheckpoint_errorに入る)
 *	@detail
-*	はじめに運動量測定クラスの設定を行う。次にltlistsを1行ずつ読み、一つのlinked_tracks.rootファイルごとに運動量測定を行う。
+*	毎回fflushし、checkpoint_interval秒ごとにfsyncする。writer threadから呼ばれるので、ここでは終了せずRunに任せる。
 */
-void Run(const char* par_file="../par/MC_plate_1_100.txt") {
-	// Setup for momenum measurement.
-	std::cout << "Read par file for momentum measurement." << std::endl;
-	mc.ReadParFile(par_file);
+bool AppendCheckpoint(const FileBatch* batch) {
+	static auto last_sync = std::chrono::steady_clock::now();
+
+	int32_t event_id = batch -> event_id;
+	int32_t n = batch -> results.size();
+	std::vector<int64_t> index(n);
+	std::vector<float> p_reco(n);
+	for (int i=0; i<n; i++) {
+		index[i] = batch -> results[i].first;
+		p_reco[i] = batch -> results[i].second;
+	}
 
-	// Loop for the vertex.
-	for (Vertex vertex: verteces) {
-		int ivertex = vertex.ivertex;
+	bool ok = fwrite(&event_id, sizeof(event_id), 1, checkpoint) == 1
+		and fwrite(&n, sizeof(n), 1, checkpoint) == 1
+		and fwrite(index.data(), sizeof(int64_t), n, checkpoint) == (std::size_t) n
+		and fwrite(p_reco.data(), sizeof(float), n, checkpoint) == (std::size_t) n
+		and fwrite(&event_id, sizeof(event_id), 1, checkpoint) == 1
+		and fflush(checkpoint) == 0;
+	if (!ok) {
+		checkpoint_error = std::string("cannot write ") + checkpoint_file + ": " + strerror(errno);
+		return false;
+	}
+
+	if (std::chrono::duration<double>(std::chrono::steady_clock::now() - last_sync).count() > checkpoint_interval) {
+		if (fsync(fileno(checkpoint)) != 0) {
+			checkpoint_error = std::string("cannot fsync ") + checkpoint_file + ": " + strerror(errno);
+			return false;
+		}
+		last_sync = std::chrono::steady_clock::now();
+	}
+	return true;
+}
 
-	  	Track trk_buf;
-	  	trk_buf.ivertex = ivertex;
-		std::vector<Track>::iterator iter_lower = std::lower_bound(tracks.begin(), tracks.end(), trk_buf, compareIVertex<Track>);
-		std::vector<Track>::iterator iter_upper = std::upper_bound(tracks.begin(), tracks.end(), trk_buf, compareIVertex<Track>);
-		int idx_lower = std::distance(tracks.begin(), iter_lower);
-		int idx_upper = std::distance(tracks.begin(), iter_upper);
+double Seconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PrintStageCounters() {
+	std::cout << "Pipeline stages:" << std::endl;
+	for (const StageCounter* counter: {&read_counter, &measure_counter, &write_counter}) {
+		double rate = counter -> busy > 0 ? counter -> ntrack / counter -> busy : 0;
+		printf("%-8s %6ld files %9ld tracks  busy %9.2f s  wait %9.2f s  %10.1f tracks/s\n",
+				counter -> name, counter -> nfile, counter -> ntrack, counter -> busy, counter -> wait, rate);
+	}
+}
+
+
+/**
+*	@fn			WriteVertexFile
+*	@brief		p_recoを詰めたvertex fileを書き出す。拡張子が.vtxbならbinaryで書く。
+*	@param[in]	output_file		出力ファイルのパス
+*	@return		void
+*/
+void WriteVertexFile(std::string output_file) {
+	std::cout << "Writing ..." << std::endl;
+	FnuMomScopedTimer timer(kTimeOutput);
 
-		int event_id = tracks[idx_lower].event_id;
-		FillMomentum(event_id, idx_lower, idx_upper);
+	try {
+		VertexFile::Write(output_file, verteces, tracks);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
 	}
 
+	std::cout << "Done." << std::endl;
 	return;
+	
 }
 
 /**
 *	@fn			Run
 *	@brief		運動量測定を実行する関数
-*	@param[in]	ltlists		linked_tracks.rootのパスが列挙されたファイルのパス
-*	@param[in]	par_file	運動量測定の際のパラメータファイル
 *	@return void
 *	@detail
 *	はじめに運動量測定クラスの設定を行う。次にltlistsを1行ずつ読み、一つのlinked_tracks.rootファイルごとに運動量測定を行う。
 */
-// Old version.
-/*
-void Run(std::string ltlists, const char* par_file="../par/MC_plate_1_100.txt") {
-	std::ifstream ifs(ltlists);
+void Run(const char* par_file="../par/MC_plate_1_100.txt") {
+	// Setup for momenum measurement.
+	std::cout << "Read par file for momentum measurement." << std::endl;
+	mc.ReadParFile(par_file);
 
-	if (ifs.fail()) {
-		std::cerr << "Error! Could not open the file." << std::endl;
-		exit(1);
+	if (nthreads > 1 and !mc.IsThreadSafe()) {
+		std::cerr << "Warning: fit_engine minuit is not thread safe. Run with 1 thread." << std::endl;
+		nthreads = 1;
 	}
 
-	// For the momentum measurement.
-	mc.ReadParFile(par_file);
+	// The read stage uses ROOT I/O while the other stages measure, even with 1 thread.
+	ROOT::EnableThreadSafety();
+
+	ThreadPool pool(nthreads);
+	std::vector<FnuMomWorkspace> ws(pool.NThreads());
+
+	// Each linked_tracks.root is read only once and serves all the verteces which need it.
+	// With --shard, all the verteces are written but only the ones of this shard are measured (p_reco of the others stays -999).
+	if (nshard > 1) std::cout << "Shard " << shard_index << "/" << nshard << std::endl;
+	std::map<int, std::vector<VertexRange>> requests = CollectFileRequests();
+	if (!files_scanned) ValidateFiles(requests, pool);
+
+	// read (1 thread) -> measure (this thread + pool) -> write (1 thread)
+	// Each queue keeps at most queue_depth files, so at most 2*queue_depth+2 files are in memory.
+	BoundedQueue<FileBatch*> read_queue(queue_depth);
+	BoundedQueue<FileBatch*> write_queue(queue_depth);
+
+	// When a file cannot be read the reader stops, the files already read are measured and written (so that
+	// --resume continues from the file) and Run exits with the error after the threads are joined.
+	std::string read_error;
+	std::thread reader([&] {
+		for (auto& request: requests) {
+			auto start = std::chrono::steady_clock::now();
+			FileBatch* batch = new FileBatch;
+			batch -> event_id = request.first;
+			batch -> ranges = &request.second;
+			try {
+				ReadTracks(files[request.first], request.second, batch -> trks);
+			} catch (const std::exception& e) {
+				read_error = e.what();
+				delete batch;
+				break;
+			}
+			BuildTrackIndex(batch -> trks, batch -> index);
+			read_counter.busy += Seconds(start);
+			read_counter.nfile++;
+			read_counter.ntrack += batch -> trks.size();
+
+			start = std::chrono::steady_clock::now();
+			bool pushed = read_queue.Push(batch);
+			read_counter.wait += Seconds(start);
+			if (!pushed) {
+				WriteResults(batch);
+				break;
+			}
+		}
+		read_queue.Close();
+	});
+
+	// Progress is shown on one status line by the writer, rewritten at most every 0.5 s.
+	FnuMomStatusLine status;
+	auto run_start = std::chrono::steady_clock::now();
+	// When the checkpoint cannot be written (e.g. full disk) the reader is stopped, the files in the queues are
+	// drained without checkpoint and Run exits with the error.
+	bool checkpoint_failed = false;
+	std::thread writer([&] {
+		FileBatch* batch;
+		while (true) {
+			auto start = std::chrono::steady_clock::now();
+			if (!write_queue.Pop(batch)) break;
+			write_counter.wait += Seconds(start);
+
+			start = std::chrono::steady_clock::now();
+			write_counter.nfile++;
+			write_counter.ntrack += batch -> results.size();
+			{
+				FnuMomScopedTimer timer(kTimeOutput);
+				if (!checkpoint_failed and !AppendCheckpoint(batch)) {
+					checkpoint_failed = true;
+					read_queue.Close();
+				}
+				WriteResults(batch);
+			}
+			write_counter.busy += Seconds(start);
 
-	std::string path;
-	while(std::getline(ifs, path)) {
-		CalcMomentum(path);
+			if (status.Due()) {
+				double elapsed = Seconds(run_start);
+				status.Print("%ld/%zu files, %ld tracks measured, %.1f tracks/s, %.0f s", write_counter.nfile, requests.size(),
+						write_counter.ntrack, elapsed > 0 ? write_counter.ntrack / elapsed : 0., elapsed);
+			}
+		}
+	});
+
+	FileBatch* batch;
+	while (true) {
+		auto start = std::chrono::steady_clock::now();
+		if (!read_queue.Pop(batch)) break;
+		measure_counter.wait += Seconds(start);
+
+		start = std::chrono::steady_clock::now();
+		FillMomentum(*batch, pool, ws);
+		measure_counter.nfile++;
+		measure_counter.ntrack += batch -> results.size();
+		batch -> index.clear();
+		measure_counter.busy += Seconds(start);
+
+		start = std::chrono::steady_clock::now();
+		write_queue.Push(batch);
+		measure_counter.wait += Seconds(start);
 	}
+	write_queue.Close();
 
-	mc.ShowPar();
+	reader.join();
+	writer.join();
 
-	std::cout << "Invalid files: " << std::endl;
-	for (auto file: invalid_files) {
-		std::cout << file << std::endl;
+	double elapsed = Seconds(run_start);
+	status.Finish("%ld/%zu files, %ld tracks measured, %.1f tracks/s, %.0f s", write_counter.nfile, requests.size(),
+			write_counter.ntrack, elapsed > 0 ? write_counter.ntrack / elapsed : 0., elapsed);
+	if (checkpoint_failed) {
+		std::cerr << "Error: " << checkpoint_error << std::endl;
+		exit(1);
+	}
+	if (!read_error.empty()) {
+		std::cerr << read_error << std::endl;
+		exit(1);
 	}
+	PrintStageCounters();
+
+	return;
 }
-*/
 
 int main(int argc, char** argv) {
-	char* input_vertex_file;
-	char* input_list;
-	char* output_vertex_file;
+	char* input_vertex_file = nullptr;
+	char* input_list = nullptr;
+	char* input_manifest = nullptr;
+	char* output_vertex_file = nullptr;
 	char* par_file = nullptr;
 
 	// Read arguments
 	// -V: Path of input vertex file
 	// -I: Path of list file of linked_tracks.root
+	// -M: Path of manifest written by scan_files, instead of -I
 	// -O: Path of output vertex file
 	// -P: Path of parameter file for momentum measurement
-	for (int i=1; i<argc; i+=2) {
-		if (std::string(argv[i]) == "-V") input_vertex_file = argv[i+1];
-		else if (std::string(argv[i]) == "-I") input_list = argv[i+1];
-		else if (std::string(argv[i]) == "-O") output_vertex_file = argv[i+1];
-		else if (std::string(argv[i]) == "-P") par_file = argv[i+1];
+	// -j: Number of threads for momentum measurement
+	// -q: Number of linked_tracks.root read ahead (default 2)
+	// --shard i/N: Measure only the verteces of shard i (0 <= i < N), merge the outputs with merge_vertex
+	// --checkpoint: Path of checkpoint file (default <output>.ckpt)
+	// --resume: Skip the linked_tracks.root already in the checkpoint file
+	// --full-read: Read whole tracks with EdbDataProc::ReadTracksTree (slower, to cross-check the default reader)
+	// --profile: Print the time of each section (file open, tree read, matching, array fill, diff, fit, output) at exit
+	// --profile-json: Write the profile to a JSON file
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--resume") {
+			resume = true;
+			continue;
+		}
+		if (arg == "--full-read") {
+			full_read = true;
+			continue;
+		}
+		if (arg == "--profile") {
+			profile = true;
+			continue;
+		}
+		if (i+1 >= argc) break;
+		if (arg == "-V") input_vertex_file = argv[++i];
+		else if (arg == "-I") input_list = argv[++i];
+		else if (arg == "-M") input_manifest = argv[++i];
+		else if (arg == "-O") output_vertex_file = argv[++i];
+		else if (arg == "-P") par_file = argv[++i];
+		else if (arg == "-j") nthreads = std::stoi(argv[++i]);
+		else if (arg == "-q") queue_depth = std::stoi(argv[++i]);
+		else if (arg == "--shard") ParseShard(argv[++i]);
+		else if (arg == "--checkpoint") checkpoint_file = argv[++i];
+		else if (arg == "--profile-json") profile_json = argv[++i];
+		else i++;
 	}
+	if (!input_vertex_file or !(input_list or input_manifest) or !output_vertex_file) {
+		std::cerr << "Error: -V, -I (or -M) and -O are required." << std::endl;
+		exit(1);
+	}
+	if (checkpoint_file.empty()) checkpoint_file = std::string(output_vertex_file) + ".ckpt";
+	checkpoint_inputs[0] = input_vertex_file;
+	checkpoint_inputs[1] = input_manifest ? input_manifest : input_list;
+	checkpoint_inputs[2] = par_file;
+	FnuMomProfile::Enable(profile or !profile_json.empty());
+	auto start = std::chrono::steady_clock::now();
 
 	ReadVertexFile(input_vertex_file);
-	ReadFilePath(input_list);
+	if (input_manifest) ReadManifestFile(input_manifest);
+	else ReadFilePath(input_list);
 
 	dproc = new EdbDataProc;
-	pvr = new EdbPVRec;
 
+	OpenCheckpoint();
 	Run(par_file);
-
-	/*
-	if (par_file == nullptr) {
-		Run(input_list);
-	} else {
-		Run(input_list, par_file);
-	}
-	*/
+	CloseCheckpoint();
 
 	WriteVertexFile(output_vertex_file);
+	std::remove(checkpoint_file.c_str()); // The output is complete.
+
+	if (profile) FnuMomProfile::Print(std::cout, Seconds(start));
+	if (!profile_json.empty()) {
+		try {
+			FnuMomProfile::WriteJSON(profile_json, Seconds(start));
+		} catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			exit(1);
+		}
+	}
 	
 	return 0;
 }
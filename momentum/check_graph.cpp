@@ -16,33 +16,14 @@
 #include <EdbDataSet.h>
 
 #include "FnuMomCoord.hpp"
+#include "VertexFile.hpp"
+#include "LinkedTracksFile.hpp"
+#include "LinkedTracksIndex.hpp"
 
 
-// To specify track uniquely
-struct Track {
-	int event_id;
-	int plate_id;
-	int seg_id;
-	double x_first;
-	double y_first;
-	int plate_id_last;
-	int npl;
-	int pdg_id;
-	double p_true;
-	double p_reco;
-	int ivertex;
-};
-
-
-// To specify vertex uniquely.
-struct Vertex {
-	int area_id;
-	double vx;
-	double vy;
-	int plate;
-	int ntrk;
-	int ivertex;
-};
+// Track and Vertex are shared with the other tools through VertexFile.
+using Track = VertexFile::Track;
+using Vertex = VertexFile::Vertex;
 
 // Global variables.
 std::vector<Track> tracks;
@@ -65,23 +46,13 @@ bool compareIVertex(const T& struct1, const T& struct2) {
 
 
 bool IsFileValid(std::string input_files) {
-	TFile* file = new TFile(input_files.c_str(), "READ");
-	if (!file->IsOpen() or file->IsZombie()) {
-		invalid_files.push_back(input_files);
-		file -> Close();
-		return false;
-	}
-	TTree* tree = (TTree*) file -> Get("tracks");
+	LinkedTracksFileInfo info = ScanLinkedTracksFile(input_files, false);
+	std::cout << info.entries << " entries." << std::endl;
 
-	int nentries = tree -> GetEntries();
-	std::cout << nentries << " entries." << std::endl;
-
-	if (nentries == 0) {
+	if (!info.IsValid()) {
 		invalid_files.push_back(input_files);
-		file -> Close();
 		return false;
 	}
-	file -> Close();
 	return true;
 }
 
@@ -97,71 +68,17 @@ bool IsTrack(EdbTrackP* track, int event_id, int plate_id, int seg_id) {
 }
 
 void ReadVertexFile(std::string vtx_file) {
-	std::ifstream ifs(vtx_file);
-
-	if (ifs.fail()) {
-		std::cerr << "Failed to open this file." << std::endl;
+	try {
+		VertexFile vf(vtx_file);
+		vf.ToVectors(verteces, tracks);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
 		exit(1);
 	}
 
-	std::string type_name; // 1ry_vtx or 1ry_track.
-
-	// For tracks.
-	int plate_id_first, seg_id_first, plate_id_last, npl, pdg_id, event_id;
-	float x_first, y_first, p_true, p_reco;
-
-	// For veteces.
-	int area_id, plate_id, ntrk;
-	double vx, vy;
-
-	// For the matching of vertex and tracks;
-	int ivertex = -1;
-
-
-	std::string line_buf;
-	while (std::getline(ifs, line_buf)) {
-
-		// Format input data.
-		auto it = std::unique(line_buf.begin(),line_buf.end(),
-            [](char const &lhs, char const &rhs) {
-                return (lhs == rhs) && (lhs == ' ');
-		});
-		//line_buf.erase(it,line_buf.end());
-
-		std::istringstream iss(line_buf);
-		iss >> type_name;
-		if (type_name == "1ry_trk") {
-			iss >> plate_id_first >> seg_id_first >> x_first >> y_first >> plate_id_last >> npl >> pdg_id >> p_true >> p_reco >> event_id;
-
-			Track track;
-			track.event_id = event_id % 100000;
-			track.plate_id = plate_id_first;
-			track.seg_id = seg_id_first;
-			track.ivertex = ivertex;
-			track.x_first = x_first;
-			track.y_first = y_first;
-			track.plate_id_last = plate_id_last;
-			track.npl = npl;
-			track.pdg_id = pdg_id;
-			track.p_true = p_true;
-			track.p_reco = -999;
-			track.ivertex = ivertex;
-
-			tracks.push_back(track);
-		} else if (type_name == "1ry_vtx") {
-			ivertex ++;
-			iss >> area_id >> vx >> vy >> plate_id >> ntrk;
-
-			Vertex vertex;
-			vertex.area_id = area_id;
-			vertex.vx = vx;
-			vertex.vy = vy;
-			vertex.plate = plate_id;
-			vertex.ntrk = ntrk;
-			vertex.ivertex = ivertex;
-
-			verteces.push_back(vertex);
-		}
+	for (Track& track: tracks) {
+		track.event_id = track.event_id % 100000;
+		track.p_reco = -999;
 	}
 
 	// Sort for binary search.
@@ -186,15 +103,19 @@ void PrintMomGraph(std::string linked_tracks_file) {
 		exit(1);
 	}
 
-	TString cut = Form("(s.eMCEvt%%100000)==%d", std::stoi(event_id)%100000);
-
-	EdbDataProc* dproc = new EdbDataProc;
-	EdbPVRec* pvr = new EdbPVRec;
-
 	if (!IsFileValid(linked_tracks_file)) return;
 
-	dproc -> ReadTracksTree(*pvr, linked_tracks_file.c_str(), cut);
-	int ntrk = pvr -> Ntracks();
+	// Same tracks as ReadTracksTree with the cut (s.eMCEvt%100000)==event_id, found in the index instead of scanning the tree.
+	std::vector<EdbTrackP*> trks;
+	try {
+		LinkedTracksIndex index(linked_tracks_file);
+		LinkedTracksReader reader(linked_tracks_file, index.EntriesMod(std::stoi(event_id)%100000, 100000));
+		reader.ReadChunk(trks, reader.NTracks());
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+	int ntrk = trks.size();
 	
 	Track track;
 	track.event_id = std::stoi(event_id)%100000;
@@ -211,7 +132,7 @@ void PrintMomGraph(std::string linked_tracks_file) {
 		int plate_id = trk_buf.plate_id;
 
 		for (int itrk=0; itrk<ntrk; itrk++) {
-			EdbTrackP* track = pvr -> GetTrack(itrk);
+			EdbTrackP* track = trks[itrk];
 			if (IsTrack(track, eve, plate_id, track_id)) {
 				tracks[i].p_reco = mc.CalcMomentum(track, 0);
 				tracks[i].plate_id_last = track -> GetSegmentLast() -> ScanID().GetPlate();
@@ -221,6 +142,8 @@ void PrintMomGraph(std::string linked_tracks_file) {
 			}
 		}
 	}
+
+	for (EdbTrackP* track: trks) LinkedTracksReader::DeleteTrack(track);
 }
 
 void Run(std::string ltlists, const char* par_file="../par/MC_plate_1_100.txt") {
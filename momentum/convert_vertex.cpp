@@ -0,0 +1,117 @@
+/**
+*	@file		convert_vertex.cpp
+*	@brief		vertex fileをtext形式とbinary形式 (*.vtxb) の間で変換する
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <exception>
+
+#include "VertexFile.hpp"
+
+/**
+*	@fn			PrintUsage
+*	@brief		プログラムの使用方法を出力する
+*	@return		void
+*/
+void PrintUsage() {
+	std::cerr << "Usage: " << std::endl;
+	std::cerr << "./convert_vertex -I <input vertex file> -O <output vertex file>" << std::endl;
+	std::cerr << "Output is written in binary if its name ends with .vtxb, otherwise in text." << std::endl;
+	std::cerr << "  --check  read the input and the output again with VertexStream and compare them" << std::endl;
+	return;
+}
+
+/**
+*	@fn			SameValue
+*	@brief		doubleの比較。text形式は有効数字6桁で書かれるので相対1e-5まで同じとみなす
+*/
+bool SameValue(double a, double b) {
+	return a == b or std::fabs(a - b) <= 1e-5 * std::max(std::fabs(a), std::fabs(b));
+}
+
+/**
+*	@fn			CheckSameStream
+*	@brief		2つのvertex fileをVertexStreamで読み、vertexとtrackが全て同じか確かめる
+*	@param		path_a, path_b vertex fileのパス (text, binaryどちらでもよい)
+*	@return		同じならtrue。違えば最初の違いを出力してfalse
+*/
+bool CheckSameStream(std::string path_a, std::string path_b) {
+	VertexStream a(path_a);
+	VertexStream b(path_b);
+	VertexFile::Vertex va, vb;
+	std::vector<VertexFile::Track> ta, tb;
+
+	while (true) {
+		bool has_a = a.Next(va, ta);
+		bool has_b = b.Next(vb, tb);
+		if (!has_a and !has_b) break;
+		if (has_a != has_b) {
+			std::cerr << "Number of verteces differs: " << (has_a ? path_a : path_b) << " has more." << std::endl;
+			return false;
+		}
+
+		long i = a.NRead() - 1;
+		if (va.ivertex != i or vb.ivertex != i or va.area_id != vb.area_id or va.plate != vb.plate or va.ntrk != vb.ntrk
+				or !SameValue(va.vx, vb.vx) or !SameValue(va.vy, vb.vy) or ta.size() != tb.size()) {
+			std::cerr << "Vertex " << i << " differs." << std::endl;
+			return false;
+		}
+
+		for (std::size_t j=0; j<ta.size(); j++) {
+			const VertexFile::Track& x = ta[j];
+			const VertexFile::Track& y = tb[j];
+			if (x.ivertex != i or y.ivertex != i or x.event_id != y.event_id or x.plate_id != y.plate_id or x.seg_id != y.seg_id
+					or x.plate_id_last != y.plate_id_last or x.npl != y.npl or x.pdg_id != y.pdg_id
+					or !SameValue(x.x_first, y.x_first) or !SameValue(x.y_first, y.y_first)
+					or !SameValue(x.p_true, y.p_true) or !SameValue(x.p_reco, y.p_reco)) {
+				std::cerr << "Track " << j << " of vertex " << i << " differs." << std::endl;
+				return false;
+			}
+		}
+	}
+
+	std::cout << a.NRead() << " verteces are the same in both files." << std::endl;
+	return true;
+}
+
+int main(int argc, char** argv) {
+	std::string input_file;
+	std::string output_file;
+	bool check = false;
+
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--check") {
+			check = true;
+			continue;
+		}
+
+		if (i+1 >= argc) break;
+		if (arg == "-I") input_file = argv[++i];
+		else if (arg == "-O") output_file = argv[++i];
+		else i++;
+	}
+
+	if (input_file.empty() or output_file.empty()) {
+		std::cerr << "Error: Argument missing!" << std::endl;
+		PrintUsage();
+		exit(1);
+	}
+
+	try {
+		VertexFile vertex_file(input_file);
+		std::cout << vertex_file.NVertex() << " verteces and " << vertex_file.NTrack() << " tracks are read." << std::endl;
+		vertex_file.Write(output_file);
+		if (check and !CheckSameStream(input_file, output_file)) exit(1);
+	} catch (const std::exception& e) {
+		std::cerr << "Caught exeption: " << e.what() << std::endl;
+		exit(1);
+	}
+
+	std::cout << "Done." << std::endl;
+	return 0;
+}
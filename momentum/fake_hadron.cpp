@@ -12,6 +12,8 @@
 #include <exception>
 #include <stdexcept>
 
+#include "VertexFile.hpp"
+
 
 /**
 *	@fn			PrintUsage
@@ -34,32 +36,16 @@ void PrintUsage() {
 */
 void Run(std::string input_file, std::string output_file) {
 	
-	std::ifstream inputFile(input_file);
+	VertexFile vertex_file(input_file);
 	std::ofstream outputFile(output_file);
 
-	if (!inputFile.is_open()) {
-		throw std::runtime_error("Cannot open the file");
-	}
-
-	std::string type_name; // 1ry_vtx or 1ry_track.
-	// Variables for tracks.
-	int plate_id_first, seg_id_first, plate_id_last, npl, pdg_id, event_id;
-	float x_first, y_first, p_true, p_reco;
-
-	std::string line_buf;
-	while (std::getline(inputFile, line_buf)) {
-		std::istringstream iss(line_buf);
-		iss >> type_name;
-
-		if (type_name == "1ry_trk") {
-			iss >> plate_id_first >> seg_id_first >> x_first >> y_first >> plate_id_last >> npl >> pdg_id >> p_true >> p_reco >> event_id;
-			if (p_reco > 200 and std::sqrt(x_first*x_first + y_first*y_first) > 0.005 and npl >= 10) {
-				outputFile << type_name << "\t" << plate_id_first << "\t" << seg_id_first << "\t" << x_first << "\t" << y_first << "\t" << plate_id_last << "\t" << npl << "\t" << pdg_id << "\t" << p_true << "\t" << p_reco << "\t" << event_id << std::endl;
-			}
+	for (long i=0; i<vertex_file.NTrack(); i++) {
+		VertexFile::Track track = vertex_file.GetTrack(i);
+		if (track.p_reco > 200 and std::sqrt(track.x_first*track.x_first + track.y_first*track.y_first) > 0.005 and track.npl >= 10) {
+			outputFile << "1ry_trk" << "\t" << track.plate_id << "\t" << track.seg_id << "\t" << track.x_first << "\t" << track.y_first << "\t" << track.plate_id_last << "\t" << track.npl << "\t" << track.pdg_id << "\t" << track.p_true << "\t" << track.p_reco << "\t" << track.event_id << std::endl;
 		}
 	}
 
-	inputFile.close();
 	outputFile.close();
 }
 
@@ -1,51 +1,77 @@
 #include <iostream>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <exception>
 
-#include <TObjArray.h>
+#include <TROOT.h>
 
 #include <EdbDataSet.h>
 
 #include "FnuMomCoord.hpp"
+#include "LinkedTracksFile.hpp"
+#include "ThreadPool.hpp"
+#include "FnuMomProfile.hpp"
 
 // Global variables.
 FnuMomCoord mc;
+int nthreads = 1;
+int chunk_tracks = 1000;		// maximum number of the tracks in memory
+long memory_limit_mb = 1024;	// maximum memory of the tracks in memory (MB)
+bool profile = false;			// print the time of each section (FnuMomProfile) at exit
+std::string profile_json;		// write the profile to this file as JSON
 
 void Init(std::string par_file="../par/MC_plate_1_100.txt") {
 	mc.ReadParFile(par_file);
+
+	if (nthreads > 1 and !mc.IsThreadSafe()) {
+		std::cerr << "Warning: fit_engine minuit is not thread safe. Run with 1 thread." << std::endl;
+		nthreads = 1;
+	}
+	if (nthreads > 1) ROOT::EnableThreadSafety();
 }
 
+/**
+ * @fn
+ * @brief linked_tracks.rootを読んで運動量を測定し, 出力ファイルに書き出す.
+ * @detail 飛跡はchunk_tracks本 (またはmemory_limit_mb) ずつ読み, 測定して書き出したら解放するので, メモリはファイルの大きさによらない.
+ */
 void FillMomentum(std::string input_file, std::string output_file="linked_tracks_measured_momentum.root") {
-	EdbDataProc* dproc = new EdbDataProc;
-	EdbPVRec* pvr = new EdbPVRec;
-
-	dproc -> ReadTracksTree(*pvr, input_file.c_str(), "npl>=100");
+	LinkedTracksReader reader(input_file, "npl>=100");
+	LinkedTracksWriter writer(output_file);
 
-	int ntrk = pvr -> Ntracks();
+	long ntrk = reader.NTracks();
+	std::size_t max_bytes = memory_limit_mb * 1024 * 1024;
 
-	TObjArray* selected = new TObjArray();
-	for (int i=0; i<ntrk; i++) {
+	// Each chunk is measured by nthreads threads, each thread has its own workspace.
+	ThreadPool pool(nthreads);
+	std::vector<FnuMomWorkspace> ws(pool.NThreads());
 
-		if (i%1000 == 0) {
-			std::cout << "\033[1A";
-			std::cout << "\033[2K";
-			std::cout << i << "/" << ntrk << " tracks are read." << std::endl;
-		}
+	// progress on one status line, rewritten at most every 0.5 s
+	FnuMomStatusLine status;
+	std::vector<EdbTrackP*> chunk;
+	while (reader.ReadChunk(chunk, chunk_tracks, max_bytes) > 0) {
 
-		EdbTrackP* track = pvr -> GetTrack(i);
-		double momentum = mc.CalcMomentum(track, 0);
-		track -> SetP(momentum);
+		if (status.Due()) status.Print("%ld/%ld tracks are read.", reader.NRead(), ntrk);
 
-		double angle_diff = mc.CalcTrackAngleDiffMax(track);
-	
-		if (angle_diff > 1.0) track -> SetFlag(-1);
+		pool.ParallelFor(chunk.size(), [&](int i, int worker) {
+			EdbTrackP* track = chunk[i];
+			double momentum = mc.Measure(track, ws[worker], 0);
+			track -> SetP(momentum);
 
-		selected -> Add(track);
-	}
+			double angle_diff = mc.CalcTrackAngleDiffMax(track);
 
+			if (angle_diff > 1.0) track -> SetFlag(-1);
+		});
 
-	dproc -> MakeTracksTree(*selected, 0, 0, output_file.c_str());
+		for (EdbTrackP* track : chunk) {
+			writer.Fill(track);
+			LinkedTracksReader::DeleteTrack(track);
+		}
+	}
 
-	delete dproc;
-	delete pvr;
+	writer.Close();
+	status.Finish("%ld/%ld tracks are read.", reader.NRead(), ntrk);
 }
 
 int main(int argc, char** argv) {
@@ -54,14 +80,40 @@ int main(int argc, char** argv) {
 	std::string par_file;
 	std::string output_file;
 
-	for (int i=1; i<argc; i+=2) {
-		if (std::string(argv[i]) == "-I") input_list = argv[i+1];
-		else if (std::string(argv[i]) == "-O") output_file = argv[i+1];
-		else if (std::string(argv[i]) == "-P") par_file = argv[i+1];
+	// --profile: Print the time of each section at exit
+	// --profile-json: Write the profile to a JSON file
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--profile") {
+			profile = true;
+			continue;
+		}
+		if (i+1 >= argc) break;
+		if (arg == "-I") input_list = argv[++i];
+		else if (arg == "-O") output_file = argv[++i];
+		else if (arg == "-P") par_file = argv[++i];
+		else if (arg == "-j") nthreads = std::stoi(argv[++i]);
+		else if (arg == "-c") chunk_tracks = std::stoi(argv[++i]);
+		else if (arg == "-m") memory_limit_mb = std::stol(argv[++i]);
+		else if (arg == "--profile-json") profile_json = argv[++i];
+		else i++;
 	}
+	FnuMomProfile::Enable(profile or !profile_json.empty());
+	auto start = std::chrono::steady_clock::now();
 
 	Init(par_file);
 	FillMomentum(input_list, output_file);
 
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (profile) FnuMomProfile::Print(std::cout, elapsed);
+	if (!profile_json.empty()) {
+		try {
+			FnuMomProfile::WriteJSON(profile_json, elapsed);
+		} catch (const std::exception& e) {
+			std::cerr << e.what() << std::endl;
+			exit(1);
+		}
+	}
+
 	return 0;
 }
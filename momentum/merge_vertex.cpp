@@ -0,0 +1,143 @@
+/**
+*	@file		merge_vertex.cpp
+*	@brief		calc_momentum --shard i/Nの出力を1つのvertex fileにまとめる
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <exception>
+#include <memory>
+
+#include "VertexFile.hpp"
+
+/**
+*	@fn			PrintUsage
+*	@brief		プログラムの使用方法を出力する
+*	@return		void
+*/
+void PrintUsage() {
+	std::cerr << "Usage: " << std::endl;
+	std::cerr << "./merge_vertex -I <shard 0> -I <shard 1> ... -I <shard N-1> -O <output vertex file>" << std::endl;
+	std::cerr << "Give the outputs of calc_momentum --shard i/N in the order of i." << std::endl;
+	std::cerr << "Output is written in binary if its name ends with .vtxb, otherwise in text." << std::endl;
+	return;
+}
+
+/**
+*	@fn			IsSameVertexList
+*	@brief		2つのshardが同じvertex fileから作られたか確かめる
+*	@return		vertex, trackの数とtrackのevent IDが同じならtrue
+*/
+bool IsSameVertexList(const VertexFile& a, const VertexFile& b) {
+	if (a.NVertex() != b.NVertex() or a.NTrack() != b.NTrack()) return false;
+	for (long i=0; i<a.NVertex(); i++) {
+		if (a.TrackBegin(i) != b.TrackBegin(i)) return false;
+	}
+	for (long j=0; j<a.NTrack(); j++) {
+		if (a.TrkEventID()[j] != b.TrkEventID()[j] or a.TrkSegID()[j] != b.TrkSegID()[j]) return false;
+	}
+	return true;
+}
+
+/**
+*	@fn			FindForeignVertex
+*	@brief		shardが担当していないvertexを測定していないか確かめる
+*	@param[in]	shards		shard iの出力がshards[i]
+*	@param[out]	ishard		見つかったshard
+*	@param[out]	ivertex		見つかったvertex
+*	@return		担当外のvertexにp_reco (-999以外) があればtrue
+*	@detail
+*	calc_momentumは担当外のvertexのp_recoを-999のまま書く。-Iの順番が違う場合やshardが足りない・多い場合は
+*	担当がずれるので、測定されたtrackのあるshardならここで見つかる。
+*/
+bool FindForeignVertex(const std::vector<std::unique_ptr<VertexFile>>& shards, int& ishard, long& ivertex) {
+	int nshard = shards.size();
+	for (ishard=0; ishard<nshard; ishard++) {
+		const VertexFile& shard = *shards[ishard];
+		const double* p_reco = shard.TrkPReco();
+		for (ivertex=0; ivertex<shard.NVertex(); ivertex++) {
+			if (shard.ShardOf(ivertex, nshard) == ishard) continue;
+			for (long j=shard.TrackBegin(ivertex); j<shard.TrackEnd(ivertex); j++) {
+				if (p_reco[j] != -999) return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+*	@fn			Merge
+*	@brief		各vertexのp_recoを、そのvertexを担当したshardから取る
+*	@param[in]	shards		shard iの出力がshards[i]
+*	@param[out]	verteces
+*	@param[out]	tracks
+*	@return		void
+*	@detail
+*	各shardの出力は全vertexを元の順番で含んでいるので、並びはshard 0のものを使う。
+*	vertexを担当するshardはcalc_momentumと同じVertexFile::ShardOfで決める。
+*/
+void Merge(const std::vector<std::unique_ptr<VertexFile>>& shards, std::vector<VertexFile::Vertex>& verteces, std::vector<VertexFile::Track>& tracks) {
+	int nshard = shards.size();
+	const VertexFile& base = *shards[0];
+	base.ToVectors(verteces, tracks);
+
+	std::vector<long> nmeasured(nshard, 0);
+	for (long i=0; i<base.NVertex(); i++) {
+		int shard = base.ShardOf(i, nshard);
+		const double* p_reco = shards[shard] -> TrkPReco();
+		for (long j=base.TrackBegin(i); j<base.TrackEnd(i); j++) {
+			tracks[j].p_reco = p_reco[j];
+			nmeasured[shard]++;
+		}
+	}
+
+	for (int i=0; i<nshard; i++) std::cout << "Shard " << i << ": " << nmeasured[i] << " tracks." << std::endl;
+}
+
+int main(int argc, char** argv) {
+	std::vector<std::string> input_files;
+	std::string output_file;
+
+	for (int i=1; i+1<argc; i+=2) {
+		if (std::string(argv[i]) == "-I") input_files.push_back(argv[i+1]);
+		else if (std::string(argv[i]) == "-O") output_file = argv[i+1];
+	}
+
+	if (input_files.empty() or output_file.empty()) {
+		std::cerr << "Error: Argument missing!" << std::endl;
+		PrintUsage();
+		exit(1);
+	}
+
+	try {
+		std::vector<std::unique_ptr<VertexFile>> shards;
+		for (const std::string& path: input_files) {
+			shards.emplace_back(new VertexFile(path));
+			if (!IsSameVertexList(*shards[0], *shards.back())) {
+				std::cerr << "Error: " << path << " is not made from the same vertex file as " << input_files[0] << "." << std::endl;
+				exit(1);
+			}
+		}
+		std::cout << shards[0] -> NVertex() << " verteces and " << shards[0] -> NTrack() << " tracks in " << shards.size() << " shards." << std::endl;
+
+		int ishard;
+		long ivertex;
+		if (FindForeignVertex(shards, ishard, ivertex)) {
+			std::cerr << "Error: " << input_files[ishard] << " has p_reco of vertex " << ivertex << ", which is not of shard " << ishard << "/" << shards.size() << "." << std::endl;
+			std::cerr << "Give all the N outputs of calc_momentum --shard i/N in the order of i." << std::endl;
+			exit(1);
+		}
+
+		std::vector<VertexFile::Vertex> verteces;
+		std::vector<VertexFile::Track> tracks;
+		Merge(shards, verteces, tracks);
+		VertexFile::Write(output_file, verteces, tracks);
+	} catch (const std::exception& e) {
+		std::cerr << "Caught exeption: " << e.what() << std::endl;
+		exit(1);
+	}
+
+	std::cout << "Done." << std::endl;
+	return 0;
+}
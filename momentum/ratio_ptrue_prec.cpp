@@ -5,273 +5,457 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <limits>
+#include <cstdlib>
+#include <cstdio>
 
-struct Track {
-	int event_id;
-	int plate_id;
-	int seg_id;
-	double x_first;
-	double y_first;
-	int plate_id_last;
-	int npl;
-	int pdg_id;
-	double p_true;
-	double p_reco;
-	int ivertex;
+#include "VertexFile.hpp"
+
+// Global variables.
+std::vector<double> thresholds = {200};
+bool stream_mode = false;
+bool write_events = true;
+long nvertex = 0;
+std::string scan_file; // --scan, csv of the threshold scan
+
+/**
+*	@struct		RatioTable
+*	@brief		1つの閾値についてのP_true/P_recの2x2の表
+*/
+struct RatioTable {
+	long p_true_over = 0;
+	long p_true_under = 0;
+
+	long p_true_over_p_rec_over = 0;
+	long p_true_over_p_rec_under = 0;
+	long p_true_under_p_rec_over = 0;
+	long p_true_under_p_rec_under = 0;
+
+	void Fill(bool is_p_true_over, bool is_p_rec_over) {
+		if (is_p_true_over) {
+			p_true_over++;
+			if (is_p_rec_over) p_true_over_p_rec_over++;
+			else p_true_over_p_rec_under++;
+		} else {
+			p_true_under++;
+			if (is_p_rec_over) p_true_under_p_rec_over++;
+			else p_true_under_p_rec_under++;
+		}
+	}
 };
 
+// Tables of all tracks and of muon tracks, one per threshold.
+std::vector<RatioTable> tables;
+std::vector<RatioTable> mu_tables;
+
+/**
+*	@struct		ThresholdScan
+*	@brief		全eventのp_true, p_recの最大値を昇順に並べたもの
+*	@detail		P_true>th かつ P_rec>th は min(P_true, P_rec)>th と同じなので、3つの列をソートしておけば
+*				任意の閾値の2x2の表が二分探索で求まる (ソートO(N log N)、1閾値あたりO(log N))。
+*/
+struct ThresholdScan {
+	std::vector<double> p_true;
+	std::vector<double> p_rec;
+	std::vector<double> p_both; // min(p_true, p_rec)
+
+	void Add(double p_true_max, double p_rec_max) {
+		p_true.push_back(p_true_max);
+		p_rec.push_back(p_rec_max);
+		p_both.push_back(std::min(p_true_max, p_rec_max));
+	}
+
+	void Sort() {
+		std::sort(p_true.begin(), p_true.end());
+		std::sort(p_rec.begin(), p_rec.end());
+		std::sort(p_both.begin(), p_both.end());
+	}
+
+	// number of the values > threshold, the values have to be sorted
+	static long CountOver(const std::vector<double>& v, double threshold) {
+		return v.end() - std::upper_bound(v.begin(), v.end(), threshold);
+	}
 
-// To specify vertex uniquely.
-struct Vertex {
-	int area_id;
-	double vx;
-	double vy;
-	int plate;
-	int ntrk;
-	int ivertex;
+	RatioTable Table(double threshold) const {
+		long n = p_true.size();
+		long true_over = CountOver(p_true, threshold);
+		long rec_over = CountOver(p_rec, threshold);
+		long both_over = CountOver(p_both, threshold);
+
+		RatioTable t;
+		t.p_true_over = true_over;
+		t.p_true_under = n - true_over;
+		t.p_true_over_p_rec_over = both_over;
+		t.p_true_over_p_rec_under = true_over - both_over;
+		t.p_true_under_p_rec_over = rec_over - both_over;
+		t.p_true_under_p_rec_under = n - true_over - rec_over + both_over;
+		return t;
+	}
 };
 
+// Maxima of the valid events, filled only with --scan.
+ThresholdScan scan;
+ThresholdScan mu_scan;
+
+/**
+*	@struct		EventMax
+*	@brief		1 eventのトラックのp_true, p_recの最大値
+*	@detail		「少なくとも1本p>閾値のトラックがいる」は「pの最大値>閾値」と同じなので、
+*				eventごとに最大値だけ持てば全ての閾値の表を1回の読み込みで埋められる。
+*/
+struct EventMax {
+	double p_true;
+	double p_rec;
+	double mu_p_true;
+	double mu_p_rec;
+	bool is_valid; // false if the event includes a track whose p=-999
+
+	void Clear() {
+		p_true = p_rec = mu_p_true = mu_p_rec = -std::numeric_limits<double>::infinity();
+		is_valid = true;
+	}
+
+	void Add(int pdg_id, double p_true_trk, double p_reco_trk) {
+		if (p_reco_trk == -999) is_valid = false;
+		p_true = std::max(p_true, p_true_trk);
+		p_rec = std::max(p_rec, p_reco_trk);
+		if (abs(pdg_id) == 13) {
+			mu_p_true = std::max(mu_p_true, p_true_trk);
+			mu_p_rec = std::max(mu_p_rec, p_reco_trk);
+		}
+	}
+};
 
-// To sort Track structure.
-bool compareTrackId(const Track& track, const Track& target_track) {
-	return track.event_id < target_track.event_id;
-}
 
-// Sort with ivertex.
-template<typename T>
-bool compareIVertex(const T& struct1, const T& struct2) {
-	return struct1.ivertex < struct2.ivertex;
+/**
+*	@fn			PrintUsage
+*	@brief		プログラムの使用方法を出力する
+*	@return		void
+*/
+void PrintUsage() {
+	std::cerr << "Usage: " << std::endl;
+	std::cerr << "./ratio_ptrue_prec -V <vertex file> -O <output file> [options]" << std::endl;
+	std::cerr << "  -t <p>                 threshold of P_true and P_rec in GeV (default 200)" << std::endl;
+	std::cerr << "  --thresholds <p1,p2,..> several thresholds, all the tables are filled in one pass" << std::endl;
+	std::cerr << "  --stream               read the vertex file one vertex at a time (constant memory)" << std::endl;
+	std::cerr << "  --no-events            do not write the tracks of each event" << std::endl;
+	std::cerr << "  --scan <csv>           write efficiency, purity and fake rate for each threshold of the grid" << std::endl;
+	std::cerr << "  --grid <min:max:step>  thresholds of --scan (default: the thresholds of -t/--thresholds)" << std::endl;
+	return;
 }
 
-// Global variables.
-std::vector<Track> tracks;
-std::vector<Vertex> verteces;
-int nvertex;
 
+/**
+*	@fn			ParseThresholds
+*	@brief		カンマ区切りの閾値のリストを読む
+*	@param		list "50,100,200"のような文字列
+*	@return		閾値 (空ならエラーで終了)
+*/
+std::vector<double> ParseThresholds(std::string list) {
+	std::vector<double> values;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (item.empty()) continue;
+		char* end;
+		double value = std::strtod(item.c_str(), &end);
+		if (*end != '\0') {
+			std::cerr << "Invalid threshold: " << item << std::endl;
+			exit(1);
+		}
+		values.push_back(value);
+	}
 
-void ReadVertexFile(std::string vtx_file) {
+	if (values.empty()) {
+		std::cerr << "No threshold is given: " << list << std::endl;
+		exit(1);
+	}
+	return values;
+}
 
-	std::ifstream ifs(vtx_file);
 
-	if (ifs.fail()) {
-		std::cerr << "Failed to open this file." << std::endl;
+/**
+*	@fn			ParseGrid
+*	@brief		"min:max:step"の閾値のグリッドを読む
+*	@param		grid "0:1000:10"のような文字列
+*	@return		min, min+step, ..., max以下の閾値
+*/
+std::vector<double> ParseGrid(std::string grid) {
+	double min, max, step;
+	char tail;
+	if (sscanf(grid.c_str(), "%lf:%lf:%lf%c", &min, &max, &step, &tail) != 3 or step <= 0 or max < min) {
+		std::cerr << "Invalid grid (min:max:step): " << grid << std::endl;
 		exit(1);
 	}
 
-	std::string type_name; // 1ry_vtx or 1ry_track.
-
-	// For tracks.
-	int plate_id_first, seg_id_first, plate_id_last, npl, pdg_id, event_id;
-	float x_first, y_first, p_true, p_reco;
-
-	// For veteces.
-	int area_id, plate_id, ntrk;
-	double vx, vy;
-
-	// For the matching of vertex and tracks;
-	int ivertex = -1;
-	nvertex = 0;
-
-
-	std::string line_buf;
-	while (std::getline(ifs, line_buf)) {
-
-		// Format input data.
-		auto it = std::unique(line_buf.begin(),line_buf.end(),
-            [](char const &lhs, char const &rhs) {
-                return (lhs == rhs) && (lhs == ' ');
-		});
-		//line_buf.erase(it,line_buf.end());
-
-		std::istringstream iss(line_buf);
-		iss >> type_name;
-		if (type_name == "1ry_trk") {
-			iss >> plate_id_first >> seg_id_first >> x_first >> y_first >> plate_id_last >> npl >> pdg_id >> p_true >> p_reco >> event_id;
-
-			Track track;
-			track.event_id = event_id;
-			track.plate_id = plate_id_first;
-			track.seg_id = seg_id_first;
-			track.ivertex = ivertex;
-			track.x_first = x_first;
-			track.y_first = y_first;
-			track.plate_id_last = plate_id_last;
-			track.npl = npl;
-			track.pdg_id = pdg_id;
-			track.p_true = p_true;
-			track.p_reco = p_reco;
-			track.ivertex = ivertex;
-
-			tracks.push_back(track);
-		} else if (type_name == "1ry_vtx") {
-			ivertex ++;
-			nvertex ++;
-			iss >> area_id >> vx >> vy >> plate_id >> ntrk;
-
-			Vertex vertex;
-			vertex.area_id = area_id;
-			vertex.vx = vx;
-			vertex.vy = vy;
-			vertex.plate = plate_id;
-			vertex.ntrk = ntrk;
-			vertex.ivertex = ivertex;
-
-			verteces.push_back(vertex);
-		}
+	std::vector<double> values;
+	// min + k*step instead of adding step, so that the rounding errors do not accumulate
+	long n = (long) ((max - min) / step + 1e-9);
+	for (long k=0; k<=n; k++) values.push_back(min + k * step);
+	return values;
+}
+
+
+/**
+*	@fn			FillEvent
+*	@brief		1 eventを全ての閾値の表に詰める
+*	@param		event eventのトラックの最大値
+*	@return		void
+*/
+void FillEvent(const EventMax& event) {
+	if (!event.is_valid) return; // Skip this event if it includes a track whose p=-999
+
+	for (std::size_t k=0; k<thresholds.size(); k++) {
+		tables[k].Fill(event.p_true > thresholds[k], event.p_rec > thresholds[k]);
+		mu_tables[k].Fill(event.mu_p_true > thresholds[k], event.mu_p_rec > thresholds[k]);
 	}
-	
-	// Sort with ivertex.
-	std::sort(tracks.begin(), tracks.end(), compareIVertex<Track>);
-	std::sort(verteces.begin(), verteces.end(), compareIVertex<Vertex>);
 
-	std::cout << nvertex << " verteces are read." << std::endl;
+	if (!scan_file.empty()) {
+		scan.Add(event.p_true, event.p_rec);
+		mu_scan.Add(event.mu_p_true, event.mu_p_rec);
+	}
 }
 
-void CalcRatio(std::string output_file = "./output/p_true_vs_p_rec.txt") {
 
-	std::ofstream ofs(output_file);
-	
-	// To calculate the ratio.
-	int num_p_true_over = 0;
-	int num_p_true_under = 0;
-
-	int num_p_true_over_p_rec_over = 0;
-	int num_p_true_over_p_rec_under = 0;
-	int num_p_true_under_p_rec_over = 0;
-	int num_p_true_under_p_rec_under = 0;
-
-	// For muon.
-	int num_mu_p_true_over = 0;
-	int num_mu_p_true_under = 0;
-
-	int num_mu_p_true_over_p_rec_over = 0;
-	int num_mu_p_true_over_p_rec_under = 0;
-	int num_mu_p_true_under_p_rec_over = 0;
-	int num_mu_p_true_under_p_rec_under = 0;
-
-	// To check the event;
-	bool is_p_true_over_200;
-	bool is_p_rec_over_200;
-	bool is_mu_p_true_over_200;
-	bool is_mu_p_rec_over_200;
-
-	bool is_this_event_valid; // Skip the event if it includes a track whose p=-999
-
-	for (int i=0; i<verteces.size(); i++) {
-		is_this_event_valid = true;
-		
-		Vertex vertex = verteces[i];
-		int ivertex = vertex.ivertex;
-
-	  	Track trk_buf;
-	  	trk_buf.ivertex = ivertex;
-		std::vector<Track>::iterator iter_lower = std::lower_bound(tracks.begin(), tracks.end(), trk_buf, compareIVertex<Track>);
-		std::vector<Track>::iterator iter_upper = std::upper_bound(tracks.begin(), tracks.end(), trk_buf, compareIVertex<Track>);
-		int idx_lower = std::distance(tracks.begin(), iter_lower);
-		int idx_upper = std::distance(tracks.begin(), iter_upper);
-
-		// Initialize the flags.
-		is_p_true_over_200 = false;
-		is_p_rec_over_200 = false;
-		is_mu_p_true_over_200 = false;
-		is_mu_p_rec_over_200 = false;
-		
-		ofs << "Event ID: " << tracks[idx_lower].event_id << std::endl;
-		for (int j=idx_lower; j<idx_upper; j++) {
-			Track track = tracks[j];
-			ofs << "PGD: " << track.pdg_id << "\tNpl: " << track.npl << "\tP_true: " << track.p_true << "\tP_rec: " << track.p_reco << std::endl;
-
-			if (track.p_reco == -999) is_this_event_valid = false;
-
-			if (track.p_true > 200) is_p_true_over_200 = true;
-			if (track.p_reco > 200) is_p_rec_over_200 = true;
-
-			if (abs(track.pdg_id) == 13) {
-				if (track.p_true > 200) is_mu_p_true_over_200 = true;
-				if (track.p_reco > 200) is_mu_p_rec_over_200 = true;
-			}
-		}
+/**
+*	@fn			WriteTrack
+*	@brief		トラックを1行書き出す
+*/
+void WriteTrack(std::ostream& ofs, int pdg_id, int npl, double p_true, double p_reco) {
+	ofs << "PGD: " << pdg_id << "\tNpl: " << npl << "\tP_true: " << p_true << "\tP_rec: " << p_reco << '\n';
+}
 
-		if (!is_this_event_valid) continue; // Skip this event if it includes a track whose p=-999
 
-		// Check if p_true > 200.
-		if (is_p_true_over_200) {
-			num_p_true_over++;
-			// Check if p_rec > 200.
-			if (is_p_rec_over_200) {
-				num_p_true_over_p_rec_over ++;
-			} else {
-				num_p_true_over_p_rec_under ++;
-			}
-		} else {
-			num_p_true_under++;
-			// Check if p_rec > 200.
-			if (is_p_rec_over_200) {
-				num_p_true_under_p_rec_over ++;
-			} else {
-				num_p_true_under_p_rec_under ++;
-			}
+/**
+*	@fn			ReadVertexFile
+*	@brief		vertex file全体を開いて (binaryはmmap) 全eventを表に詰める
+*	@param		vtx_file vertex fileのパス
+*	@param		ofs eventごとのトラックの出力先
+*	@return		void
+*/
+void ReadVertexFile(std::string vtx_file, std::ostream& ofs) {
+
+	VertexFile vertex_file;
+	try {
+		vertex_file.Open(vtx_file);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+
+	nvertex = vertex_file.NVertex();
+	std::cout << nvertex << " verteces are read." << std::endl;
+
+	// Columns of the tracks.
+	const int* event_id = vertex_file.TrkEventID();
+	const int* pdg_id = vertex_file.TrkPdgID();
+	const int* npl = vertex_file.TrkNpl();
+	const double* p_true = vertex_file.TrkPTrue();
+	const double* p_reco = vertex_file.TrkPReco();
+
+	EventMax event;
+	for (long i=0; i<nvertex; i++) {
+		long idx_lower = vertex_file.TrackBegin(i);
+		long idx_upper = vertex_file.TrackEnd(i);
+
+		event.Clear();
+		if (write_events and idx_lower < idx_upper) ofs << "Event ID: " << event_id[idx_lower] << '\n';
+		for (long j=idx_lower; j<idx_upper; j++) {
+			if (write_events) WriteTrack(ofs, pdg_id[j], npl[j], p_true[j], p_reco[j]);
+			event.Add(pdg_id[j], p_true[j], p_reco[j]);
 		}
 
-		// Check if muon's p_true > 200.
-		if (is_mu_p_true_over_200) {
-			num_mu_p_true_over ++;
-			// Check if muon's p_rec > 200.
-			if (is_mu_p_rec_over_200) {
-				num_mu_p_true_over_p_rec_over ++;
-			} else {
-				num_mu_p_true_over_p_rec_under ++;
-			}
-		} else {
-			num_mu_p_true_under ++;
-			// Check if muon's p_rec > 200.
-			if (is_mu_p_rec_over_200) {
-				num_mu_p_true_under_p_rec_over ++;
-			} else {
-				num_mu_p_true_under_p_rec_under ++;
+		FillEvent(event);
+		if (write_events and event.is_valid) ofs << "======================================================================\n";
+	}
+}
+
+
+/**
+*	@fn			StreamVertexFile
+*	@brief		vertex fileを1 vertexずつ読みながら表に詰める
+*	@detail		メモリに持つのは今のvertexのトラックと表だけなので、vertex fileの大きさによらない。
+*	@param		vtx_file vertex fileのパス
+*	@param		ofs eventごとのトラックの出力先
+*	@return		void
+*/
+void StreamVertexFile(std::string vtx_file, std::ostream& ofs) {
+
+	try {
+		VertexStream stream(vtx_file);
+		VertexFile::Vertex vertex;
+		std::vector<VertexFile::Track> tracks;
+		EventMax event;
+
+		while (stream.Next(vertex, tracks)) {
+			event.Clear();
+			if (write_events and !tracks.empty()) ofs << "Event ID: " << tracks.front().event_id << '\n';
+			for (const VertexFile::Track& track: tracks) {
+				if (write_events) WriteTrack(ofs, track.pdg_id, track.npl, track.p_true, track.p_reco);
+				event.Add(track.pdg_id, track.p_true, track.p_reco);
 			}
-		}
 
-		ofs << "======================================================================" << std::endl;
+			FillEvent(event);
+			if (write_events and event.is_valid) ofs << "======================================================================\n";
+		}
+		nvertex = stream.NRead();
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
 	}
 
-	ofs << std::endl << std::endl;
+	std::cout << nvertex << " verteces are read." << std::endl;
+}
+
+
+/**
+*	@fn			WriteTable
+*	@brief		1つの閾値の2x2の表を書き出す
+*/
+void WriteTable(std::ostream& ofs, const RatioTable& t, double threshold) {
+	ofs << "| | P_rec > " << threshold << " | P_rec < " << threshold << " |" << std::endl;
+	ofs << "| --- | --- | --- |" << std::endl;
+	ofs << "| P_true > " << threshold << " | " << t.p_true_over_p_rec_over << "/" << t.p_true_over << "=" << (double) t.p_true_over_p_rec_over/t.p_true_over << " | " << t.p_true_over_p_rec_under << "/" <<  t.p_true_over << "=" << (double) t.p_true_over_p_rec_under/t.p_true_over << " |" << std::endl;
+	ofs << "| P_true < " << threshold << " | " << t.p_true_under_p_rec_over << "/" << t.p_true_under << "=" << (double) t.p_true_under_p_rec_over/t.p_true_under << " | " << t.p_true_under_p_rec_under << "/" << t.p_true_under << "=" << (double) t.p_true_under_p_rec_under/t.p_true_under << " |" << std::endl;
+}
+
 
+/**
+*	@fn			WriteRatio
+*	@brief		全ての閾値の表と、閾値が複数あれば効率の閾値依存性の表を書き出す
+*/
+void WriteRatio(std::ostream& ofs) {
 
 	ofs << std::endl << std::endl;
 
-	ofs << "Number of events: " << nvertex << std::endl;
-	ofs << "少なくとも1本p_true>200GeVのトラックがいるevent数: " << num_p_true_over << std::endl;
-	ofs << "すべてのトラックがp_true<200GeVのevent数: " << num_p_true_under << std::endl;
-	//ofs << "p_true>200GeVのmuonがいるevent数: " << num_mu_over_200 << std::endl;
 
 	ofs << std::endl << std::endl;
 
-	ofs << "| | P_rec > 200 | P_rec < 200 |" << std::endl;
-	ofs << "| --- | --- | --- |" << std::endl;
-	ofs << "| P_true > 200 | " << num_p_true_over_p_rec_over << "/" << num_p_true_over << "=" << (double) num_p_true_over_p_rec_over/num_p_true_over << " | " << num_p_true_over_p_rec_under << "/" <<  num_p_true_over << "=" << (double) num_p_true_over_p_rec_under/num_p_true_over << " |" << std::endl;
-	ofs << "| P_true < 200 | " << num_p_true_under_p_rec_over << "/" << num_p_true_under << "=" << (double) num_p_true_under_p_rec_over/num_p_true_under << " | " << num_p_true_under_p_rec_under << "/" << num_p_true_under << "=" << (double) num_p_true_under_p_rec_under/num_p_true_under << " |" << std::endl;
+	for (std::size_t k=0; k<thresholds.size(); k++) {
+		double threshold = thresholds[k];
+
+		if (k > 0) ofs << std::endl << std::endl;
+		ofs << "Number of events: " << nvertex << std::endl;
+		ofs << "少なくとも1本p_true>" << threshold << "GeVのトラックがいるevent数: " << tables[k].p_true_over << std::endl;
+		ofs << "すべてのトラックがp_true<" << threshold << "GeVのevent数: " << tables[k].p_true_under << std::endl;
+
+		ofs << std::endl << std::endl;
+		WriteTable(ofs, tables[k], threshold);
+
+		ofs << std::endl << std::endl;
+		ofs << "Only muon tracks." << std::endl;
+		WriteTable(ofs, mu_tables[k], threshold);
+	}
 
+	if (thresholds.size() < 2) return;
+
+	// P(P_rec > th | P_true > th) and P(P_rec > th | P_true < th) as a function of the threshold.
 	ofs << std::endl << std::endl;
-	ofs << "Only muon tracks." << std::endl;
-	ofs << "| | P_rec > 200 | P_rec < 200 |" << std::endl;
-	ofs << "| --- | --- | --- |" << std::endl;
-	ofs << "| P_true > 200 | " << num_mu_p_true_over_p_rec_over << "/" << num_mu_p_true_over << "=" << (double) num_mu_p_true_over_p_rec_over/num_mu_p_true_over << " | " << num_mu_p_true_over_p_rec_under << "/" << num_mu_p_true_over << "=" << (double) num_mu_p_true_over_p_rec_under/num_mu_p_true_over << " |" << std::endl;
-	ofs << "| P_true < 200 | " << num_mu_p_true_under_p_rec_over << "/" << num_mu_p_true_under << "=" << (double) num_mu_p_true_under_p_rec_over/num_mu_p_true_under << " | " << num_mu_p_true_under_p_rec_under << "/" << num_mu_p_true_under << "=" << (double) num_mu_p_true_under_p_rec_under/num_mu_p_true_under << " |" << std::endl;
+	ofs << "Efficiency vs threshold." << std::endl;
+	ofs << "| Threshold | P_rec > th / P_true > th | P_rec > th / P_true < th | muon P_rec > th / P_true > th | muon P_rec > th / P_true < th |" << std::endl;
+	ofs << "| --- | --- | --- | --- | --- |" << std::endl;
+	for (std::size_t k=0; k<thresholds.size(); k++) {
+		const RatioTable& t = tables[k];
+		const RatioTable& m = mu_tables[k];
+		ofs << "| " << thresholds[k]
+			<< " | " << t.p_true_over_p_rec_over << "/" << t.p_true_over << "=" << (double) t.p_true_over_p_rec_over/t.p_true_over
+			<< " | " << t.p_true_under_p_rec_over << "/" << t.p_true_under << "=" << (double) t.p_true_under_p_rec_over/t.p_true_under
+			<< " | " << m.p_true_over_p_rec_over << "/" << m.p_true_over << "=" << (double) m.p_true_over_p_rec_over/m.p_true_over
+			<< " | " << m.p_true_under_p_rec_over << "/" << m.p_true_under << "=" << (double) m.p_true_under_p_rec_over/m.p_true_under
+			<< " |" << std::endl;
+	}
+}
+
+/**
+*	@fn			WriteScan
+*	@brief		閾値ごとの効率、純度、fake rateをcsvで書き出す
+*	@detail		efficiency = N(P_true>th, P_rec>th) / N(P_true>th)、
+*				purity = N(P_true>th, P_rec>th) / N(P_rec>th)、
+*				fake_rate = N(P_true<th, P_rec>th) / N(P_true<th)。muonはmu_で始まる列。
+*	@param		path 出力ファイルのパス
+*	@param		grid 閾値
+*	@return		void
+*/
+void WriteScan(std::string path, const std::vector<double>& grid) {
+	std::ofstream ofs(path);
+	if (ofs.fail()) {
+		std::cerr << "Error! Could not open the file: " << path << std::endl;
+		exit(1);
+	}
+
+	scan.Sort();
+	mu_scan.Sort();
+
+	ofs << "threshold,n_event,n_true_over,n_rec_over,n_both_over,efficiency,purity,fake_rate,"
+		<< "mu_n_true_over,mu_n_rec_over,mu_n_both_over,mu_efficiency,mu_purity,mu_fake_rate" << std::endl;
+	for (double threshold: grid) {
+		RatioTable t = scan.Table(threshold);
+		RatioTable m = mu_scan.Table(threshold);
+		long rec_over = t.p_true_over_p_rec_over + t.p_true_under_p_rec_over;
+		long mu_rec_over = m.p_true_over_p_rec_over + m.p_true_under_p_rec_over;
+
+		ofs << threshold << "," << scan.p_true.size() << ","
+			<< t.p_true_over << "," << rec_over << "," << t.p_true_over_p_rec_over << ","
+			<< (double) t.p_true_over_p_rec_over/t.p_true_over << "," << (double) t.p_true_over_p_rec_over/rec_over << ","
+			<< (double) t.p_true_under_p_rec_over/t.p_true_under << ","
+			<< m.p_true_over << "," << mu_rec_over << "," << m.p_true_over_p_rec_over << ","
+			<< (double) m.p_true_over_p_rec_over/m.p_true_over << "," << (double) m.p_true_over_p_rec_over/mu_rec_over << ","
+			<< (double) m.p_true_under_p_rec_over/m.p_true_under << '\n';
+	}
+	ofs.flush();
+	if (ofs.fail()) {
+		std::cerr << "Error! Failed to write the file: " << path << std::endl;
+		exit(1);
+	}
+
+	std::cout << grid.size() << " thresholds are written to " << path << std::endl;
 }
 
 int main(int argc, char** argv) {
 
-	char* input_vertex_file;
-	char* output_file;
+	std::string input_vertex_file;
+	std::string output_file = "./output/p_true_vs_p_rec.txt";
+	std::vector<double> grid;
+
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--stream") {
+			stream_mode = true;
+			continue;
+		} else if (arg == "--no-events") {
+			write_events = false;
+			continue;
+		}
+
+		if (i+1 >= argc) break;
+		if (arg == "-V") input_vertex_file = argv[++i];
+		else if (arg == "-O") output_file = argv[++i];
+		else if (arg == "-t") thresholds = ParseThresholds(argv[++i]);
+		else if (arg == "--thresholds") thresholds = ParseThresholds(argv[++i]);
+		else if (arg == "--scan") scan_file = argv[++i];
+		else if (arg == "--grid") grid = ParseGrid(argv[++i]);
+		else i++;
+	}
+
+	if (input_vertex_file.empty()) {
+		std::cerr << "Error: Argument missing!" << std::endl;
+		PrintUsage();
+		exit(1);
+	}
+
+	tables.assign(thresholds.size(), RatioTable());
+	mu_tables.assign(thresholds.size(), RatioTable());
 
-	for (int i=1; i<argc; i+=2) {
-		if (std::string(argv[i]) == "-V") input_vertex_file = argv[i+1];
-		else if (std::string(argv[i]) == "-O") output_file = argv[i+1];
+	std::ofstream ofs(output_file);
+	if (ofs.fail()) {
+		std::cerr << "Cannot open the file: " << output_file << std::endl;
+		exit(1);
 	}
 
-	ReadVertexFile(input_vertex_file);
-	CalcRatio(output_file);
+	if (stream_mode) StreamVertexFile(input_vertex_file, ofs);
+	else ReadVertexFile(input_vertex_file, ofs);
+	WriteRatio(ofs);
+	if (!scan_file.empty()) WriteScan(scan_file, grid.empty() ? thresholds : grid);
 
 	return 0;
 }
@@ -0,0 +1,377 @@
+/**
+*	@file		regress_momentum.cpp
+*	@brief		FnuMomCoordの測定結果をgolden fileと比べる
+*	@detail
+*	FnuMomTrackSimで決まったtrack (多重散乱、pos_resoのsmear、missing plate、kink) を生成し、
+*	CalcMomentumの結果とntの全columnをgolden fileの値と許容誤差内で比べる。MCのファイルは使わない。
+*	--writeでgolden fileを書く。生成の設定はgolden fileのheaderに書かれ、比べるときはそれを使う。
+*	ReentrantなMeasure (calc_momentumのthread) がCalcMomentumと同じ値を返すことも確かめる。
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include <TNtuple.h>
+
+#include <EdbDataSet.h>
+
+#include "FnuMomCoord.hpp"
+#include "FnuMomTrackSim.hpp"
+#include "LinkedTracksFile.hpp"
+
+const int kNColumn = 15;
+const char* kColumnNames[kNColumn] = {"Ptrue", "Prec_Coord", "sigma_error_Coord", "Prec_inv_Coord", "sigma_error_inv_Coord",
+	"Prec_inv_Coord_error", "Prec_Lat", "sigma_error_Lat", "Prec_inv_Lat", "sigma_error_inv_Lat", "nicell", "itype", "trid",
+	"angle_diff_max", "slope"};
+
+/**
+*	@struct		RegressConfig
+*	@brief		生成するtrackの設定、golden fileのheaderに書かれる
+*/
+struct RegressConfig {
+	unsigned long seed = 1;
+	int ntrack = 8;						// 運動量、plate数の組み合わせごとのtrack数
+	std::vector<double> momenta = {1, 5, 20, 100, 500, 2000};
+	std::vector<int> plate_counts = {10, 30, 100, 300};
+	double missing = 0.1;
+	double kink_prob = 0.2;
+	double kink_angle = 0.02;
+};
+
+/**
+*	@struct		TrackResult
+*	@brief		1 trackの測定結果
+*/
+struct TrackResult {
+	int id;
+	double p_true;
+	int nplate;
+	int kink_plate;
+	float p_rec;						// CalcMomentumの戻り値
+	std::vector<std::vector<float>> rows;	// このtrackでntに詰められた行
+};
+
+RegressConfig config;
+double rel_tol = 1e-4;
+double abs_tol = 1e-9;
+int max_print = 20;
+
+
+/**
+*	@fn			PrintUsage
+*	@brief		プログラムの使用方法を出力する
+*	@return		void
+*/
+void PrintUsage() {
+	std::cerr << "Usage: " << std::endl;
+	std::cerr << "./regress_momentum -P <par file> -G <golden file> [--write] [--rtol <tolerance>] [--atol <tolerance>]" << std::endl;
+	std::cerr << "With --write the golden file is written, otherwise the results are compared with it." << std::endl;
+	return;
+}
+
+/**
+*	@fn			JoinList
+*	@brief		数値をカンマ区切りにする
+*/
+template<typename T>
+std::string JoinList(const std::vector<T>& values) {
+	std::ostringstream oss;
+	for (std::size_t i=0; i<values.size(); i++) oss << (i > 0 ? "," : "") << values[i];
+	return oss.str();
+}
+
+/**
+*	@fn			SplitList
+*	@brief		カンマ区切りの数値を読む
+*/
+template<typename T>
+std::vector<T> SplitList(std::string str) {
+	std::vector<T> values;
+	std::stringstream ss(str);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (item.empty()) continue;
+		values.push_back(std::stod(item));
+	}
+	return values;
+}
+
+/**
+*	@fn			RunTracks
+*	@brief		trackを生成してCalcMomentumで測定する
+*	@param[in]	par_file	運動量測定のパラメータファイル
+*	@param[out]	nmismatch_measure	MeasureがCalcMomentumと違う値を返したtrack数
+*	@return		全trackの結果
+*/
+std::vector<TrackResult> RunTracks(std::string par_file, int& nmismatch_measure) {
+	FnuMomCoord mc;
+	mc.ReadParFile(par_file);
+	mc.ShowPar();
+
+	FnuMomSimConfig sim_config;
+	sim_config.ReadParFile(par_file);
+	sim_config.missing = config.missing;
+	sim_config.kink_prob = config.kink_prob;
+	sim_config.kink_angle = config.kink_angle;
+	FnuMomTrackSim sim(sim_config, config.seed);
+
+	TNtuple* nt = mc.GetNtuple();
+	FnuMomWorkspace ws;
+	std::vector<TrackResult> results;
+	nmismatch_measure = 0;
+	int id = 0;
+	for (double p: config.momenta) {
+		for (int nplate: config.plate_counts) {
+			for (int i=0; i<config.ntrack; i++, id++) {
+				EdbTrackP* track = sim.GenerateTrack(p, nplate, id);
+
+				TrackResult result;
+				result.id = id;
+				result.p_true = p;
+				result.nplate = nplate;
+				result.kink_plate = sim.KinkPlate();
+
+				long first = nt -> GetEntries();
+				result.p_rec = mc.CalcMomentum(track, 0);
+				for (long entry=first; entry<nt -> GetEntries(); entry++) {
+					nt -> GetEntry(entry);
+					float* args = nt -> GetArgs();
+					result.rows.push_back(std::vector<float>(args, args + kNColumn));
+				}
+
+				// the reentrant interface used by calc_momentum must give the same value
+				float p_measure = mc.Measure(track, ws, 0);
+				if (p_measure != result.p_rec and !(std::isnan(p_measure) and std::isnan(result.p_rec))) {
+					if (nmismatch_measure < max_print) {
+						printf("Measure differs from CalcMomentum: track %d, %.9g / %.9g\n", id, p_measure, result.p_rec);
+					}
+					nmismatch_measure++;
+				}
+
+				results.push_back(result);
+				LinkedTracksReader::DeleteTrack(track);
+			}
+		}
+	}
+
+	return results;
+}
+
+/**
+*	@fn			WriteGolden
+*	@brief		golden fileを書く
+*	@param[in]	path
+*	@param[in]	par_file
+*	@param[in]	results
+*	@return		void
+*/
+void WriteGolden(std::string path, std::string par_file, const std::vector<TrackResult>& results) {
+	std::ofstream ofs(path);
+	if (ofs.fail()) {
+		std::cerr << "Error! Could not open the file: " << path << std::endl;
+		exit(1);
+	}
+
+	ofs << "# golden output of regress_momentum, par file " << par_file << std::endl;
+	ofs << "# seed " << config.seed << std::endl;
+	ofs << "# ntrack " << config.ntrack << std::endl;
+	ofs << "# momenta " << JoinList(config.momenta) << std::endl;
+	ofs << "# plates " << JoinList(config.plate_counts) << std::endl;
+	ofs << "# missing " << config.missing << std::endl;
+	ofs << "# kink_prob " << config.kink_prob << std::endl;
+	ofs << "# kink_angle " << config.kink_angle << std::endl;
+	ofs << "# T id p_true nplate kink_plate p_rec" << std::endl;
+	ofs << "# N " << JoinList(std::vector<std::string>(kColumnNames, kColumnNames + kNColumn)) << std::endl;
+
+	char buf[64];
+	for (const TrackResult& r: results) {
+		snprintf(buf, sizeof(buf), "%.9g", r.p_rec);
+		ofs << "T " << r.id << " " << r.p_true << " " << r.nplate << " " << r.kink_plate << " " << buf << std::endl;
+		for (const std::vector<float>& row: r.rows) {
+			ofs << "N";
+			for (float value: row) {
+				snprintf(buf, sizeof(buf), "%.9g", value);
+				ofs << " " << buf;
+			}
+			ofs << std::endl;
+		}
+	}
+}
+
+/**
+*	@fn			ReadGolden
+*	@brief		golden fileを読む。headerの設定はconfigに入れる
+*	@param[in]	path
+*	@return		golden fileの結果
+*/
+std::vector<TrackResult> ReadGolden(std::string path) {
+	std::ifstream ifs(path);
+	if (ifs.fail()) {
+		std::cerr << "Error! Could not open the file: " << path << std::endl;
+		exit(1);
+	}
+
+	std::vector<TrackResult> results;
+	std::string line;
+	while (std::getline(ifs, line)) {
+		if (line.empty()) continue;
+		std::istringstream iss(line);
+		std::string tag;
+		iss >> tag;
+		if (tag == "#") {
+			std::string key, value;
+			iss >> key >> value;
+			if (key == "seed") config.seed = std::stoul(value);
+			else if (key == "ntrack") config.ntrack = std::stoi(value);
+			else if (key == "momenta") config.momenta = SplitList<double>(value);
+			else if (key == "plates") config.plate_counts = SplitList<int>(value);
+			else if (key == "missing") config.missing = std::stod(value);
+			else if (key == "kink_prob") config.kink_prob = std::stod(value);
+			else if (key == "kink_angle") config.kink_angle = std::stod(value);
+		} else if (tag == "T") {
+			TrackResult r;
+			std::string p_rec;
+			iss >> r.id >> r.p_true >> r.nplate >> r.kink_plate >> p_rec;
+			r.p_rec = strtof(p_rec.c_str(), nullptr);
+			results.push_back(r);
+		} else if (tag == "N" and !results.empty()) {
+			// strtof, not >>, reads also nan and inf
+			std::vector<float> row(kNColumn);
+			std::string value;
+			for (int i=0; i<kNColumn; i++) {
+				iss >> value;
+				row[i] = strtof(value.c_str(), nullptr);
+			}
+			results.back().rows.push_back(row);
+		} else {
+			std::cerr << "Error! Invalid line in the golden file: " << line << std::endl;
+			exit(1);
+		}
+		if (iss.fail()) {
+			std::cerr << "Error! Invalid line in the golden file: " << line << std::endl;
+			exit(1);
+		}
+	}
+
+	return results;
+}
+
+/**
+*	@fn			IsClose
+*	@brief		|a - b| <= atol + rtol * |b|、NaNどうし、infどうしは同じとする
+*/
+bool IsClose(double a, double b) {
+	if (std::isnan(a) or std::isnan(b)) return std::isnan(a) and std::isnan(b);
+	if (std::isinf(a) or std::isinf(b)) return a == b;
+	return std::fabs(a - b) <= abs_tol + rel_tol * std::fabs(b);
+}
+
+/**
+*	@fn			Compare
+*	@brief		測定結果をgoldenと比べ、違うものを出力する
+*	@param[in]	results
+*	@param[in]	golden
+*	@return		違っていた値の数
+*/
+int Compare(const std::vector<TrackResult>& results, const std::vector<TrackResult>& golden) {
+	if (results.size() != golden.size()) {
+		printf("Number of tracks differs: %zu / golden %zu\n", results.size(), golden.size());
+		return 1;
+	}
+
+	int nmismatch = 0;
+	long nvalue = 0;
+	double max_rel[kNColumn + 1] = {0};	// 最後はp_rec
+	auto check = [&](double value, double expected, int column, int id, int irow) {
+		nvalue++;
+		if (std::isfinite(value) and std::isfinite(expected) and expected != 0) {
+			max_rel[column] = std::max(max_rel[column], std::fabs(value - expected) / std::fabs(expected));
+		}
+		if (IsClose(value, expected)) return;
+		if (nmismatch < max_print) {
+			printf("Mismatch: track %d, %s%s: %.9g / golden %.9g\n", id, column == kNColumn ? "p_rec" : kColumnNames[column],
+					irow < 0 ? "" : Form(" (row %d)", irow), value, expected);
+		}
+		nmismatch++;
+	};
+
+	for (std::size_t i=0; i<results.size(); i++) {
+		const TrackResult& r = results[i];
+		const TrackResult& g = golden[i];
+		if (r.id != g.id or r.nplate != g.nplate or r.kink_plate != g.kink_plate or r.rows.size() != g.rows.size()) {
+			if (nmismatch < max_print) {
+				printf("Track %d differs: nplate %d / %d, kink plate %d / %d, ntuple rows %zu / %zu\n", g.id, r.nplate, g.nplate,
+						r.kink_plate, g.kink_plate, r.rows.size(), g.rows.size());
+			}
+			nmismatch++;
+			continue;
+		}
+		check(r.p_rec, g.p_rec, kNColumn, r.id, -1);
+		for (std::size_t irow=0; irow<r.rows.size(); irow++) {
+			for (int icol=0; icol<kNColumn; icol++) check(r.rows[irow][icol], g.rows[irow][icol], icol, r.id, irow);
+		}
+	}
+
+	printf("%zu tracks, %ld values compared (rtol = %g, atol = %g), %d mismatches.\n", results.size(), nvalue, rel_tol, abs_tol, nmismatch);
+	printf("Maximum relative difference:\n");
+	printf("  %-24s %g\n", "p_rec", max_rel[kNColumn]);
+	for (int icol=0; icol<kNColumn; icol++) printf("  %-24s %g\n", kColumnNames[icol], max_rel[icol]);
+	return nmismatch;
+}
+
+int main(int argc, char** argv) {
+	std::string par_file;
+	std::string golden_file;
+	bool write = false;
+
+	// -P: Path of parameter file for momentum measurement
+	// -G: Path of golden file
+	// --write: Write the golden file instead of comparing
+	// --rtol, --atol: Relative and absolute tolerance of the comparison
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--write") {
+			write = true;
+			continue;
+		}
+		if (i+1 >= argc) break;
+		if (arg == "-P") par_file = argv[++i];
+		else if (arg == "-G") golden_file = argv[++i];
+		else if (arg == "--rtol") rel_tol = std::stod(argv[++i]);
+		else if (arg == "--atol") abs_tol = std::stod(argv[++i]);
+		else i++;
+	}
+	if (par_file.empty() or golden_file.empty()) {
+		std::cerr << "Error: Argument missing!" << std::endl;
+		PrintUsage();
+		exit(1);
+	}
+
+	std::vector<TrackResult> golden;
+	if (!write) golden = ReadGolden(golden_file);
+
+	int nmismatch_measure = 0;
+	std::vector<TrackResult> results = RunTracks(par_file, nmismatch_measure);
+
+	if (write) {
+		WriteGolden(golden_file, par_file, results);
+		std::cout << results.size() << " tracks are written to " << golden_file << std::endl;
+		return nmismatch_measure > 0 ? 1 : 0;
+	}
+
+	int nmismatch = Compare(results, golden);
+	if (nmismatch_measure > 0) printf("Measure differs from CalcMomentum for %d tracks.\n", nmismatch_measure);
+	if (nmismatch > 0 or nmismatch_measure > 0) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
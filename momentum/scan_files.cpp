@@ -0,0 +1,144 @@
+/**
+*	@file		scan_files.cpp
+*	@brief		LTListのlinked_tracks.rootを並列にチェックしてmanifestを書く
+*	@detail
+*	各ファイルについて、開けるか、tracks treeがあるか、entry数、s.eMCEvtの範囲を調べる。
+*	manifestはcalc_momentum -Mで-Iのリストの代わりに読める。
+*	--indexを付けると、正常なファイルのMCEvt index (<path>.mcidx, LinkedTracksIndex) も作る。
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <exception>
+
+#include <TROOT.h>
+
+#include "ThreadPool.hpp"
+#include "LinkedTracksFile.hpp"
+#include "LinkedTracksIndex.hpp"
+
+/**
+*	@fn			PrintUsage
+*	@brief		プログラムの使用方法を出力する
+*	@return		void
+*/
+void PrintUsage() {
+	std::cerr << "Usage: " << std::endl;
+	std::cerr << "./scan_files -I <LTList> -O <manifest> [-j <threads>] [--index]" << std::endl;
+	std::cerr << "The manifest can be given to calc_momentum with -M instead of -I." << std::endl;
+	return;
+}
+
+/**
+*	@fn			ReadFileList
+*	@brief		LTListからlinked_tracks.rootのパスを読む
+*	@param[in]	ltlists		linked_tracks.rootのパスが書かれているテキストファイルのパス
+*	@return		パスのリスト
+*/
+std::vector<std::string> ReadFileList(std::string ltlists) {
+	std::ifstream ifs(ltlists);
+	if (ifs.fail()) {
+		std::cerr << "Error! Could not open the file: " << ltlists << std::endl;
+		exit(1);
+	}
+
+	std::vector<std::string> paths;
+	std::string path;
+	while (std::getline(ifs, path)) {
+		if (path.empty()) continue;
+		paths.push_back(path);
+	}
+
+	return paths;
+}
+
+/**
+*	@fn			PrintSummary
+*	@brief		statusごとのファイル数と壊れたファイルを出力する
+*	@param[in]	infos
+*	@return		壊れたファイルの数
+*/
+int PrintSummary(const std::vector<LinkedTracksFileInfo>& infos) {
+	std::map<std::string, int> nstatus;
+	long nentries = 0;
+	long size = 0;
+	for (const LinkedTracksFileInfo& info: infos) {
+		nstatus[info.status]++;
+		nentries += info.entries;
+		size += info.size;
+	}
+
+	std::cout << infos.size() << " files, " << nentries << " tracks, " << size / (1024. * 1024.) << " MB." << std::endl;
+	for (auto& status: nstatus) std::cout << "  " << status.first << ": " << status.second << std::endl;
+
+	int nbad = 0;
+	for (const LinkedTracksFileInfo& info: infos) {
+		if (info.IsValid()) continue;
+		if (nbad == 0) std::cout << "Invalid files:" << std::endl;
+		std::cout << "  " << info.path << " (" << info.status << ")" << std::endl;
+		nbad++;
+	}
+
+	return nbad;
+}
+
+int main(int argc, char** argv) {
+	std::string input_list;
+	std::string output_manifest;
+	int nthreads = 1;
+	bool build_index = false;
+
+	// -I: Path of list file of linked_tracks.root
+	// -O: Path of output manifest
+	// -j: Number of threads
+	// --index: Build the MCEvt index of each valid file
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--index") {
+			build_index = true;
+			continue;
+		}
+		if (i+1 >= argc) break;
+		if (arg == "-I") input_list = argv[++i];
+		else if (arg == "-O") output_manifest = argv[++i];
+		else if (arg == "-j") nthreads = std::stoi(argv[++i]);
+		else i++;
+	}
+	if (input_list.empty() or output_manifest.empty()) {
+		std::cerr << "Error: Argument missing!" << std::endl;
+		PrintUsage();
+		exit(1);
+	}
+
+	std::vector<std::string> paths = ReadFileList(input_list);
+
+	// Each file is opened by one thread.
+	ROOT::EnableThreadSafety();
+	ThreadPool pool(nthreads);
+	std::vector<LinkedTracksFileInfo> infos(paths.size());
+	pool.ParallelFor(paths.size(), [&](int i, int worker) {
+		infos[i] = ScanLinkedTracksFile(paths[i]);
+		if (!build_index or !infos[i].IsValid()) return;
+
+		// an up-to-date index is only loaded
+		try {
+			LinkedTracksIndex index(paths[i]);
+		} catch (const std::exception& e) {
+			infos[i].status = "index_failed";
+		}
+	});
+
+	try {
+		WriteManifest(output_manifest, infos);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+
+	// The manifest is written also with invalid files, calc_momentum skips them.
+	int nbad = PrintSummary(infos);
+	return nbad > 0 ? 1 : 0;
+}
@@ -12,6 +12,8 @@
 #include <algorithm>
 #include <unordered_map>
 
+#include "VertexFile.hpp"
+
 /// @struct Track
 /// @brief Structure for uniquely indentifying tracks.
 /// @note Note
@@ -50,6 +52,8 @@ struct Track {
 // Global variables
 std::vector<Track> tracks_over200_with_100plates; // Track whose momentum is smaller than 100 GeV with 50 plates.
 std::unordered_map<int, int> event_count_map;
+double p_low = 100; // Momentum cut with 50 plates [GeV].
+double p_high = 200; // Momentum cut with 100 plates [GeV].
 
 
 /// @fn PrintUsage
@@ -57,7 +61,7 @@ std::unordered_map<int, int> event_count_map;
 /// @return void
 /// @note Note
 void PrintUsage() {
-	std::cerr << "Usage: " << std::endl; std::cerr << "./selection_pass_fail_investigator -S <Vertex file with 50 plates> -L <Vertex file with 100 plates>" << std::endl;
+	std::cerr << "Usage: " << std::endl; std::cerr << "./selection_pass_fail_investigator -S <Vertex file with 50 plates> -L <Vertex file with 100 plates> [--low <GeV (default 100)>] [--high <GeV (default 200)>]" << std::endl;
 	return;
 }
 
@@ -72,7 +76,7 @@ void sortTracks() {
 }
 
 /// @fn pushTracksOver200With100plates
-/// @brief Search tracks whose momentum is larger than 200 GeV with 100 plates.
+/// @brief Search tracks whose momentum is larger than p_high (200 GeV by default) with 100 plates.
 /// @param filename Filename of the vertex file.
 /// @return void
 /// @Refer
@@ -80,35 +84,19 @@ void sortTracks() {
 /// @noteNote
 void pushTracksOver200With100plates(std::string filename) {
 	
-	std::ifstream inputFile(filename);
-
-	if (!inputFile) {
-		throw std::runtime_error("Cannot open the file");
-	}
-
-	std::string type_name; // 1ry_vtx or 1ry_track.
-	// Variables for tracks.
-	int plate_id_first, seg_id_first, plate_id_last, npl, pdg_id, event_id;
-	float x_first, y_first, p_true, p_reco;
-
-	std::string line_buf;
-	while (std::getline(inputFile, line_buf)) {
-		std::istringstream iss(line_buf);
-		iss >> type_name;
-		if (type_name == "1ry_trk") {
-			iss >> plate_id_first >> seg_id_first >> x_first >> y_first >> plate_id_last >> npl >> pdg_id >> p_true >> p_reco >> event_id;
-			event_count_map[event_id]++;
-			if (p_reco > 200) {
-				Track t(event_id, seg_id_first, plate_id_first, p_reco, npl);
-				t.SetPdgId(pdg_id);
-				t.SetPTrue(p_true);
-				tracks_over200_with_100plates.push_back(t);
-			}
+	VertexFile vertex_file(filename);
+
+	for (long i=0; i<vertex_file.NTrack(); i++) {
+		VertexFile::Track track = vertex_file.GetTrack(i);
+		event_count_map[track.event_id]++;
+		if (track.p_reco > p_high) {
+			Track t(track.event_id, track.seg_id, track.plate_id, track.p_reco, track.npl);
+			t.SetPdgId(track.pdg_id);
+			t.SetPTrue(track.p_true);
+			tracks_over200_with_100plates.push_back(t);
 		}
 	}
 
-	inputFile.close();
-
 	// Sort tracks_over200_with_100plates with event_id.
 	sortTracks();
 
@@ -117,36 +105,22 @@ void pushTracksOver200With100plates(std::string filename) {
 
 void SearchTrackFailureMomentumSelection(std::string vtx_file_50plates) {
 	
-	std::ifstream inputFile(vtx_file_50plates);
-
-	if (!inputFile) {
-		throw std::runtime_error("Cannot open the file");
-	}
-
-	std::string type_name; // 1ry_vtx or 1ry_track.
-	// Variables for tracks.
-	int plate_id_first, seg_id_first, plate_id_last, npl, pdg_id, event_id;
-	float x_first, y_first, p_true, p_reco;
-
-	std::string line_buf;
-	while (std::getline(inputFile, line_buf)) {
-		std::istringstream iss(line_buf);
-		iss >> type_name;
-		if (type_name == "1ry_trk") {
-			iss >> plate_id_first >> seg_id_first >> x_first >> y_first >> plate_id_last >> npl >> pdg_id >> p_true >> p_reco >> event_id;
-			if (p_reco < 100) {
-				Track t(event_id, seg_id_first, plate_id_first, p_reco, npl);
-				t.SetPdgId(pdg_id);
-				t.SetPTrue(p_true);
-				// Binary search
-				auto iter = std::lower_bound(tracks_over200_with_100plates.begin(), tracks_over200_with_100plates.end(), t);
-				if (*iter == t) {
-					std::cout << "====================" << std::endl;
-					std::cout << "50 plates:\t";
-					t.Print();
-					std::cout << "100 plates:\t";
-					iter->Print();
-				}
+	VertexFile vertex_file(vtx_file_50plates);
+
+	for (long i=0; i<vertex_file.NTrack(); i++) {
+		VertexFile::Track track = vertex_file.GetTrack(i);
+		if (track.p_reco < p_low) {
+			Track t(track.event_id, track.seg_id, track.plate_id, track.p_reco, track.npl);
+			t.SetPdgId(track.pdg_id);
+			t.SetPTrue(track.p_true);
+			// Binary search
+			auto iter = std::lower_bound(tracks_over200_with_100plates.begin(), tracks_over200_with_100plates.end(), t);
+			if (*iter == t) {
+				std::cout << "====================" << std::endl;
+				std::cout << "50 plates:\t";
+				t.Print();
+				std::cout << "100 plates:\t";
+				iter->Print();
 			}
 		}
 	}
@@ -193,6 +167,12 @@ int main(int argc, char** argv) {
 			} else if (arg == "-L") {
 				vtx_file_100plates = argv[i+1];
 				i++;
+			} else if (arg == "--low") {
+				p_low = std::stod(argv[i+1]);
+				i++;
+			} else if (arg == "--high") {
+				p_high = std::stod(argv[i+1]);
+				i++;
 			} else {
 				std::cerr << "Error: Invalid arugment!" << std::endl;
 				PrintUsage();
@@ -1,4 +1,5 @@
 #include "FnuMomCoord.hpp"
+#include "FnuMomProfile.hpp"
 
 #include<stdio.h>
 #include<stdlib.h>
@@ -8,6 +9,7 @@
 #include<math.h>
 #include<time.h>
 #include<vector>
+#include<sstream>
 #include<TCanvas.h>
 #include<TGraph.h>
 #include<TRandom.h>
@@ -18,6 +20,7 @@
 #include<TFile.h>
 #include<TNtuple.h>
 #include<TGraphErrors.h>
+#include<TROOT.h>
 #include<TText.h>
 #include<TString.h>
 #include<TEnv.h>
@@ -40,6 +43,22 @@
 #include <EdbEDA.h>
 
 
+// Da1..Da4 of the kMinuit fit, z_eff and X0 are fixed parameters so that the same TF1 is used for every track.
+// par: [0] p (FnuMomDaMom) or 1/p (FnuMomDaInv), [1] sigma, [2] z_eff, [3] X0 (micron)
+static double FnuMomDaMom(double *x, double *par){
+    double t = par[2] * x[0] / par[3];
+    double theta = 13.6e-3 * par[2] * x[0];
+    double log_term = 1 + 0.038 * TMath::Log(t);
+    return sqrt(2. / 3.0 * theta * theta * t * log_term * log_term / (par[0] * par[0]) + par[1] * par[1]);
+}
+
+static double FnuMomDaInv(double *x, double *par){
+    double t = par[2] * x[0] / par[3];
+    double theta = 13.6e-3 * par[2] * x[0];
+    double log_term = 1 + 0.038 * TMath::Log(t);
+    return sqrt(2. / 3.0 * theta * theta * t * log_term * log_term * par[0] * par[0] + par[1] * par[1]);
+}
+
 // FnuMomCoord::FnuMomCoord() : nseg(95), icellMax(30), ini_mom(50), smearing(0.4), X0(4.571), zW(1.1), z(1450), type("AB"), cal_s("Origin_log_modify")
 // {
 //     std::cout << "success" << std::endl;
@@ -57,12 +76,27 @@ FnuMomCoord::FnuMomCoord(){
     z = 1450.0;
     type = "AB";
     cal_s = "Origin_log_modify";
+    fit_engine = kAnalytic;
+    newton_refine = true;
+    rand_seed = 4357;
+    simd_kernel = FnuMomKernelSelect(kKernelAuto);
+    simd_verify = false;
+    SetFitCells({1, 2, 4, 8, 16, 32});
+    fitted_cells_only = false;
+    fit_mom = new TF1("FnuMomDaMom", FnuMomDaMom, 0, 100, 4);
+    fit_inv = new TF1("FnuMomDaInv", FnuMomDaInv, 0, 100, 4);
+    gROOT->GetListOfFunctions()->Remove(fit_mom);
+    gROOT->GetListOfFunctions()->Remove(fit_inv);
+    fit_graph = new TGraphErrors(40);
     nt = new TNtuple("nt", "", "Ptrue:Prec_Coord:sigma_error_Coord:Prec_inv_Coord:sigma_error_inv_Coord:Prec_inv_Coord_error:Prec_Lat:sigma_error_Lat:Prec_inv_Lat:sigma_error_inv_Lat:nicell:itype:trid:angle_diff_max:slope");
 
     std::cout << "success" << std::endl;
 }
 
 FnuMomCoord::~FnuMomCoord(){
+    delete fit_mom;
+    delete fit_inv;
+    delete fit_graph;
     std::cout << "success" << std::endl;
 }
 
@@ -76,6 +110,14 @@ void FnuMomCoord::ShowPar(){
     printf("z = %.1f\n", z);
     printf("type = %s\n", type);
     printf("cal_s = %s\n", cal_s);
+    printf("fit_engine = %s\n", fit_engine == kAnalytic ? "analytic" : "minuit");
+    printf("newton_refine = %d\n", newton_refine);
+    printf("rand_seed = %llu\n", rand_seed);
+    printf("simd = %s%s\n", FnuMomKernelName(simd_kernel), simd_verify ? " (verify)" : "");
+    printf("cells =");
+    for(int icell = 1; icell <= 40; icell++) if(fit_cell[icell]) printf(" %d", icell);
+    printf("\n");
+    printf("cell_mode = %s\n", fitted_cells_only ? "fitted" : "all");
     printf("\n");
     
 }
@@ -134,30 +176,76 @@ void FnuMomCoord::ReadParFile(TString file_name){
     zW = env.GetValue("zW", 1.);
     z = env.GetValue("z", 1.);
 
+    TString engine = env.GetValue("fit_engine", "analytic");
+    fit_engine = engine == "minuit" ? kMinuit : kAnalytic;
+    newton_refine = env.GetValue("newton_refine", 1) != 0;
+    rand_seed = env.GetValue("rand_seed", 4357);
+    simd_kernel = FnuMomKernelSelect(FnuMomKernelFromName(env.GetValue("simd", "auto")));
+    simd_verify = env.GetValue("simd_verify", 0) != 0;
+
+    std::vector<int> cells;
+    std::istringstream cells_stream(env.GetValue("cells", "1 2 4 8 16 32"));
+    int icell;
+    while(cells_stream >> icell) cells.push_back(icell);
+    SetFitCells(cells);
+    TString cell_mode = env.GetValue("cell_mode", "all");
+    fitted_cells_only = cell_mode == "fitted";
+
 }
 
-std::pair<double, double> FnuMomCoord::CalcTrackAngle(EdbTrackP* t, int index) {
-	TGraph grx;
-	TGraph gry;
+void FnuMomCoord::SetFitCells(const std::vector<int> &cells){
+    for(int icell = 0; icell <= 40; icell++) fit_cell[icell] = false;
+    for(int icell : cells){
+        if(icell < 1 || icell > 40){
+            std::cerr << "cells: " << icell << " is out of range (1-40), ignored" << std::endl;
+            continue;
+        }
+        fit_cell[icell] = true;
+    }
+}
 
-	for(int i = index-1; i <= index+1; i++){
-		EdbSegP* s = t->GetSegment(i);
+void FnuMomTrackData::Set(EdbTrackP *t){
+    Clear();
+    id = t->ID();
+    p = t->P();
+    npl = t->Npl();
+    int nseg_track = t->N();
+    for(int i = 0; i < nseg_track; i++){
+        EdbSegP *s = t->GetSegment(i);
+        AddSegment(s->X(), s->Y(), s->Z(), s->TX(), s->TY(), s->Plate(), s->ID(), s->MCEvt(), s->ScanID().GetPlate());
+    }
+}
 
-		grx.SetPoint(i-index+1, s->Z(), s->X());
-		gry.SetPoint(i-index+1, s->Z(), s->Y());
+// slopes dx/dz, dy/dz of the least-squares line through 3 points.
+// The sums are taken around the mean in double, the raw sums of z*z and z*x cancel at z ~ 1e5 micron.
+static std::pair<double, double> FnuMomLineSlope3(const double z[3], const double x[3], const double y[3]){
+	double mz = (z[0] + z[1] + z[2]) / 3;
+	double mx = (x[0] + x[1] + x[2]) / 3;
+	double my = (y[0] + y[1] + y[2]) / 3;
+	double szz = 0, szx = 0, szy = 0;
+	for(int i = 0; i < 3; i++){
+		double dz = z[i] - mz;
+		szz += dz * dz;
+		szx += dz * (x[i] - mx);
+		szy += dz * (y[i] - my);
 	}
+	return std::make_pair(szx / szz, szy / szz);
+}
 
-	grx.Fit("pol1", "Q");
-	gry.Fit("pol1", "Q");
-
-	std::pair<double, double> txy;
-    txy.first = grx.GetFunction("pol1") -> GetParameter(1);
-	txy.second = gry.GetFunction("pol1") -> GetParameter(1);
+// straight line fit of the 3 segments around index, same as the pol1 fit of TGraph but without ROOT fitter (reentrant)
+std::pair<double, double> FnuMomCoord::CalcTrackAngle(EdbTrackP* t, int index) const {
+	double x[3], y[3], z[3];
+	for(int i = 0; i < 3; i++){
+		EdbSegP* s = t->GetSegment(index-1+i);
+		x[i] = s->X();
+		y[i] = s->Y();
+		z[i] = s->Z();
+	}
 
-    return txy;
+	return FnuMomLineSlope3(z, x, y);
 }
 
-double FnuMomCoord::CalcTrackAngleDiff(EdbTrackP* t, int index){
+double FnuMomCoord::CalcTrackAngleDiff(EdbTrackP* t, int index) const {
 	std::pair<double, double> prv_theta = CalcTrackAngle(t, index-2);
 	std::pair<double, double> nxt_theta = CalcTrackAngle(t, index+1);
 
@@ -170,15 +258,68 @@ double FnuMomCoord::CalcTrackAngleDiff(EdbTrackP* t, int index){
 	return theta * 1000;
 }
 
-double FnuMomCoord::CalcTrackAngleDiffMax(EdbTrackP* t){
-	double max_angle_diff = -1;
+double FnuMomCoord::CalcTrackAngleDiffMax(EdbTrackP* t) const {
+	return ScanTrackAngleDiff(t).angle_diff_max;
+}
 
-	for (int i = 3; i < t->N()-2; i++) {
-		double angle_diff = CalcTrackAngleDiff(t, i);
-		if (angle_diff > max_angle_diff) max_angle_diff = angle_diff;
+// Same as CalcTrackAngleDiff for i = 3 ... N-3, but the angle of each 3-segment window is computed only once.
+// The last 3 segments and the angles of the last 4 windows are kept in rings, the angle difference at segment i
+// is between the windows centered at i-2 and i+1. Each window is fitted with FnuMomLineSlope3 as in CalcTrackAngle
+// (not updated by subtraction, which would lose the precision at z ~ 1e5 micron), so the result is the same.
+FnuMomKink FnuMomCoord::ScanTrackAngleDiff(EdbTrackP* t, std::vector<std::pair<int, double> > *profile) const {
+	FnuMomTrackData data;
+	data.Set(t);
+	return ScanTrackAngleDiff(data, profile);
+}
+
+FnuMomKink FnuMomCoord::ScanTrackAngleDiff(const FnuMomTrackData &t, std::vector<std::pair<int, double> > *profile) const {
+	FnuMomScopedTimer timer(kTimeKink);
+	FnuMomKink kink;
+	kink.angle_diff_max = -1;
+	kink.plate = -1;
+	kink.index = -1;
+	if(profile) profile->clear();
+
+	double x[3], y[3], z[3];
+	int plate[3];
+	double tx[4], ty[4];
+	int nseg_track = t.N();
+	for(int i = 0; i < nseg_track; i++){
+		x[i%3] = t.x[i];
+		y[i%3] = t.y[i];
+		z[i%3] = t.z[i];
+		plate[i%3] = t.plate[i];
+		if(i < 2) continue;
+
+		// window of the segments i-2, i-1, i, in the order of CalcTrackAngle
+		double wx[3], wy[3], wz[3];
+		for(int j = 0; j < 3; j++){
+			wx[j] = x[(i-2+j)%3];
+			wy[j] = y[(i-2+j)%3];
+			wz[j] = z[(i-2+j)%3];
+		}
+		int center = i-1;
+		std::pair<double, double> txy = FnuMomLineSlope3(wz, wx, wy);
+		tx[center%4] = txy.first;
+		ty[center%4] = txy.second;
+
+		int index = center-1; // segment between the windows centered at index-2 and index+1
+		if(index < 3) continue;
+		double thx1 = tx[(index-2)%4];
+		double thy1 = ty[(index-2)%4];
+		double thx2 = tx[center%4];
+		double thy2 = ty[center%4];
+		double angle_diff = sqrt((thx1-thx2)*(thx1-thx2) + (thy1-thy2)*(thy1-thy2)) * 1000;
+
+		if(profile) profile->push_back(std::make_pair(plate[index%3], angle_diff));
+		if(angle_diff > kink.angle_diff_max){
+			kink.angle_diff_max = angle_diff;
+			kink.plate = plate[index%3];
+			kink.index = index;
+		}
 	}
 
-	return max_angle_diff;
+	return kink;
 }
 
 // double FnuMomCoord::CalcDistance(TVector2 a, TVector2 b, TVector2 p){
@@ -200,7 +341,7 @@ double FnuMomCoord::CalcTrackAngleDiffMax(EdbTrackP* t){
 //     // return dist;
 // }
 
-double FnuMomCoord::CalcDistance(TVector3 a, TVector3 b, TVector3 p){
+double FnuMomCoord::CalcDistance(TVector3 a, TVector3 b, TVector3 p) const {
     TVector3 ab = b - a;
 	// ab.Print();
     TVector3 ap = p - a;
@@ -243,200 +384,195 @@ void FnuMomCoord::SetZArray(char *fname){
 }
 
 int FnuMomCoord::SetTrackArray(EdbTrackP *t, int file_type = 0){
+    return SetTrackArray(t, file_type, ws_);
+}
+
+// seed of the smearing of a track, depends only on rand_seed and the track (not on the order of the measurement)
+ULong64_t FnuMomCoord::TrackSeed(const FnuMomTrackData &t) const {
+    ULong64_t key[3] = {(ULong64_t)t.id, (ULong64_t)t.mcevt[0], (ULong64_t)t.plate[0]};
+    ULong64_t h = rand_seed;
+    for(int i = 0; i < 3; i++){
+        h ^= key[i] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    }
+    // splitmix64 finalizer
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h = h ^ (h >> 31);
+    return h == 0 ? 1 : h; // TRandom3::SetSeed(0) takes a random seed
+}
+
+int FnuMomCoord::SetTrackArray(EdbTrackP *t, int file_type, FnuMomWorkspace &ws) const {
+    ws.data.Set(t);
+    return SetTrackArray(ws.data, file_type, ws);
+}
+
+int FnuMomCoord::SetTrackArray(const FnuMomTrackData &t, int file_type, FnuMomWorkspace &ws) const {
+    FnuMomScopedTimer timer(kTimeArrayFill);
     int first_plate, plate_num, seg_count;
-    double ini_x_pos, fin_x_pos, ini_y_pos, fin_y_pos, ini_z_pos, fin_z_pos, nloss;
+    FnuMomTrackBuffer &track = ws.track;
 
-    first_plate = t->GetSegmentFirst()->Plate();
+    first_plate = t.plate[0];
     // seg_count = t->N();
-    seg_count = t->N() <= nseg ? t->N(): nseg; //check if t->N() is smaller than nseg
+    seg_count = t.N() <= nseg ? t.N(): nseg; //check if t->N() is smaller than nseg
     plate_num = 0;
+    track.Clear();
+    if(file_type==1) ws.rand.SetSeed(TrackSeed(t));
 
     for(int iseg = 0; iseg < seg_count; iseg++){
-        EdbSegP *s = t->GetSegment(iseg);
-        if(plate_num + first_plate == s->Plate())
-        {
-
-            if(file_type==0) {
-                track_array[plate_num][0] = s->X();
-                track_array[plate_num][1] = s->Y();
-                track_array[plate_num][2] = s->Z();
-                ini_x_pos = track_array[plate_num][0]; //it can be not necesary ?
-                ini_y_pos = track_array[plate_num][1];
-                ini_z_pos = track_array[plate_num][2];
-            }
-
-            if(file_type==1) {
-                track_array[plate_num][0] = s->X() + gRandom->Gaus(0, smearing);
-                track_array[plate_num][1] = s->Y() + gRandom->Gaus(0, smearing);
-                track_array[plate_num][2] = s->Z();
-                ini_x_pos = track_array[plate_num][0];
-                ini_y_pos = track_array[plate_num][1];
-                ini_z_pos = track_array[plate_num][2];
-
-            }
-
+        int index = t.plate[iseg] - first_plate;
 
-            // printf("exist [%d][0] = %f\texist [%d][1] = %f\n", plate_num, track_array[plate_num][0], plate_num, track_array[plate_num][1]);
-            // printf("exist plate_num = %d\n", plate_num);
-            // printf("exist plate_a = %d\tplate_b = %d\n", s->Plate(), s->Plate());
+        if(file_type==0) {
+            track.Set(index, t.x[iseg], t.y[iseg], t.z[iseg]);
         }
-        else
-        {
-            nloss = s->Plate() - plate_num - first_plate;
-
-            if(file_type==0){
-                track_array[s->Plate()-first_plate][0] = s->X(); //substitute current segment X information
-                track_array[s->Plate()-first_plate][1] = s->Y(); //substitute current segment Y information
-                track_array[s->Plate()-first_plate][2] = s->Z(); //substitute current segment Z information
-                fin_x_pos = s->X(); // memorize current segment information
-                fin_y_pos = s->Y();
-                fin_z_pos = s->Z();
-            }
-            
-            if(file_type==1) {
-                track_array[s->Plate()-first_plate][0] = s->X() + gRandom->Gaus(0, smearing);
-                track_array[s->Plate()-first_plate][1] = s->Y() + gRandom->Gaus(0, smearing);
-                track_array[s->Plate()-first_plate][2] = s->Z();
-                fin_x_pos = track_array[s->Plate()-first_plate][0];
-                fin_y_pos = track_array[s->Plate()-first_plate][1];
-                fin_z_pos = track_array[s->Plate()-first_plate][2];
-            }
 
-            // printf("exist plate_a = %d\tplate_b = %d\n", s->Plate(), s->Plate());
-            for(int i = 1; i < nloss+1; i++){
-            // missing segments are eqal to 0 as a flag
-                track_array[plate_num][0] = 0.0;
-                track_array[plate_num][1] = 0.0;
-                track_array[plate_num][2] = 0.0;
-                // printf("empty plate_a = %d\tplate_b = %d\n", plate_num + first_plate, plate_num + first_plate);
-            plate_num++;
-            }
-            ini_x_pos = fin_x_pos; // replace standard segment information with current segment information 
-            ini_y_pos = fin_y_pos;
-            ini_z_pos = fin_z_pos;
+        if(file_type==1) {
+            double x = t.x[iseg] + ws.rand.Gaus(0, smearing);
+            double y = t.y[iseg] + ws.rand.Gaus(0, smearing);
+            track.Set(index, x, y, t.z[iseg]);
         }
+
+        // missing plates before this segment are left as missing (present = 0)
+        int nloss = t.plate[iseg] - plate_num - first_plate;
+        if(nloss > 0) plate_num += nloss;
         plate_num++;
     }
+    track.Extend(plate_num);
     if(plate_num<=nseg) return plate_num;
     else return nseg;
 
 }
 
 void FnuMomCoord::CalcPosDiff(EdbTrackP *t, int plate_num){
+    CalcPosDiff(plate_num, ws_);
+}
 
-    double sum_square;
-    int first_plate = t->GetSegmentFirst()->Plate();
-    icell_cut = (plate_num - 1)/2 <= icellMax ? (plate_num - 1)/2 : icellMax;
-    for(int icell = 1; icell < icell_cut + 1; icell++){
-    // for(int icell = 1; icell < icellMax + 1; icell++){
-    // for(int icell = 5; icell < 6; icell++){
-        int allentry = 0;
-        int nentry = 0;
-        if(type=="AB"){
-            for(int i = 0; i < plate_num - icell * 2; i++)// plate_num is last plate - first plate, which have hits of a and b
-            { 
-                int i0 = i;
-                int i1 = i + icell;
-                int i2 = i + icell * 2;
-                if (i2 >= plate_num)
-                    continue;
-                if (i2 >= npl)
-                    continue;
-
-                double x0 = track_array[i0][0];
-                double x1 = track_array[i1][0];
-                double x2 = track_array[i2][0];
-
-                if(abs(x0) < 0.00001 || abs(x1) < 0.00001 || abs(x2) < 0.00001) // if each segment is missing, calculation is skipped
-                    continue;
-
-                double z0 = track_array[i0][2];
-                double z1 = track_array[i1][2];
-                double z2 = track_array[i2][2];
-                // double delta_ax = -x2 + 2 * x1 - x0;
-                double delta_ax = x2 - x1 - (x1 - x0)/(z1 - z0) * (z2 - z1);
-                
-                // if(abs(delta_ax) < 0.00001) continue;
-                delta_array[allentry] = delta_ax;
-
-                // printf("delta_array[%d] = %f\n", allentry, delta_ax);
-                // printf("deltaArray[%d][%d] = %f\tdeltaArray[%d][%d] = %f\n", itrk, nentry, delta_ax, itrk, nentry, deltaArray[itrk][nentry]);
-                allentry++;
-            }
-            for (int i = 0; i < plate_num - icell * 2; i++)
-            {
-                int i0 = i;
-                int i1 = i + icell;
-                int i2 = i + icell * 2;
-                if (i2 >= plate_num)
-                    continue;
-                if (i2 >= npl)
-                    continue;
-
-                double x0 = track_array[i0][1];
-                double x1 = track_array[i1][1];
-                double x2 = track_array[i2][1];
-
-                if(abs(x0) < 0.00001 || abs(x1) < 0.00001 || abs(x2) < 0.00001) // if each segment is missing, calculation is skipped
-                    continue;
-
-                double z0 = track_array[i0][2];
-                double z1 = track_array[i1][2];
-                double z2 = track_array[i2][2];
-                // double delta_ax = -x2 + 2 * x1 - x0;
-                double delta_ax = x2 - x1 - (x1 - x0)/(z1 - z0) * (z2 - z1);
-                // if(abs(delta_ax) < 0.00001) continue;
-                delta_array[allentry] = delta_ax;
-                // printf("delta_array[%d] = %f\n", allentry, delta_ax);
-                allentry++;
+void FnuMomCoord::CalcPosDiff(int plate_num, FnuMomWorkspace &ws) const {
+    ws.icell_cut = (plate_num - 1)/2 <= icellMax ? (plate_num - 1)/2 : icellMax;
+    for(int icell = 1; icell < ws.icell_cut + 1; icell++){
+        CalcPosDiffCell(plate_num, icell, ws);
+    }
+}
+
+// delta of the triplets (i, i+icell, i+2*icell) where all the 3 plates have a segment, see FnuMomKernel.hpp
+void FnuMomCoord::CalcPosDiffCell(int plate_num, int icell, FnuMomWorkspace &ws) const {
+    const double *x = ws.track.x.data();
+    const double *y = ws.track.y.data();
+    const double *z = ws.track.z.data();
+    const uint8_t *present = ws.track.present.data();
+    int nplate = plate_num <= npl ? plate_num : npl; // i2 < plate_num and i2 < npl
+
+    int ntriplet = nplate - icell * 2;
+    int allentry = 0;
+    double sum_square = 0;
+    if(type=="AB"){
+        FnuMomSecondDiff(simd_kernel, x, y, z, present, ntriplet, icell, sum_square, allentry);
+
+        if(simd_verify && simd_kernel != kKernelScalar){
+            double sum_scalar;
+            int allentry_scalar;
+            FnuMomSecondDiff(kKernelScalar, x, y, z, present, ntriplet, icell, sum_scalar, allentry_scalar);
+            if(allentry != allentry_scalar || fabs(sum_square - sum_scalar) > 1e-12 * fabs(sum_scalar)){
+                fprintf(stderr, "CalcPosDiff: %s kernel differs from scalar, icell = %d, sum = %.17g / %.17g, entry = %d / %d\n",
+                        FnuMomKernelName(simd_kernel), icell, sum_square, sum_scalar, allentry, allentry_scalar);
             }
         }
-        allentryArray[icell-1] = allentry;
+    }
+    ws.allentryArray[icell-1] = allentry;
+    ws.cal_CoordArray[icell-1] = sum_square / allentry;
 
-        sum_square = 0;
-        for(int i = 0; i < allentry; i++){
-            sum_square += delta_array[i] * delta_array[i];
-        }
-        cal_CoordArray[icell-1] = sum_square / allentry;
+    // relvarArray[iraw][icell-1] = sum_square / allentry;
+    // printf("relvarArray[%d][%d] = %f\tsqrt = %f\n", iraw, icell-1, relvarArray[iraw][icell-1], sqrt(sum_square / allentry));
+}
+
+void FnuMomCoord::CalcLatPosDiff(EdbTrackP *t, int plate_num){
+    CalcLatPosDiff(plate_num, ws_);
+}
 
-        // relvarArray[iraw][icell-1] = sum_square / allentry;
-        // printf("relvarArray[%d][%d] = %f\tsqrt = %f\n", iraw, icell-1, relvarArray[iraw][icell-1], sqrt(sum_square / allentry));
+void FnuMomCoord::CalcLatPosDiff(int plate_num, FnuMomWorkspace &ws) const {
+    ws.icell_cut = (plate_num - 1)/2 <= icellMax ? (plate_num - 1)/2 : icellMax;
+    for(int icell = 1; icell < ws.icell_cut+1; icell++){
+        CalcLatPosDiffCell(plate_num, icell, ws);
     }
+}
 
+void FnuMomCoord::CalcLatPosDiffCell(int plate_num, int icell, FnuMomWorkspace &ws) const {
+    const FnuMomTrackBuffer &track = ws.track;
+    double var = 0;
+    int LateralEntry = 0;
+    for(int i = 0; i < plate_num - icell * 2; i++){
+        int i0 = i;
+        int i1 = i+icell*1;
+        int i2 = i+icell*2;
+        if(i2 >= plate_num) continue;
+        if(i2 >= npl) continue;
+
+        if(!(track.present[i0] & track.present[i1] & track.present[i2])) // if each segment is missing, calculation is skipped
+            continue;
+
+        TVector3 a(track.x[i0], track.y[i0], 0.0);
+        TVector3 b(track.x[i1], track.y[i1], 0.0);
+        TVector3 p(track.x[i2], track.y[i2], 0.0);
+        
+        double lateral = CalcDistance(a, b, p);
+        // cout << lateral << endl;
+        var += lateral*lateral;
+        LateralEntry++;
+
+    }
+    ws.cal_LateralArray[icell-1] = var/LateralEntry;
+    ws.LateralEntryArray[icell-1] = LateralEntry;
 }
 
-void FnuMomCoord::CalcLatPosDiff(EdbTrackP *t, int plate_num){
-    double lateralArray[200];
-    icell_cut = (plate_num - 1)/2 <= icellMax ? (plate_num - 1)/2 : icellMax;
-    for(int icell = 1; icell < icell_cut+1; icell++){
-        double var = 0;
-        int LateralEntry = 0;
-        for(int i = 0; i < plate_num - icell * 2; i++){
-            int i0 = i;
-            int i1 = i+icell*1;
-            int i2 = i+icell*2;
-            if(i2 >= plate_num) continue;
-            if(i2 >= npl) continue;
-
-            double x0 = track_array[i0][0];
-            double x1 = track_array[i1][0];
-            double x2 = track_array[i2][0];
-
-            if(abs(x0) < 0.00001 || abs(x1) < 0.00001 || abs(x2) < 0.00001) // if each segment is missing, calculation is skipped
-                continue;
-
-            TVector3 a(track_array[i0][0], track_array[i0][1], 0.0);
-            TVector3 b(track_array[i1][0], track_array[i1][1], 0.0);
-            TVector3 p(track_array[i2][0], track_array[i2][1], 0.0);
-            
-            lateralArray[i] = CalcDistance(a, b, p);
-            // cout << lateralArray[i] << endl;
-            var += lateralArray[i]*lateralArray[i];
-            LateralEntry++;
+// Coord and Lateral RMS of one cell length from one pass over the triplets (FnuMomCellDiff),
+// same values as CalcPosDiffCell + CalcLatPosDiffCell except for the order of the additions.
+void FnuMomCoord::CalcCellDiffCell(int plate_num, int icell, FnuMomWorkspace &ws) const {
+    const double *x = ws.track.x.data();
+    const double *y = ws.track.y.data();
+    const double *z = ws.track.z.data();
+    const uint8_t *present = ws.track.present.data();
+    int nplate = plate_num <= npl ? plate_num : npl; // i2 < plate_num and i2 < npl
+
+    int ntriplet = nplate - icell * 2;
+    int allentry, LateralEntry;
+    double sum_square, var;
+    FnuMomCellDiff(simd_kernel, x, y, z, present, ntriplet, icell, sum_square, allentry, var, LateralEntry);
+
+    if(simd_verify && simd_kernel != kKernelScalar){
+        double sum_scalar, var_scalar;
+        int allentry_scalar, LateralEntry_scalar;
+        FnuMomCellDiff(kKernelScalar, x, y, z, present, ntriplet, icell, sum_scalar, allentry_scalar, var_scalar, LateralEntry_scalar);
+        if(allentry != allentry_scalar || fabs(sum_square - sum_scalar) > 1e-12 * fabs(sum_scalar)
+           || LateralEntry != LateralEntry_scalar || fabs(var - var_scalar) > 1e-12 * fabs(var_scalar)){
+            fprintf(stderr, "CalcCellRMS: %s kernel differs from scalar, icell = %d, sum = %.17g / %.17g, lateral = %.17g / %.17g\n",
+                    FnuMomKernelName(simd_kernel), icell, sum_square, sum_scalar, var, var_scalar);
+        }
+    }
+
+    if(type != "AB"){ // as CalcPosDiffCell, Coord is computed only for AB
+        sum_square = 0;
+        allentry = 0;
+    }
+    ws.allentryArray[icell-1] = allentry;
+    ws.cal_CoordArray[icell-1] = sum_square / allentry;
+    ws.cal_LateralArray[icell-1] = var/LateralEntry;
+    ws.LateralEntryArray[icell-1] = LateralEntry;
+}
 
+// Coord and Lateral RMS of the cell lengths used in CalcMomCoord.
+// cell_mode all: every cell length up to icell_cut.
+// cell_mode fitted: only the cell lengths in cells, the others are left 0 and are not used.
+void FnuMomCoord::CalcCellRMS(int plate_num, FnuMomWorkspace &ws) const {
+    FnuMomScopedTimer timer(kTimeDiff);
+    ws.icell_cut = (plate_num - 1)/2 <= icellMax ? (plate_num - 1)/2 : icellMax;
+    for(int icell = 1; icell < ws.icell_cut + 1; icell++){
+        if(fitted_cells_only && !IsFitCell(icell)){
+            ws.cal_CoordArray[icell-1] = 0;
+            ws.allentryArray[icell-1] = 0;
+            ws.cal_LateralArray[icell-1] = 0;
+            ws.LateralEntryArray[icell-1] = 0;
+            continue;
         }
-        cal_LateralArray[icell-1] = var/LateralEntry;
-        LateralEntryArray[icell-1] = LateralEntry;
+        CalcCellDiffCell(plate_num, icell, ws);
     }
 }
 
@@ -474,156 +610,313 @@ void FnuMomCoord::CalcLatPosDiff(EdbTrackP *t, int plate_num){
 //     }
 // }
 
+// multiple scattering part of Da1..Da4 for p = 1 GeV, i.e. rms^2 = term/p^2 + sigma^2
+double FnuMomCoord::CalcScatteringTerm(double x, double z_eff) const {
+    double t = z_eff * x / (X0 * 1000.0);
+    double theta = 13.6e-3 * z_eff * x;
+    double log_term = 1 + 0.038 * TMath::Log(t);
+    return 2. / 3.0 * theta * theta * t * log_term * log_term;
+}
+
+// Fit of rms(x) = sqrt(term(x)*k + s) in [0, icell] without Minuit.
+// rms^2 is linear in k = 1/p^2 and s = sigma^2, so the weighted least squares is solved directly,
+// then (optionally) one Newton step is taken on the chi2 of rms itself, which is what TGraphErrors::Fit minimizes.
+// The same solution gives both the momentum (Da1, Da3) and the inverse momentum (Da2, Da4) parameters.
+void FnuMomCoord::FitAnalytic(const double *gx, const double *gy, const double *gey, int npoint, int icell, double z_eff, double first_mom, float &Prec, float &sigma_error, float &inverse, float &inverse_error) const {
+    const int npoint_max = 40;
+    double f[npoint_max], y[npoint_max], ey[npoint_max];
+    int n = 0;
+    for(int i = 0; i < npoint && n < npoint_max; i++){
+        if(gx[i] > icell || gy[i] <= 0 || gey[i] <= 0) continue;
+        f[n] = CalcScatteringTerm(gx[i], z_eff);
+        y[n] = gy[i];
+        ey[n] = gey[i];
+        n++;
+    }
+
+    double s0 = 6.0 * pos_reso * pos_reso; // (sqrt(6)*pos_reso)^2, initial value of the Minuit fit
+    if(n == 0){ // nothing to fit, Minuit keeps the initial parameters
+        Prec = first_mom;
+        sigma_error = sqrt(s0);
+        inverse = 1.0 / first_mom;
+        inverse_error = 0.0;
+        return;
+    }
+
+    // linear fit of rms^2, error of rms^2 is 2*rms*error
+    double sw = 0, sf = 0, sff = 0, sy = 0, sfy = 0;
+    for(int i = 0; i < n; i++){
+        double w = 1.0 / (4.0 * y[i] * y[i] * ey[i] * ey[i]);
+        sw += w;
+        sf += w * f[i];
+        sff += w * f[i] * f[i];
+        sy += w * y[i] * y[i];
+        sfy += w * f[i] * y[i] * y[i];
+    }
+    double k, s;
+    double det = sff * sw - sf * sf;
+    bool fix_s = n < 2 || det <= 1e-12 * sff * sw;
+    if(fix_s){ // one point cannot constrain both parameters
+        s = s0;
+        k = (sfy - s * sf) / sff;
+    } else {
+        k = (sfy * sw - sf * sy) / det;
+        s = (sff * sy - sf * sfy) / det;
+    }
+    // both parameters enter the model squared
+    if(k < 0){
+        k = 0;
+        if(!fix_s) s = sy / sw;
+    }
+    if(s < 0){
+        s = 0;
+        k = sfy / sff;
+    }
+
+    // Newton step on chi2 = sum((rms - m)/error)^2, m = sqrt(term*k + s)
+    // a parameter sitting on its bound (or fixed) is kept and only the other one is moved
+    if(newton_refine){
+        double gk = 0, gs = 0, hkk = 0, hks = 0, hss = 0;
+        for(int i = 0; i < n; i++){
+            double m = sqrt(f[i] * k + s);
+            if(m <= 0) continue;
+            double w = 1.0 / (ey[i] * ey[i]);
+            double r = y[i] - m;
+            double dk = f[i] / (2.0 * m);
+            double ds = 1.0 / (2.0 * m);
+            double c = r / (4.0 * m * m * m); // -r * second derivative of m
+            gk += w * r * dk;
+            gs += w * r * ds;
+            hkk += w * (dk * dk + c * f[i] * f[i]);
+            hks += w * (dk * ds + c * f[i]);
+            hss += w * (ds * ds + c);
+        }
+        double det_h = hkk * hss - hks * hks;
+        double k_new = -1, s_new = -1;
+        if(!fix_s && hkk > 0 && det_h > 0){
+            k_new = k + (hss * gk - hks * gs) / det_h;
+            s_new = s + (hkk * gs - hks * gk) / det_h;
+        }
+        if(k_new >= 0 && s_new >= 0){
+            k = k_new;
+            s = s_new;
+        } else if(hkk > 0 && (fix_s || s == 0 || s_new < 0) && k + gk / hkk >= 0){
+            k = k + gk / hkk;
+        } else if(!fix_s && hss > 0 && s + gs / hss >= 0){
+            s = s + gs / hss;
+        }
+    }
+
+    // parameter error from the curvature of the chi2, as Minuit does
+    double hkk = 0, hks = 0, hss = 0;
+    for(int i = 0; i < n; i++){
+        double m = sqrt(f[i] * k + s);
+        if(m <= 0) continue;
+        double w = 1.0 / (ey[i] * ey[i]);
+        hkk += w * f[i] * f[i] / (4.0 * m * m);
+        hks += w * f[i] / (4.0 * m * m);
+        hss += w / (4.0 * m * m);
+    }
+    double det_h = hkk * hss - hks * hks;
+    double k_error = 0.0;
+    if(!fix_s && det_h > 0) k_error = sqrt(hss / det_h);
+    else if(hkk > 0) k_error = sqrt(1.0 / hkk);
+
+    inverse = sqrt(k);
+    inverse_error = k > 0 ? k_error / (2.0 * inverse) : sqrt(k_error);
+    Prec = k > 0 ? 1.0 / inverse : 7000;
+    sigma_error = sqrt(s);
+}
+
+// Minuit fit of Da3/Da4 (z_eff = z) or Da1/Da2 (z_eff = z*sqrt(1+slope^2)) in [0, icell].
+// The points are copied into fit_graph, the unused points are parked at x = -1 (outside of every fit range)
+// so that the graph is never resized. "N" keeps the fitted function out of the graph.
+void FnuMomCoord::FitMinuit(const FnuMomGraph &gr, int icell, double z_eff, double first_mom, float &Prec, float &sigma_error, float &inverse, float &inverse_error, float &sigma_error_inv) const {
+    for(int i = 0; i < fit_graph->GetN(); i++){
+        if(i < gr.n){
+            fit_graph->SetPoint(i, gr.x[i], gr.y[i]);
+            fit_graph->SetPointError(i, 0, gr.ey[i]);
+        } else {
+            fit_graph->SetPoint(i, -1, 0);
+            fit_graph->SetPointError(i, 0, 0);
+        }
+    }
+
+    //Get momentum
+    fit_mom->SetParameters(first_mom, sqrt(6)*pos_reso);
+    fit_mom->FixParameter(2, z_eff);
+    fit_mom->FixParameter(3, X0*1000.0);
+    fit_graph->Fit(fit_mom, "QN", "", 0, icell);
+    Prec = fit_mom->GetParameter(0);
+    sigma_error = fit_mom->GetParameter(1);
+    Prec = Prec < 0 ? -Prec : Prec;
+    sigma_error = sigma_error < 0 ? -sigma_error : sigma_error;
+
+    //Get inverse monentum
+    fit_inv->SetParameters(1.0/first_mom, sqrt(6)*pos_reso);
+    fit_inv->FixParameter(2, z_eff);
+    fit_inv->FixParameter(3, X0*1000.0);
+    fit_graph->Fit(fit_inv, "QN", "", 0, icell);
+    inverse = fit_inv->GetParameter(0);
+    inverse_error = fit_inv->GetParError(0);
+    sigma_error_inv = fit_inv->GetParameter(1);
+    inverse = inverse < 0 ? -inverse : inverse;
+    sigma_error_inv = sigma_error_inv < 0 ? -sigma_error_inv : sigma_error_inv;
+}
+
 // void FnuMomCoord::CalcDataMomCoord(EdbTrackP *t, TCanvas *c1, TNtuple *nt, TString file_name, int file_type){
 float FnuMomCoord::CalcMomCoord(EdbTrackP *t, int file_type){
-    TGraphErrors *grCoord = new TGraphErrors();
-    TGraphErrors *grLat = new TGraphErrors();
+    if(file_type == 1) SetIniMom(t->P());
+    float Pmeas = CalcMomCoord(t, file_type, ws_);
+    FillNtuple(ws_);
+    return Pmeas;
+}
+
+float FnuMomCoord::CalcMomCoord(EdbTrackP *t, int file_type, FnuMomWorkspace &ws) const {
+    ws.data.Set(t);
+    return CalcMomCoord(ws.data, file_type, ws);
+}
+
+float FnuMomCoord::CalcMomCoord(const FnuMomTrackData &t, int file_type, FnuMomWorkspace &ws) const {
+    FnuMomGraph &grCoord = ws.grCoord;
+    FnuMomGraph &grLat = ws.grLat;
     float rms_RCM, rms_Coord, rms_Lat;
     float rmserror_RCM, rmserror_Coord, rmserror_Lat;
     float Ptrue, Prec_RCM, error_RCM, inverse_RCM, error_RCM_in, Prec_Coord, error_Coord, inverse_Coord, error_Coord_in, inverse_Coord_error;
-    float Prec_Lat, error_Lat, inverse_Lat, error_Lat_in;
+    float Prec_Lat, error_Lat, inverse_Lat, error_Lat_in, inverse_Lat_error;
     float tanx, tany, slope;
     int ith, itype;
+    double first_mom = file_type == 1 ? t.p : ini_mom; // initial value of the fit
 
-    tanx = t->GetSegmentFirst()->TX();
-    tany = t->GetSegmentFirst()->TY();
+    tanx = t.tx[0];
+    tany = t.ty[0];
     slope = sqrt(tanx*tanx + tany*tany);
 
-	double max_angle_diff = CalcTrackAngleDiffMax(t);
+	double max_angle_diff = ScanTrackAngleDiff(t).angle_diff_max;
+    FnuMomScopedTimer timer(kTimeFit); // after the kink scan, which has its own timer
+
+    grCoord.Clear();
+    grLat.Clear();
 
-    for(int i = 0; i < icell_cut; i++){
+    for(int i = 0; i < ws.icell_cut; i++){
         itype = 0;
         float j = 1.0;
 
 // こいつは直そう
 // calculate Coord error bar
-        if(cal_CoordArray[i] <= 0.0) 
+        if(ws.cal_CoordArray[i] <= 0.0) 
             continue;
-        rms_Coord = sqrt(cal_CoordArray[i]);
-        rmserror_Coord = rms_Coord / sqrt(allentryArray[i]);
+        rms_Coord = sqrt(ws.cal_CoordArray[i]);
+        rmserror_Coord = rms_Coord / sqrt(ws.allentryArray[i]);
         if(cal_s=="Origin_log_modify") {
             // rmserror_Coord = rms_Coord / sqrt(nentryArray[i]);
-            rmserror_Coord = rms_Coord / sqrt((t->Npl()-1.0) / (1.0*(i+1.0)));
+            rmserror_Coord = rms_Coord / sqrt((t.npl-1.0) / (1.0*(i+1.0)));
             // if(type=="AB") {
             //     rmserror_Coord = rms_Coord / sqrt((nseg-1.0) / (2.0*(i+1.0)));
             // }
         }
-        if(i==0||i==1||i==3||i==7||i==15||i==31){
-            ith = grCoord->GetN();
-            grCoord->SetPoint(ith, i+1, rms_Coord);
-            grCoord->SetPointError(ith, 0, rmserror_Coord);
+        if(IsFitCell(i+1)){
+            grCoord.AddPoint(i+1, rms_Coord, rmserror_Coord);
             // nts->Fill(rms_Coord, rms_RCM, rmserror_Coord, rmserror_RCM, trk_num + icount*ntrk, i+1, itype);
             //nts("sRMS_Coord:sRMS_RCM:sRMSerror_Coord:sRMSerror_RCM:trk_num:nicell:itype")
         }
 
 // calculate Lateral error bar
-        if(cal_LateralArray[i] <= 0.0) 
+        if(ws.cal_LateralArray[i] <= 0.0) 
             continue;
-        rms_Lat = sqrt(cal_LateralArray[i]);
-        rmserror_Lat = rms_Lat / sqrt(LateralEntryArray[i]);
+        rms_Lat = sqrt(ws.cal_LateralArray[i]);
+        rmserror_Lat = rms_Lat / sqrt(ws.LateralEntryArray[i]);
         if(cal_s=="Origin_log_modify") {
             // rmserror_Coord = rms_Coord / sqrt(nentryArray[i]);
-            rmserror_Lat = rms_Lat / sqrt((t->Npl()-1.0) / (2.0*(i+1.0)));
+            rmserror_Lat = rms_Lat / sqrt((t.npl-1.0) / (2.0*(i+1.0)));
             // if(type=="AB") {
             //     rmserror_Coord = rms_Coord / sqrt((nseg-1.0) / (2.0*(i+1.0)));
             // }
         }
-        if(i==0||i==1||i==3||i==7||i==15||i==31){
-            ith = grLat->GetN();
-            grLat->SetPoint(ith, i+1, rms_Lat);
-            grLat->SetPointError(ith, 0, rmserror_Lat);
+        if(IsFitCell(i+1)){
+            grLat.AddPoint(i+1, rms_Lat, rmserror_Lat);
             // nts->Fill(rms_Coord, rms_RCM, rmserror_Coord, rmserror_RCM, trk_num + icount*ntrk, i+1, itype);
             //nts("sRMS_Coord:sRMS_RCM:sRMSerror_Coord:sRMSerror_RCM:trk_num:nicell:itype")
         }
 
     }
 
-// log and modify radiation length
-	TF1 *Da4 = new TF1("Da4", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))**2*[0]**2+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100);
-	TF1 *Da3 = new TF1("Da3", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))**2/([0]**2)+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100); 
-	// TF1 *Da2 = new TF1("Da2", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))*[0]**2+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100);
-	// TF1 *Da1 = new TF1("Da1", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))/([0]**2)+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100); 
-	// TF1 *Da2 = new TF1("Da2", Form("sqrt(4./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))*[0]**2+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100);
-	// TF1 *Da1 = new TF1("Da1", Form("sqrt(4./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))/([0]**2)+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100); 
-	// TF1 *Da2 = new TF1("Da2", Form("sqrt(4./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))*[0]**2+[1]**2)", z*sqrt(1.0 + slope*slope), z*sqrt(1.0 + slope*slope), X0*1000.0, z*sqrt(1.0 + slope*slope), X0*1000.0),0,100);
-	// TF1 *Da1 = new TF1("Da1", Form("sqrt(4./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))/([0]**2)+[1]**2)", z*sqrt(1.0 + slope*slope), z*sqrt(1.0 + slope*slope), X0*1000.0, z*sqrt(1.0 + slope*slope), X0*1000.0),0,100); 
-	TF1 *Da2 = new TF1("Da2", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))**2*[0]**2+[1]**2)", z*sqrt(1.0 + slope*slope), z*sqrt(1.0 + slope*slope), X0*1000.0, z*sqrt(1.0 + slope*slope), X0*1000.0),0,100);
-	TF1 *Da1 = new TF1("Da1", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))**2/([0]**2)+[1]**2)", z*sqrt(1.0 + slope*slope), z*sqrt(1.0 + slope*slope), X0*1000.0, z*sqrt(1.0 + slope*slope), X0*1000.0),0,100); 
-    if(file_type == 1) SetIniMom(t->P());
-    for(int icell = 1; icell < icell_cut + 1; icell++){
-        if(icell==1||icell==2||icell==4||icell==8||icell==16||icell==32){
+    ws.trid = t.id;
+    ws.angle_diff_max = max_angle_diff;
+    ws.slope = slope;
+    ws.ncell = 0;
+    inverse_Coord = -1.0/999; // returned if no cell length is fitted
+    for(int icell = 1; icell < ws.icell_cut + 1; icell++){
+        if(IsFitCell(icell)){
             itype = 0;
 
-        //Get Coord momentum
-            Da3->SetParameters(ini_mom, sqrt(6)*pos_reso);
-            grCoord->Fit(Da3, "Q", "", 0, icell);
-            Prec_Coord = Da3->GetParameter(0);
-            error_Coord = Da3->GetParameter(1);
-            Ptrue = ini_mom; // zanteitekina P
-            Prec_Coord = Prec_Coord < 0 ? -Prec_Coord : Prec_Coord;
-            error_Coord = error_Coord < 0 ? -error_Coord : error_Coord;
+            if(fit_engine == kAnalytic){
+            //Get Coord momentum and inverse momentum
+                FitAnalytic(grCoord.x, grCoord.y, grCoord.ey, grCoord.n, icell, z, first_mom, Prec_Coord, error_Coord, inverse_Coord, inverse_Coord_error);
+                error_Coord_in = error_Coord;
+            //Get Lateral momentum and inverse momentum
+                FitAnalytic(grLat.x, grLat.y, grLat.ey, grLat.n, icell, z*sqrt(1.0 + slope*slope), first_mom, Prec_Lat, error_Lat, inverse_Lat, inverse_Lat_error);
+                error_Lat_in = error_Lat;
+            } else {
+            // log and modify radiation length
+                FitMinuit(grCoord, icell, z, first_mom, Prec_Coord, error_Coord, inverse_Coord, inverse_Coord_error, error_Coord_in);
+                FitMinuit(grLat, icell, z*sqrt(1.0 + slope*slope), first_mom, Prec_Lat, error_Lat, inverse_Lat, inverse_Lat_error, error_Lat_in);
+            }
+            Ptrue = first_mom; // zanteitekina P
             if(Prec_Coord>7000) Prec_Coord=7000;
-
-        //Get Coord inverse monentum
-            Da4->SetParameters(1.0/ini_mom, sqrt(6)*pos_reso);
-            grCoord->Fit(Da4, "Q", "", 0, icell);
-            gStyle->SetOptFit(0000);
-            inverse_Coord = Da4->GetParameter(0);
-            inverse_Coord_error = Da4->GetParError(0);
-            error_Coord_in = Da4->GetParameter(1);
-            inverse_Coord = inverse_Coord < 0 ? -inverse_Coord : inverse_Coord;
-            error_Coord_in = error_Coord_in < 0 ? -error_Coord_in : error_Coord_in;
             if(inverse_Coord<0.00014286) inverse_Coord = 0.00014286;
-
-        //Get Lateral momentum
-            Da1->SetParameters(ini_mom, sqrt(6)*pos_reso);
-            grLat->Fit(Da1, "Q", "", 0, icell);
-            Prec_Lat = Da1->GetParameter(0);
-            error_Lat = Da1->GetParameter(1);
-            Ptrue = ini_mom; // zanteitekina P
-            Prec_Lat = Prec_Lat < 0 ? -Prec_Lat : Prec_Lat;
-            error_Lat = error_Lat < 0 ? -error_Lat : error_Lat;
             if(Prec_Lat>7000) Prec_Lat=7000;
-
-        //Get Lateral inverse monentum
-            Da2->SetParameters(1.0/ini_mom, sqrt(6)*pos_reso);
-            grLat->Fit(Da2, "Q", "", 0, icell);
-            gStyle->SetOptFit(0000);
-            inverse_Lat = Da2->GetParameter(0);
-            // inverse_Lat_error = Da2->GetParError(0);
-            error_Lat_in = Da2->GetParameter(1);
-            inverse_Lat = inverse_Lat < 0 ? -inverse_Lat : inverse_Lat;
-            error_Lat_in = error_Lat_in < 0 ? -error_Lat_in : error_Lat_in;
             if(inverse_Lat<0.00014286) inverse_Lat = 0.00014286;
 
-            if(file_type==0){
-                // nt->Fill(Ptrue, Prec_RCM, error_RCM, inverse_RCM, error_RCM_in, Prec_Coord, error_Coord, inverse_Coord, error_Coord_in, icell, itype);
-                // nt->Fill(ini_mom, -999.0, -999.0, -999.0, -999.0, Prec_Coord, error_Coord, inverse_Coord, error_Coord_in, inverse_Coord_error, icell, itype, t->ID(), max_angle_diff, slope);
-                nt->Fill(ini_mom, Prec_Coord, error_Coord, inverse_Coord, error_Coord_in, inverse_Coord_error, Prec_Lat, error_Lat, inverse_Lat, error_Lat_in, icell, itype, t->ID(), max_angle_diff, slope);
-                // nt->Fill(ini_mom, Prec_RCM, error_RCM, inverse_RCM, error_RCM_in, -999.0, -999.0, -999.0, -999.0, icell, itype, t->ID(), max_angle_diff, slope);
-            }
-            else if(file_type==1){
-                nt->Fill(t->P(), Prec_Coord, error_Coord, inverse_Coord, error_Coord_in, inverse_Coord_error, Prec_Lat, error_Lat, inverse_Lat, error_Lat_in, icell, itype, t->ID(), max_angle_diff, slope);
+            if(file_type==0||file_type==1){
+                FnuMomCell &cell = ws.cell[ws.ncell++];
+                cell.Ptrue = file_type==0 ? ini_mom : t.p;
+                cell.Prec_Coord = Prec_Coord;
+                cell.sigma_error_Coord = error_Coord;
+                cell.Prec_inv_Coord = inverse_Coord;
+                cell.sigma_error_inv_Coord = error_Coord_in;
+                cell.Prec_inv_Coord_error = inverse_Coord_error;
+                cell.Prec_Lat = Prec_Lat;
+                cell.sigma_error_Lat = error_Lat;
+                cell.Prec_inv_Lat = inverse_Lat;
+                cell.sigma_error_inv_Lat = error_Lat_in;
+                cell.nicell = icell;
+                cell.itype = itype;
             }
         }
     }
-    delete grCoord;
-    delete grLat;
-
     return 1.0/inverse_Coord;
 }
 
+void FnuMomCoord::FillNtuple(const FnuMomWorkspace &ws){
+    for(int i = 0; i < ws.ncell; i++){
+        const FnuMomCell &cell = ws.cell[i];
+        // nt->Fill(Ptrue, Prec_RCM, error_RCM, inverse_RCM, error_RCM_in, Prec_Coord, error_Coord, inverse_Coord, error_Coord_in, icell, itype);
+        nt->Fill(cell.Ptrue, cell.Prec_Coord, cell.sigma_error_Coord, cell.Prec_inv_Coord, cell.sigma_error_inv_Coord, cell.Prec_inv_Coord_error, cell.Prec_Lat, cell.sigma_error_Lat, cell.Prec_inv_Lat, cell.sigma_error_inv_Lat, cell.nicell, cell.itype, ws.trid, ws.angle_diff_max, ws.slope);
+    }
+}
+
 float FnuMomCoord::CalcMomentum(EdbTrackP *t, int file_type){
     int plate_num = SetTrackArray(t, file_type);
     // printf("plate_num = %d\tnpl = %d\n", plate_num, t->Npl());
-    CalcPosDiff(t, plate_num);
-    CalcLatPosDiff(t, plate_num);
+    CalcCellRMS(plate_num, ws_);
     // DrawDataMomGraphCoord(t, c1, nt, file_name, plate_num);
     // DrawMomGraphCoord(t, c1, file_name);
     float Pmeas = CalcMomCoord(t, file_type);
     return Pmeas;
 }
 
+float FnuMomCoord::Measure(EdbTrackP *t, FnuMomWorkspace &ws, int file_type) const {
+    ws.data.Set(t);
+    return Measure(ws.data, ws, file_type);
+}
+
+float FnuMomCoord::Measure(const FnuMomTrackData &t, FnuMomWorkspace &ws, int file_type) const {
+    int plate_num = SetTrackArray(t, file_type, ws);
+    CalcCellRMS(plate_num, ws);
+    return CalcMomCoord(t, file_type, ws);
+}
+
 // void FnuMomCoord::DrawDataMomGraphCoord(EdbTrackP *t, TCanvas *c1, TNtuple *nt, TString file_name, int plate_num){
 // void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name, int plate_num){
 void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name){
@@ -641,7 +934,7 @@ void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name
     float rms_RCM, rms_Coord, rms_Lat;
     float rmserror_RCM, rmserror_Coord, rmserror_Lat;
     float Ptrue, Prec_RCM, error_RCM, inverse_RCM, error_RCM_in, Prec_Coord, error_Coord, inverse_Coord, error_Coord_in, inverse_Coord_error;
-    float Prec_Lat, error_Lat, inverse_Lat, error_Lat_in;
+    float Prec_Lat, error_Lat, inverse_Lat, error_Lat_in, inverse_Lat_error;
     float tanx, tany, slope;
     int ith, itype;
 
@@ -687,24 +980,22 @@ void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name
     //     grTY->SetPoint(ith, t->GetSegment(i)->Plate(), t->GetSegment(i)->TY());
     // }
 
-	double max_angle_diff = -1;
-    for(int i = 3; i < t->N()-2; i++){
-        double angle_diff = CalcTrackAngleDiff(t, i);
-        if (angle_diff > max_angle_diff) max_angle_diff = angle_diff;
-        EdbSegP *s = t->GetSegment(i);
-        diff->SetPoint(diff->GetN(), s->Plate(), angle_diff);
-        // printf("i = %d, diff theta = %f\n", s->Plate(), angle_diff);
+    std::vector<std::pair<int, double> > angle_diff_profile;
+	double max_angle_diff = ScanTrackAngleDiff(t, &angle_diff_profile).angle_diff_max;
+    for(size_t i = 0; i < angle_diff_profile.size(); i++){
+        diff->SetPoint(diff->GetN(), angle_diff_profile[i].first, angle_diff_profile[i].second);
+        // printf("i = %d, diff theta = %f\n", angle_diff_profile[i].first, angle_diff_profile[i].second);
     }
 
-    for(int i = 0; i < icell_cut; i++){
+    for(int i = 0; i < ws_.icell_cut; i++){
         itype = 0;
         float j = 1.0;
 
 // calculate Coord error bar
-        if(cal_CoordArray[i] <= 0.0) 
+        if(ws_.cal_CoordArray[i] <= 0.0) 
             continue;
-        rms_Coord = sqrt(cal_CoordArray[i]);
-        rmserror_Coord = rms_Coord / sqrt(allentryArray[i]);
+        rms_Coord = sqrt(ws_.cal_CoordArray[i]);
+        rmserror_Coord = rms_Coord / sqrt(ws_.allentryArray[i]);
         if(cal_s=="Origin_log_modify") {
             // rmserror_Coord = rms_Coord / sqrt(nentryArray[i]);
             rmserror_Coord = rms_Coord / sqrt((t->Npl()-1.0) / (1.0*(i+1.0)));
@@ -712,7 +1003,7 @@ void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name
             //     rmserror_Coord = rms_Coord / sqrt((nseg-1.0) / (2.0*(i+1.0)));
             // }
         }
-        if(i==0||i==1||i==3||i==7||i==15||i==31){
+        if(IsFitCell(i+1)){
             ith = grCoord->GetN();
             grCoord->SetPoint(ith, i+1, rms_Coord);
             grCoord->SetPointError(ith, 0, rmserror_Coord);
@@ -721,10 +1012,10 @@ void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name
         }
 
 // calculate Lateral error bar
-        if(cal_LateralArray[i] <= 0.0) 
+        if(ws_.cal_LateralArray[i] <= 0.0) 
             continue;
-        rms_Lat = sqrt(cal_LateralArray[i]);
-        rmserror_Lat = rms_Lat / sqrt(LateralEntryArray[i]);
+        rms_Lat = sqrt(ws_.cal_LateralArray[i]);
+        rmserror_Lat = rms_Lat / sqrt(ws_.LateralEntryArray[i]);
         if(cal_s=="Origin_log_modify") {
             // rmserror_Coord = rms_Coord / sqrt(nentryArray[i]);
             rmserror_Lat = rms_Lat / sqrt((t->Npl()-1.0) / (2.0*(i+1.0)));
@@ -732,7 +1023,7 @@ void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name
             //     rmserror_Coord = rms_Coord / sqrt((nseg-1.0) / (2.0*(i+1.0)));
             // }
         }
-        if(i==0||i==1||i==3||i==7||i==15||i==31){
+        if(IsFitCell(i+1)){
             ith = grLat->GetN();
             grLat->SetPoint(ith, i+1, rms_Lat);
             grLat->SetPointError(ith, 0, rmserror_Lat);
@@ -742,62 +1033,33 @@ void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name
 
     }
 
-// log and modify radiation length
-	TF1 *Da4 = new TF1("Da4", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))**2*[0]**2+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100);
-	TF1 *Da3 = new TF1("Da3", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))**2/([0]**2)+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100); 
-	// TF1 *Da2 = new TF1("Da2", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))*[0]**2+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100);
-	// TF1 *Da1 = new TF1("Da1", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))/([0]**2)+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100); 
-	// TF1 *Da2 = new TF1("Da2", Form("sqrt(4./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))*[0]**2+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100);
-	// TF1 *Da1 = new TF1("Da1", Form("sqrt(4./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))/([0]**2)+[1]**2)", z, z, X0*1000.0, z, X0*1000.0),0,100); 
-	// TF1 *Da2 = new TF1("Da2", Form("sqrt(4./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))*[0]**2+[1]**2)", z*sqrt(1.0 + slope*slope), z*sqrt(1.0 + slope*slope), X0*1000.0, z*sqrt(1.0 + slope*slope), X0*1000.0),0,100);
-	// TF1 *Da1 = new TF1("Da1", Form("sqrt(4./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))/([0]**2)+[1]**2)", z*sqrt(1.0 + slope*slope), z*sqrt(1.0 + slope*slope), X0*1000.0, z*sqrt(1.0 + slope*slope), X0*1000.0),0,100); 
-	TF1 *Da2 = new TF1("Da2", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))**2*[0]**2+[1]**2)", z*sqrt(1.0 + slope*slope), z*sqrt(1.0 + slope*slope), X0*1000.0, z*sqrt(1.0 + slope*slope), X0*1000.0),0,100);
-	TF1 *Da1 = new TF1("Da1", Form("sqrt(2./3.0*(13.6e-3*%f*x)**2*%f*x/%f*(1+0.038*TMath::Log(x*%f/%f))**2/([0]**2)+[1]**2)", z*sqrt(1.0 + slope*slope), z*sqrt(1.0 + slope*slope), X0*1000.0, z*sqrt(1.0 + slope*slope), X0*1000.0),0,100); 
-    for(int icell = 1; icell < icell_cut + 1; icell++){
-         if(icell==1||icell==2||icell==4||icell==8||icell==16||icell==32){
+    // same fit as CalcMomCoord, with the preallocated fit_mom/fit_inv for kMinuit
+    FnuMomGraph gCoord, gLat;
+    for(int i = 0; i < grCoord->GetN(); i++) gCoord.AddPoint(grCoord->GetX()[i], grCoord->GetY()[i], grCoord->GetEY()[i]);
+    for(int i = 0; i < grLat->GetN(); i++) gLat.AddPoint(grLat->GetX()[i], grLat->GetY()[i], grLat->GetEY()[i]);
+    int icell_fit = 0; // last fitted cell length, its model is drawn on grCoord and grLat
+    for(int icell = 1; icell < ws_.icell_cut + 1; icell++){
+         if(IsFitCell(icell)){
         //if(icell==16||icell==32){
             itype = 0;
-
-        //Get Coord momentum
-            Da3->SetParameters(ini_mom, sqrt(6)*pos_reso);
-            grCoord->Fit(Da3, "Q", "", 0, icell);
-            Prec_Coord = Da3->GetParameter(0);
-            error_Coord = Da3->GetParameter(1);
+            icell_fit = icell;
+
+            if(fit_engine == kAnalytic){
+            //Get Coord momentum and inverse momentum
+                FitAnalytic(gCoord.x, gCoord.y, gCoord.ey, gCoord.n, icell, z, ini_mom, Prec_Coord, error_Coord, inverse_Coord, inverse_Coord_error);
+                error_Coord_in = error_Coord;
+            //Get Lateral momentum and inverse momentum
+                FitAnalytic(gLat.x, gLat.y, gLat.ey, gLat.n, icell, z*sqrt(1.0 + slope*slope), ini_mom, Prec_Lat, error_Lat, inverse_Lat, inverse_Lat_error);
+                error_Lat_in = error_Lat;
+            } else {
+            // log and modify radiation length
+                FitMinuit(gCoord, icell, z, ini_mom, Prec_Coord, error_Coord, inverse_Coord, inverse_Coord_error, error_Coord_in);
+                FitMinuit(gLat, icell, z*sqrt(1.0 + slope*slope), ini_mom, Prec_Lat, error_Lat, inverse_Lat, inverse_Lat_error, error_Lat_in);
+            }
             Ptrue = ini_mom; // zanteitekina P
-            Prec_Coord = Prec_Coord < 0 ? -Prec_Coord : Prec_Coord;
-            error_Coord = error_Coord < 0 ? -error_Coord : error_Coord;
             if(Prec_Coord>7000) Prec_Coord=7000;
-
-        //Get Coord inverse monentum
-            Da4->SetParameters(1.0/ini_mom, sqrt(6)*pos_reso);
-            grCoord->Fit(Da4, "Q", "", 0, icell);
-            gStyle->SetOptFit(0000);
-            inverse_Coord = Da4->GetParameter(0);
-            inverse_Coord_error = Da4->GetParError(0);
-            error_Coord_in = Da4->GetParameter(1);
-            inverse_Coord = inverse_Coord < 0 ? -inverse_Coord : inverse_Coord;
-            error_Coord_in = error_Coord_in < 0 ? -error_Coord_in : error_Coord_in;
             if(inverse_Coord<0.00014286) inverse_Coord = 0.00014286;
-
-        //Get Lateral momentum
-            Da1->SetParameters(ini_mom, sqrt(6)*pos_reso);
-            grLat->Fit(Da1, "Q", "", 0, icell);
-            Prec_Lat = Da1->GetParameter(0);
-            error_Lat = Da1->GetParameter(1);
-            Ptrue = ini_mom; // zanteitekina P
-            Prec_Lat = Prec_Lat < 0 ? -Prec_Lat : Prec_Lat;
-            error_Lat = error_Lat < 0 ? -error_Lat : error_Lat;
             if(Prec_Lat>7000) Prec_Lat=7000;
-
-        //Get Lateral inverse monentum
-            Da2->SetParameters(1.0/ini_mom, sqrt(6)*pos_reso);
-            grLat->Fit(Da2, "Q", "", 0, icell);
-            gStyle->SetOptFit(0000);
-            inverse_Lat = Da2->GetParameter(0);
-            // inverse_Lat_error = Da2->GetParError(0);
-            error_Lat_in = Da2->GetParameter(1);
-            inverse_Lat = inverse_Lat < 0 ? -inverse_Lat : inverse_Lat;
-            error_Lat_in = error_Lat_in < 0 ? -error_Lat_in : error_Lat_in;
             if(inverse_Lat<0.00014286) inverse_Lat = 0.00014286;
 
             // nt->Fill(Ptrue, Prec_RCM, error_RCM, inverse_RCM, error_RCM_in, Prec_Coord, error_Coord, inverse_Coord, error_Coord_in, icell, itype);
@@ -833,6 +1095,11 @@ void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name
     grCoord->GetYaxis()->SetTitle("RMS (#mum)");
     grCoord->GetYaxis()->SetTitleOffset(1.6);
     grCoord->Draw("apl");
+    if(icell_fit > 0){ // fitted Da4 (inverse momentum) in [0, icell_fit], a copy owned by the pad
+        fit_inv->SetParameters(inverse_Coord, error_Coord_in, z, X0*1000.0);
+        fit_inv->SetRange(0, icell_fit);
+        fit_inv->DrawCopy("same");
+    }
 
     c1->cd(8);
     grLat->SetTitle(Form("Lat Prec = %.1f GeV (trid = %d)", 1.0/inverse_Lat, t->ID()));
@@ -840,6 +1107,11 @@ void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name
     grLat->GetYaxis()->SetTitle("RMS (#mum)");
     grLat->GetYaxis()->SetTitleOffset(1.6);
     grLat->Draw("apl");
+    if(icell_fit > 0){ // fitted Da2
+        fit_inv->SetParameters(inverse_Lat, error_Lat_in, z*sqrt(1.0 + slope*slope), X0*1000.0);
+        fit_inv->SetRange(0, icell_fit);
+        fit_inv->DrawCopy("same");
+    }
 
     // // c1->cd(6);
     // c1->cd(3);
@@ -862,7 +1134,7 @@ void FnuMomCoord::DrawMomGraphCoord(EdbTrackP *t, TCanvas *c1, TString file_name
     tx.DrawTextNDC(0.1,0.7,Form("Prec(Lat) = %.1f GeV", 1.0/inverse_Lat));
     tx.DrawTextNDC(0.1,0.6,Form("sigma_error(Coord) = %.3f micron", error_Coord));
     tx.DrawTextNDC(0.1,0.5,Form("sigma_error(Lat) = %.3f micron", error_Lat));
-    tx.DrawTextNDC(0.1,0.4,Form("Cell length max = %d", icell_cut));
+    tx.DrawTextNDC(0.1,0.4,Form("Cell length max = %d", ws_.icell_cut));
     tx.DrawTextNDC(0.1,0.3,Form("npl = %d  nseg = %d", t->Npl(), t->N()));
     tx.DrawTextNDC(0.1,0.2,Form("slope = %.4f", slope));
     tx.DrawTextNDC(0.1,0.1,Form("tan x = %.4f  tan y = %.4f", tanx, tany));
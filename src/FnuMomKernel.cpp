@@ -0,0 +1,396 @@
+#include "FnuMomKernel.hpp"
+
+#include<string.h>
+#include<math.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FNUMOM_X86_KERNEL 1
+#include<immintrin.h>
+#endif
+
+// Same order of the operations as the old CalcPosDiff: all the X triplets, then all the Y triplets.
+static void SecondDiffScalar(const double *x, const double *y, const double *z, const uint8_t *present,
+                             int ntriplet, int icell, double &sum_square, int &nentry){
+    double sum = 0;
+    int n = 0;
+    for(int i = 0; i < ntriplet; i++){
+        int i1 = i + icell;
+        int i2 = i + icell * 2;
+        int valid = present[i] & present[i1] & present[i2];
+        double delta_ax = x[i2] - x[i1] - (x[i1] - x[i])/(z[i1] - z[i]) * (z[i2] - z[i1]);
+        sum += valid ? delta_ax * delta_ax : 0.0;
+        n += valid;
+    }
+    for(int i = 0; i < ntriplet; i++){
+        int i1 = i + icell;
+        int i2 = i + icell * 2;
+        int valid = present[i] & present[i1] & present[i2];
+        double delta_ay = y[i2] - y[i1] - (y[i1] - y[i])/(z[i1] - z[i]) * (z[i2] - z[i1]);
+        sum += valid ? delta_ay * delta_ay : 0.0;
+        n += valid;
+    }
+    sum_square = sum;
+    nentry = n;
+}
+
+// X and Y of one triplet, used for the tail of the SIMD kernels
+static inline void SecondDiffOne(const double *x, const double *y, const double *z, const uint8_t *present,
+                                 int i, int icell, double &sum, int &n){
+    int i1 = i + icell;
+    int i2 = i + icell * 2;
+    if(!(present[i] & present[i1] & present[i2])) return;
+    double dz10 = z[i1] - z[i];
+    double dz21 = z[i2] - z[i1];
+    double delta_ax = x[i2] - x[i1] - (x[i1] - x[i])/dz10 * dz21;
+    double delta_ay = y[i2] - y[i1] - (y[i1] - y[i])/dz10 * dz21;
+    sum += delta_ax * delta_ax;
+    sum += delta_ay * delta_ay;
+    n += 2;
+}
+
+// lateral distance^2 of p2 from the line p0-p1 with the operations of CalcDistance:
+// ab = p1 - p0, ap = p2 - p0, u = ab.Unit(), d = ap - u * ap.Dot(u), |d|^2 (z = 0 adds nothing)
+static inline double LateralSquare(double x0, double y0, double x1, double y1, double x2, double y2){
+    double abx = x1 - x0;
+    double aby = y1 - y0;
+    double apx = x2 - x0;
+    double apy = y2 - y0;
+    double tot2 = abx * abx + aby * aby;
+    double tot = tot2 > 0 ? 1.0 / sqrt(tot2) : 1.0;
+    double ux = abx * tot;
+    double uy = aby * tot;
+    double dot = apx * ux + apy * uy;
+    double dx = apx - ux * dot;
+    double dy = apy - uy * dot;
+    double dist = sqrt(dx * dx + dy * dy);
+    return dist * dist;
+}
+
+// second differences and lateral distance in one loop over the triplets
+static void CellDiffScalar(const double *x, const double *y, const double *z, const uint8_t *present,
+                           int ntriplet, int icell, double &sum_square, int &nentry, double &sum_lateral, int &nlateral){
+    double sum = 0;
+    double lat = 0;
+    int n = 0;
+    for(int i = 0; i < ntriplet; i++){
+        int i1 = i + icell;
+        int i2 = i + icell * 2;
+        if(!(present[i] & present[i1] & present[i2])) continue;
+        double dz10 = z[i1] - z[i];
+        double dz21 = z[i2] - z[i1];
+        double delta_ax = x[i2] - x[i1] - (x[i1] - x[i])/dz10 * dz21;
+        double delta_ay = y[i2] - y[i1] - (y[i1] - y[i])/dz10 * dz21;
+        sum += delta_ax * delta_ax;
+        sum += delta_ay * delta_ay;
+        lat += LateralSquare(x[i], y[i], x[i1], y[i1], x[i2], y[i2]);
+        n++;
+    }
+    sum_square = sum;
+    nentry = 2 * n;
+    sum_lateral = lat;
+    nlateral = n;
+}
+
+#ifdef FNUMOM_X86_KERNEL
+
+// fma is not enabled so that each operation is rounded as in the scalar kernel
+__attribute__((target("avx2")))
+static void SecondDiffAVX2(const double *x, const double *y, const double *z, const uint8_t *present,
+                           int ntriplet, int icell, double &sum_square, int &nentry){
+    const int i1 = icell;
+    const int i2 = icell * 2;
+    __m256d acc = _mm256_setzero_pd();
+    int n = 0;
+    int i = 0;
+    for(; i + 4 <= ntriplet; i += 4){
+        int32_t p0, p1, p2;
+        memcpy(&p0, present + i, 4);
+        memcpy(&p1, present + i + i1, 4);
+        memcpy(&p2, present + i + i2, 4);
+        __m256i valid = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(p0 & p1 & p2));
+        __m256d mask = _mm256_castsi256_pd(_mm256_cmpgt_epi64(valid, _mm256_setzero_si256()));
+
+        __m256d z0 = _mm256_loadu_pd(z + i);
+        __m256d z1 = _mm256_loadu_pd(z + i + i1);
+        __m256d z2 = _mm256_loadu_pd(z + i + i2);
+        __m256d dz10 = _mm256_sub_pd(z1, z0);
+        __m256d dz21 = _mm256_sub_pd(z2, z1);
+
+        __m256d x0 = _mm256_loadu_pd(x + i);
+        __m256d x1 = _mm256_loadu_pd(x + i + i1);
+        __m256d x2 = _mm256_loadu_pd(x + i + i2);
+        __m256d dx = _mm256_sub_pd(_mm256_sub_pd(x2, x1), _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(x1, x0), dz10), dz21));
+
+        __m256d y0 = _mm256_loadu_pd(y + i);
+        __m256d y1 = _mm256_loadu_pd(y + i + i1);
+        __m256d y2 = _mm256_loadu_pd(y + i + i2);
+        __m256d dy = _mm256_sub_pd(_mm256_sub_pd(y2, y1), _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(y1, y0), dz10), dz21));
+
+        // missing triplets give NaN/inf, the mask replaces them with +0
+        acc = _mm256_add_pd(acc, _mm256_and_pd(mask, _mm256_mul_pd(dx, dx)));
+        acc = _mm256_add_pd(acc, _mm256_and_pd(mask, _mm256_mul_pd(dy, dy)));
+        n += 2 * __builtin_popcount(_mm256_movemask_pd(mask));
+    }
+
+    double lane[4];
+    _mm256_storeu_pd(lane, acc);
+    double sum = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+    for(; i < ntriplet; i++) SecondDiffOne(x, y, z, present, i, icell, sum, n);
+
+    sum_square = sum;
+    nentry = n;
+}
+
+__attribute__((target("avx2")))
+static void CellDiffAVX2(const double *x, const double *y, const double *z, const uint8_t *present,
+                         int ntriplet, int icell, double &sum_square, int &nentry, double &sum_lateral, int &nlateral){
+    const int i1 = icell;
+    const int i2 = icell * 2;
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    __m256d acc = zero;
+    __m256d acc_lat = zero;
+    int n = 0;
+    int i = 0;
+    for(; i + 4 <= ntriplet; i += 4){
+        int32_t p0, p1, p2;
+        memcpy(&p0, present + i, 4);
+        memcpy(&p1, present + i + i1, 4);
+        memcpy(&p2, present + i + i2, 4);
+        __m256i valid = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(p0 & p1 & p2));
+        __m256d mask = _mm256_castsi256_pd(_mm256_cmpgt_epi64(valid, _mm256_setzero_si256()));
+
+        __m256d z0 = _mm256_loadu_pd(z + i);
+        __m256d z1 = _mm256_loadu_pd(z + i + i1);
+        __m256d z2 = _mm256_loadu_pd(z + i + i2);
+        __m256d dz10 = _mm256_sub_pd(z1, z0);
+        __m256d dz21 = _mm256_sub_pd(z2, z1);
+
+        __m256d x0 = _mm256_loadu_pd(x + i);
+        __m256d x1 = _mm256_loadu_pd(x + i + i1);
+        __m256d x2 = _mm256_loadu_pd(x + i + i2);
+        __m256d dx = _mm256_sub_pd(_mm256_sub_pd(x2, x1), _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(x1, x0), dz10), dz21));
+
+        __m256d y0 = _mm256_loadu_pd(y + i);
+        __m256d y1 = _mm256_loadu_pd(y + i + i1);
+        __m256d y2 = _mm256_loadu_pd(y + i + i2);
+        __m256d dy = _mm256_sub_pd(_mm256_sub_pd(y2, y1), _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(y1, y0), dz10), dz21));
+
+        acc = _mm256_add_pd(acc, _mm256_and_pd(mask, _mm256_mul_pd(dx, dx)));
+        acc = _mm256_add_pd(acc, _mm256_and_pd(mask, _mm256_mul_pd(dy, dy)));
+
+        // LateralSquare
+        __m256d abx = _mm256_sub_pd(x1, x0);
+        __m256d aby = _mm256_sub_pd(y1, y0);
+        __m256d apx = _mm256_sub_pd(x2, x0);
+        __m256d apy = _mm256_sub_pd(y2, y0);
+        __m256d tot2 = _mm256_add_pd(_mm256_mul_pd(abx, abx), _mm256_mul_pd(aby, aby));
+        __m256d tot = _mm256_blendv_pd(one, _mm256_div_pd(one, _mm256_sqrt_pd(tot2)), _mm256_cmp_pd(tot2, zero, _CMP_GT_OQ));
+        __m256d ux = _mm256_mul_pd(abx, tot);
+        __m256d uy = _mm256_mul_pd(aby, tot);
+        __m256d dot = _mm256_add_pd(_mm256_mul_pd(apx, ux), _mm256_mul_pd(apy, uy));
+        __m256d lx = _mm256_sub_pd(apx, _mm256_mul_pd(ux, dot));
+        __m256d ly = _mm256_sub_pd(apy, _mm256_mul_pd(uy, dot));
+        __m256d dist = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(lx, lx), _mm256_mul_pd(ly, ly)));
+        acc_lat = _mm256_add_pd(acc_lat, _mm256_and_pd(mask, _mm256_mul_pd(dist, dist)));
+
+        n += __builtin_popcount(_mm256_movemask_pd(mask));
+    }
+
+    double lane[4];
+    _mm256_storeu_pd(lane, acc);
+    double sum = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+    _mm256_storeu_pd(lane, acc_lat);
+    double lat = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+
+    double sum_tail, lat_tail;
+    int n_tail, nlat_tail;
+    CellDiffScalar(x + i, y + i, z + i, present + i, ntriplet - i, icell, sum_tail, n_tail, lat_tail, nlat_tail);
+
+    sum_square = sum + sum_tail;
+    nentry = 2 * n + n_tail;
+    sum_lateral = lat + lat_tail;
+    nlateral = n + nlat_tail;
+}
+
+__attribute__((target("avx512f")))
+static void SecondDiffAVX512(const double *x, const double *y, const double *z, const uint8_t *present,
+                             int ntriplet, int icell, double &sum_square, int &nentry){
+    const int i1 = icell;
+    const int i2 = icell * 2;
+    __m512d acc = _mm512_setzero_pd();
+    int n = 0;
+    int i = 0;
+    for(; i + 8 <= ntriplet; i += 8){
+        int64_t p0, p1, p2;
+        memcpy(&p0, present + i, 8);
+        memcpy(&p1, present + i + i1, 8);
+        memcpy(&p2, present + i + i2, 8);
+        __m512i valid = _mm512_cvtepu8_epi64(_mm_cvtsi64_si128(p0 & p1 & p2));
+        __mmask8 mask = _mm512_test_epi64_mask(valid, valid);
+
+        __m512d z0 = _mm512_loadu_pd(z + i);
+        __m512d z1 = _mm512_loadu_pd(z + i + i1);
+        __m512d z2 = _mm512_loadu_pd(z + i + i2);
+        __m512d dz10 = _mm512_sub_pd(z1, z0);
+        __m512d dz21 = _mm512_sub_pd(z2, z1);
+
+        __m512d x0 = _mm512_loadu_pd(x + i);
+        __m512d x1 = _mm512_loadu_pd(x + i + i1);
+        __m512d x2 = _mm512_loadu_pd(x + i + i2);
+        __m512d dx = _mm512_sub_pd(_mm512_sub_pd(x2, x1), _mm512_mul_pd(_mm512_div_pd(_mm512_sub_pd(x1, x0), dz10), dz21));
+
+        __m512d y0 = _mm512_loadu_pd(y + i);
+        __m512d y1 = _mm512_loadu_pd(y + i + i1);
+        __m512d y2 = _mm512_loadu_pd(y + i + i2);
+        __m512d dy = _mm512_sub_pd(_mm512_sub_pd(y2, y1), _mm512_mul_pd(_mm512_div_pd(_mm512_sub_pd(y1, y0), dz10), dz21));
+
+        acc = _mm512_mask_add_pd(acc, mask, acc, _mm512_mul_pd(dx, dx));
+        acc = _mm512_mask_add_pd(acc, mask, acc, _mm512_mul_pd(dy, dy));
+        n += 2 * __builtin_popcount(mask);
+    }
+
+    double lane[8];
+    _mm512_storeu_pd(lane, acc);
+    double sum = ((lane[0] + lane[1]) + (lane[2] + lane[3])) + ((lane[4] + lane[5]) + (lane[6] + lane[7]));
+    for(; i < ntriplet; i++) SecondDiffOne(x, y, z, present, i, icell, sum, n);
+
+    sum_square = sum;
+    nentry = n;
+}
+
+__attribute__((target("avx512f")))
+static void CellDiffAVX512(const double *x, const double *y, const double *z, const uint8_t *present,
+                           int ntriplet, int icell, double &sum_square, int &nentry, double &sum_lateral, int &nlateral){
+    const int i1 = icell;
+    const int i2 = icell * 2;
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d one = _mm512_set1_pd(1.0);
+    __m512d acc = zero;
+    __m512d acc_lat = zero;
+    int n = 0;
+    int i = 0;
+    for(; i + 8 <= ntriplet; i += 8){
+        int64_t p0, p1, p2;
+        memcpy(&p0, present + i, 8);
+        memcpy(&p1, present + i + i1, 8);
+        memcpy(&p2, present + i + i2, 8);
+        __m512i valid = _mm512_cvtepu8_epi64(_mm_cvtsi64_si128(p0 & p1 & p2));
+        __mmask8 mask = _mm512_test_epi64_mask(valid, valid);
+
+        __m512d z0 = _mm512_loadu_pd(z + i);
+        __m512d z1 = _mm512_loadu_pd(z + i + i1);
+        __m512d z2 = _mm512_loadu_pd(z + i + i2);
+        __m512d dz10 = _mm512_sub_pd(z1, z0);
+        __m512d dz21 = _mm512_sub_pd(z2, z1);
+
+        __m512d x0 = _mm512_loadu_pd(x + i);
+        __m512d x1 = _mm512_loadu_pd(x + i + i1);
+        __m512d x2 = _mm512_loadu_pd(x + i + i2);
+        __m512d dx = _mm512_sub_pd(_mm512_sub_pd(x2, x1), _mm512_mul_pd(_mm512_div_pd(_mm512_sub_pd(x1, x0), dz10), dz21));
+
+        __m512d y0 = _mm512_loadu_pd(y + i);
+        __m512d y1 = _mm512_loadu_pd(y + i + i1);
+        __m512d y2 = _mm512_loadu_pd(y + i + i2);
+        __m512d dy = _mm512_sub_pd(_mm512_sub_pd(y2, y1), _mm512_mul_pd(_mm512_div_pd(_mm512_sub_pd(y1, y0), dz10), dz21));
+
+        acc = _mm512_mask_add_pd(acc, mask, acc, _mm512_mul_pd(dx, dx));
+        acc = _mm512_mask_add_pd(acc, mask, acc, _mm512_mul_pd(dy, dy));
+
+        // LateralSquare
+        __m512d abx = _mm512_sub_pd(x1, x0);
+        __m512d aby = _mm512_sub_pd(y1, y0);
+        __m512d apx = _mm512_sub_pd(x2, x0);
+        __m512d apy = _mm512_sub_pd(y2, y0);
+        __m512d tot2 = _mm512_add_pd(_mm512_mul_pd(abx, abx), _mm512_mul_pd(aby, aby));
+        __mmask8 positive = _mm512_cmp_pd_mask(tot2, zero, _CMP_GT_OQ);
+        __m512d tot = _mm512_mask_div_pd(one, positive, one, _mm512_sqrt_pd(tot2));
+        __m512d ux = _mm512_mul_pd(abx, tot);
+        __m512d uy = _mm512_mul_pd(aby, tot);
+        __m512d dot = _mm512_add_pd(_mm512_mul_pd(apx, ux), _mm512_mul_pd(apy, uy));
+        __m512d lx = _mm512_sub_pd(apx, _mm512_mul_pd(ux, dot));
+        __m512d ly = _mm512_sub_pd(apy, _mm512_mul_pd(uy, dot));
+        __m512d dist = _mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(lx, lx), _mm512_mul_pd(ly, ly)));
+        acc_lat = _mm512_mask_add_pd(acc_lat, mask, acc_lat, _mm512_mul_pd(dist, dist));
+
+        n += __builtin_popcount(mask);
+    }
+
+    double lane[8];
+    _mm512_storeu_pd(lane, acc);
+    double sum = ((lane[0] + lane[1]) + (lane[2] + lane[3])) + ((lane[4] + lane[5]) + (lane[6] + lane[7]));
+    _mm512_storeu_pd(lane, acc_lat);
+    double lat = ((lane[0] + lane[1]) + (lane[2] + lane[3])) + ((lane[4] + lane[5]) + (lane[6] + lane[7]));
+
+    double sum_tail, lat_tail;
+    int n_tail, nlat_tail;
+    CellDiffScalar(x + i, y + i, z + i, present + i, ntriplet - i, icell, sum_tail, n_tail, lat_tail, nlat_tail);
+
+    sum_square = sum + sum_tail;
+    nentry = 2 * n + n_tail;
+    sum_lateral = lat + lat_tail;
+    nlateral = n + nlat_tail;
+}
+
+#endif
+
+int FnuMomKernelSelect(int request){
+#ifdef FNUMOM_X86_KERNEL
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+    bool has_avx512 = __builtin_cpu_supports("avx512f");
+#else
+    bool has_avx2 = false;
+    bool has_avx512 = false;
+#endif
+    if(request == kKernelAuto) return has_avx512 ? kKernelAVX512 : has_avx2 ? kKernelAVX2 : kKernelScalar;
+    if(request == kKernelAVX512 && has_avx512) return kKernelAVX512;
+    if(request == kKernelAVX2 && has_avx2) return kKernelAVX2;
+    return kKernelScalar;
+}
+
+int FnuMomKernelFromName(const char *name){
+    if(strcmp(name, "scalar") == 0) return kKernelScalar;
+    if(strcmp(name, "avx2") == 0) return kKernelAVX2;
+    if(strcmp(name, "avx512") == 0) return kKernelAVX512;
+    return kKernelAuto;
+}
+
+const char* FnuMomKernelName(int kernel){
+    if(kernel == kKernelAVX2) return "avx2";
+    if(kernel == kKernelAVX512) return "avx512";
+    if(kernel == kKernelScalar) return "scalar";
+    return "auto";
+}
+
+void FnuMomSecondDiff(int kernel, const double *x, const double *y, const double *z, const uint8_t *present,
+                      int ntriplet, int icell, double &sum_square, int &nentry){
+    if(ntriplet < 0) ntriplet = 0;
+#ifdef FNUMOM_X86_KERNEL
+    if(kernel == kKernelAVX512){
+        SecondDiffAVX512(x, y, z, present, ntriplet, icell, sum_square, nentry);
+        return;
+    }
+    if(kernel == kKernelAVX2){
+        SecondDiffAVX2(x, y, z, present, ntriplet, icell, sum_square, nentry);
+        return;
+    }
+#endif
+    SecondDiffScalar(x, y, z, present, ntriplet, icell, sum_square, nentry);
+}
+
+void FnuMomCellDiff(int kernel, const double *x, const double *y, const double *z, const uint8_t *present,
+                    int ntriplet, int icell, double &sum_square, int &nentry, double &sum_lateral, int &nlateral){
+    if(ntriplet < 0) ntriplet = 0;
+#ifdef FNUMOM_X86_KERNEL
+    if(kernel == kKernelAVX512){
+        CellDiffAVX512(x, y, z, present, ntriplet, icell, sum_square, nentry, sum_lateral, nlateral);
+        return;
+    }
+    if(kernel == kKernelAVX2){
+        CellDiffAVX2(x, y, z, present, ntriplet, icell, sum_square, nentry, sum_lateral, nlateral);
+        return;
+    }
+#endif
+    CellDiffScalar(x, y, z, present, ntriplet, icell, sum_square, nentry, sum_lateral, nlateral);
+}
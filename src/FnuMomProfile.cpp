@@ -0,0 +1,168 @@
+#include "FnuMomProfile.hpp"
+
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+#include <cstdarg>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace {
+
+const char* kTimerNames[kNTimer] = {"file_open", "index", "tree_read", "match", "array_fill", "diff", "kink", "fit", "output"};
+
+} // namespace
+
+// written only by its thread, read by Sum
+struct FnuMomProfile::Slot {
+	Slot() {
+		for (int i=0; i<kNTimer; i++) {
+			ns[i].store(0);
+			calls[i].store(0);
+		}
+	}
+	std::atomic<int64_t> ns[kNTimer];
+	std::atomic<long> calls[kNTimer];
+};
+
+std::atomic<bool> FnuMomProfile::enabled_(false);
+
+namespace {
+
+// slots of all the threads, kept until the exit so that the ones of the finished threads are still counted
+std::mutex slots_mutex;
+std::vector<std::unique_ptr<FnuMomProfile::Slot>>* slots = nullptr;
+
+} // namespace
+
+// ----------------------------------------------------
+
+FnuMomProfile::Slot& FnuMomProfile::LocalSlot() {
+	thread_local Slot* slot = nullptr;
+	if (slot) return *slot;
+
+	std::lock_guard<std::mutex> lock(slots_mutex);
+	if (!slots) slots = new std::vector<std::unique_ptr<Slot>>;
+	slots -> emplace_back(new Slot);
+	slot = slots -> back().get();
+	return *slot;
+}
+
+// ----------------------------------------------------
+
+void FnuMomProfile::Add(int timer, int64_t ns, long calls) {
+	Slot& slot = LocalSlot();
+	// only this thread writes the slot, no read-modify-write needed
+	slot.ns[timer].store(slot.ns[timer].load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+	slot.calls[timer].store(slot.calls[timer].load(std::memory_order_relaxed) + calls, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------
+
+const char* FnuMomProfile::Name(int timer) {
+	return timer >= 0 and timer < kNTimer ? kTimerNames[timer] : "unknown";
+}
+
+// ----------------------------------------------------
+
+void FnuMomProfile::Sum(int64_t* ns, long* calls) {
+	for (int i=0; i<kNTimer; i++) {
+		ns[i] = 0;
+		calls[i] = 0;
+	}
+
+	std::lock_guard<std::mutex> lock(slots_mutex);
+	if (!slots) return;
+	for (const std::unique_ptr<Slot>& slot: *slots) {
+		for (int i=0; i<kNTimer; i++) {
+			ns[i] += slot -> ns[i].load(std::memory_order_relaxed);
+			calls[i] += slot -> calls[i].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+// ----------------------------------------------------
+
+void FnuMomProfile::Print(std::ostream& os, double wall_seconds) {
+	int64_t ns[kNTimer];
+	long calls[kNTimer];
+	Sum(ns, calls);
+
+	char line[256];
+	snprintf(line, sizeof(line), "%-12s %12s %12s %14s %9s", "Section", "calls", "total (s)", "mean (us)", "% wall");
+	os << "Profile (thread seconds, wall " << wall_seconds << " s):" << std::endl << line << std::endl;
+	for (int i=0; i<kNTimer; i++) {
+		if (calls[i] == 0) continue;
+		double total = ns[i] * 1e-9;
+		snprintf(line, sizeof(line), "%-12s %12ld %12.3f %14.3f %9.1f", kTimerNames[i], calls[i], total,
+				ns[i] * 1e-3 / calls[i], wall_seconds > 0 ? 100 * total / wall_seconds : 0.);
+		os << line << std::endl;
+	}
+}
+
+// ----------------------------------------------------
+
+void FnuMomProfile::WriteJSON(std::string path, double wall_seconds) {
+	int64_t ns[kNTimer];
+	long calls[kNTimer];
+	Sum(ns, calls);
+
+	std::ofstream ofs(path);
+	if (ofs.fail()) throw std::runtime_error("Cannot open the file: " + path);
+
+	ofs << "{\n  \"wall_seconds\": " << wall_seconds << ",\n  \"sections\": {";
+	for (int i=0; i<kNTimer; i++) {
+		ofs << (i > 0 ? "," : "") << "\n    \"" << kTimerNames[i] << "\": {\"calls\": " << calls[i]
+			<< ", \"seconds\": " << ns[i] * 1e-9 << "}";
+	}
+	ofs << "\n  }\n}" << std::endl;
+	if (ofs.fail()) throw std::runtime_error("Failed to write the file: " + path);
+}
+
+// ----------------------------------------------------
+
+FnuMomStatusLine::FnuMomStatusLine(double interval, double log_interval) {
+	tty_ = isatty(fileno(stderr));
+	interval_ = tty_ ? interval : log_interval;
+	last_ = std::chrono::steady_clock::now();
+}
+
+// ----------------------------------------------------
+
+bool FnuMomStatusLine::Due() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - last_).count() >= interval_;
+}
+
+// ----------------------------------------------------
+
+void FnuMomStatusLine::Print(const char* format, ...) {
+	char text[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	Write(text, false);
+}
+
+// ----------------------------------------------------
+
+void FnuMomStatusLine::Finish(const char* format, ...) {
+	char text[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	Write(text, true);
+}
+
+// ----------------------------------------------------
+
+void FnuMomStatusLine::Write(const char* text, bool final) {
+	if (tty_) fprintf(stderr, "\r%s\033[K%s", text, final ? "\n" : "");
+	else fprintf(stderr, "%s\n", text);
+	fflush(stderr);
+	last_ = std::chrono::steady_clock::now();
+}
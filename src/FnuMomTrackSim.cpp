@@ -0,0 +1,124 @@
+#include "FnuMomTrackSim.hpp"
+
+#include <cmath>
+
+#include <TEnv.h>
+
+void FnuMomSimConfig::ReadParFile(std::string path) {
+	TEnv env;
+	env.ReadFile(path.c_str(), kEnvAll);
+	z = env.GetValue("z", z);
+	X0 = env.GetValue("X0", X0);
+	pos_reso = env.GetValue("pos_reso", pos_reso);
+}
+
+// ----------------------------------------------------
+
+FnuMomTrackSim::FnuMomTrackSim(const FnuMomSimConfig& config, uint64_t seed)
+	: config_(config), seed_(seed), has_spare_(false), spare_(0), kink_plate_(-1), kink_angle_(0) {}
+
+// ----------------------------------------------------
+
+double FnuMomTrackSim::Theta0(double p) const {
+	double t = config_.z / (config_.X0 * 1000.0);
+	return 13.6e-3 / p * sqrt(t) * (1 + 0.038 * log(t));
+}
+
+// ----------------------------------------------------
+
+// (0, 1], 53 bits
+double FnuMomTrackSim::Uniform() {
+	return ((engine_() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+// ----------------------------------------------------
+
+double FnuMomTrackSim::Gaus(double sigma) {
+	if (has_spare_) {
+		has_spare_ = false;
+		return spare_ * sigma;
+	}
+	double r = sqrt(-2.0 * log(Uniform()));
+	double phi = 2.0 * M_PI * Uniform();
+	spare_ = r * sin(phi);
+	has_spare_ = true;
+	return r * cos(phi) * sigma;
+}
+
+// ----------------------------------------------------
+
+void FnuMomTrackSim::Generate(double p, int nplate, int id, FnuMomTrackData& t) {
+	// splitmix64 of (seed, id)
+	uint64_t h = seed_ + 0x9e3779b97f4a7c15ULL * (uint64_t) (id + 1);
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	engine_.seed(h ^ (h >> 31));
+	has_spare_ = false;
+
+	t.Clear();
+	t.id = id;
+	t.p = p;
+	t.npl = nplate;
+
+	double theta0 = Theta0(p);
+	kink_plate_ = -1;
+	kink_angle_ = 0;
+	if (Uniform() <= config_.kink_prob and nplate >= 4) {
+		kink_plate_ = config_.first_plate + nplate / 4 + (int) (Uniform() * (nplate / 2));
+	}
+
+	double x = Uniform() * 100000;
+	double y = Uniform() * 100000;
+	double tx = Gaus(config_.angle_sigma);
+	double ty = Gaus(config_.angle_sigma);
+	for (int ipl=0; ipl<nplate; ipl++) {
+		int plate = config_.first_plate + ipl;
+		if (ipl > 0) {
+			tx += Gaus(theta0);
+			ty += Gaus(theta0);
+			if (plate == kink_plate_) {
+				double kx = Gaus(config_.kink_angle);
+				double ky = Gaus(config_.kink_angle);
+				tx += kx;
+				ty += ky;
+				kink_angle_ = sqrt(kx*kx + ky*ky);
+			}
+			x += tx * config_.z;
+			y += ty * config_.z;
+		}
+
+		// the random numbers are drawn for every plate, so a missing segment does not shift the others
+		double xs = x + Gaus(config_.pos_reso);
+		double ys = y + Gaus(config_.pos_reso);
+		bool drop = Uniform() <= config_.missing;
+		if (drop and ipl > 0 and ipl < nplate-1) continue;
+
+		t.AddSegment(xs, ys, config_.z * ipl, tx, ty, plate, id * 1000 + ipl, 100000 + id, plate);
+	}
+}
+
+// ----------------------------------------------------
+
+EdbTrackP* FnuMomTrackSim::GenerateTrack(double p, int nplate, int id) {
+	FnuMomTrackData t;
+	Generate(p, nplate, id, t);
+	return MakeTrack(t);
+}
+
+// ----------------------------------------------------
+
+EdbTrackP* FnuMomTrackSim::MakeTrack(const FnuMomTrackData& t) {
+	EdbTrackP* track = new EdbTrackP();
+	for (int i=0; i<t.N(); i++) {
+		EdbSegP* seg = new EdbSegP();
+		seg -> Set(t.seg_id[i], t.x[i], t.y[i], t.tx[i], t.ty[i], 0, 0);
+		seg -> SetZ(t.z[i]);
+		seg -> SetPlate(t.plate[i]);
+		seg -> SetMC(t.mcevt[i], t.id);
+		track -> AddSegment(seg);
+	}
+	track -> SetID(t.id);
+	track -> SetP(t.p);
+	track -> SetNpl(t.npl);
+	return track;
+}
@@ -0,0 +1,416 @@
+#include "LinkedTracksFile.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TEntryList.h>
+#include <TClonesArray.h>
+#include <TDirectory.h>
+
+#include <EdbDataSet.h>
+
+#include "FnuMomProfile.hpp"
+
+bool ExtractEventID(const std::string& str, int& event_id) {
+	// std::regex is slow to construct, search by hand.
+	std::size_t pos = str.find("evt_");
+	while (pos != std::string::npos) {
+		std::size_t begin = pos + 4;
+		std::size_t end = begin;
+		while (end < str.size() and str[end] >= '0' and str[end] <= '9') end++;
+
+		if (end > begin and end < str.size() and str[end] == '_') {
+			event_id = std::stoi(str.substr(begin, end - begin));
+			return true;
+		}
+		pos = str.find("evt_", pos + 1);
+	}
+
+	return false;
+}
+
+// ----------------------------------------------------
+
+LinkedTracksFileInfo ScanLinkedTracksFile(std::string path, bool mcevt_range) {
+	LinkedTracksFileInfo info;
+	info.path = path;
+	info.event_id = -1;
+	info.entries = 0;
+	info.size = 0;
+	info.mcevt_min = -1;
+	info.mcevt_max = -1;
+	info.status = "ok";
+
+	if (!ExtractEventID(path, info.event_id)) {
+		info.event_id = -1;
+		info.status = "no_event_id";
+		return info;
+	}
+
+	std::unique_ptr<TFile> file(TFile::Open(path.c_str(), "READ"));
+	if (!file or !file -> IsOpen()) {
+		info.status = "cannot_open";
+		return info;
+	}
+	info.size = file -> GetSize();
+	if (file -> IsZombie()) {
+		info.status = "zombie";
+		return info;
+	}
+
+	TTree* tree = (TTree*) file -> Get("tracks");
+	if (!tree) {
+		info.status = "no_tracks_tree";
+		return info;
+	}
+	info.entries = tree -> GetEntries();
+	if (info.entries == 0) {
+		info.status = "empty";
+		return info;
+	}
+
+	if (mcevt_range) {
+		info.mcevt_min = tree -> GetMinimum("s.eMCEvt");
+		info.mcevt_max = tree -> GetMaximum("s.eMCEvt");
+	}
+
+	return info; // the file is closed by unique_ptr
+}
+
+// ----------------------------------------------------
+
+void WriteManifest(std::string path, const std::vector<LinkedTracksFileInfo>& infos) {
+	std::ofstream ofs(path);
+	if (ofs.fail()) throw std::runtime_error("Cannot open the file: " + path);
+
+	ofs << "# path\tevent_id\tentries\tsize\tmcevt_min\tmcevt_max\tstatus\n";
+	for (const LinkedTracksFileInfo& info: infos) {
+		ofs << info.path << "\t" << info.event_id << "\t" << info.entries << "\t" << info.size << "\t" << info.mcevt_min << "\t" << info.mcevt_max << "\t" << info.status << "\n";
+	}
+
+	if (ofs.fail()) throw std::runtime_error("Failed to write the file: " + path);
+}
+
+// ----------------------------------------------------
+
+std::vector<LinkedTracksFileInfo> ReadManifest(std::string path) {
+	std::ifstream ifs(path);
+	if (ifs.fail()) throw std::runtime_error("Cannot open the file: " + path);
+
+	std::vector<LinkedTracksFileInfo> infos;
+	std::string line_buf;
+	while (std::getline(ifs, line_buf)) {
+		if (line_buf.empty() or line_buf[0] == '#') continue;
+
+		LinkedTracksFileInfo info;
+		std::istringstream iss(line_buf);
+		std::getline(iss, info.path, '\t');
+		if (!(iss >> info.event_id >> info.entries >> info.size >> info.mcevt_min >> info.mcevt_max >> info.status)) {
+			throw std::runtime_error("Broken manifest line: " + line_buf);
+		}
+		infos.push_back(info);
+	}
+
+	return infos;
+}
+
+// ----------------------------------------------------
+
+LinkedTracksReader::LinkedTracksReader(std::string path, std::string cut) : list_(nullptr), use_entries_(false), ntrack_(0), next_(0), trk_(nullptr) {
+
+	Open(path);
+
+	if (cut.empty()) {
+		ntrack_ = tree_ -> GetEntries();
+	} else {
+		// only the entry numbers passing the cut are kept, tracks are read later chunk by chunk
+		FnuMomScopedTimer timer(kTimeTreeRead);
+		TDirectory* dir = gDirectory;
+		file_ -> cd();
+		tree_ -> Draw(">>linked_tracks_lst", cut.c_str(), "entrylist");
+		list_ = (TEntryList*) gDirectory -> Get("linked_tracks_lst");
+		dir -> cd();
+		if (!list_) throw std::runtime_error("Invalid cut: " + cut);
+		ntrack_ = list_ -> GetN();
+	}
+}
+
+// ----------------------------------------------------
+
+LinkedTracksReader::LinkedTracksReader(std::string path, const std::vector<long>& entries) : list_(nullptr), entries_(entries), use_entries_(true), ntrack_(entries.size()), next_(0), trk_(nullptr) {
+	Open(path);
+}
+
+// ----------------------------------------------------
+
+void LinkedTracksReader::Open(std::string path) {
+	FnuMomScopedTimer timer(kTimeFileOpen);
+	file_ = TFile::Open(path.c_str(), "READ");
+	if (!file_ or file_ -> IsZombie()) throw std::runtime_error("Cannot open the file: " + path);
+
+	tree_ = (TTree*) file_ -> Get("tracks");
+	if (!tree_) throw std::runtime_error("No tracks tree in the file: " + path);
+
+	seg_ = new TClonesArray("EdbSegP", 60);
+	segf_ = new TClonesArray("EdbSegP", 60);
+	tree_ -> SetBranchAddress("t.", &trk_);
+	tree_ -> SetBranchAddress("s", &seg_);
+	tree_ -> SetBranchAddress("sf", &segf_);
+}
+
+// ----------------------------------------------------
+
+LinkedTracksReader::~LinkedTracksReader() {
+	tree_ -> ResetBranchAddresses();
+	delete seg_;
+	delete segf_;
+	delete trk_;
+	file_ -> Close();
+	delete file_;
+}
+
+// ----------------------------------------------------
+
+EdbTrackP* LinkedTracksReader::ReadTrack(long entry) {
+	tree_ -> GetEntry(entry);
+
+	EdbTrackP* track = new EdbTrackP();
+	((EdbSegP*) track) -> Copy(*trk_);
+	track -> SetM(0.139);
+
+	int nseg = seg_ -> GetEntriesFast();
+	for (int i=0; i<nseg; i++) {
+		track -> AddSegment(new EdbSegP(*(EdbSegP*) seg_ -> At(i)));
+		if (i < segf_ -> GetEntriesFast()) track -> AddSegmentF(new EdbSegP(*(EdbSegP*) segf_ -> At(i)));
+	}
+	track -> SetSegmentsTrack(track -> ID());
+	track -> SetCounters();
+
+	return track;
+}
+
+// ----------------------------------------------------
+
+int LinkedTracksReader::ReadChunk(std::vector<EdbTrackP*>& tracks, int max_tracks, std::size_t max_bytes) {
+	FnuMomScopedTimer timer(kTimeTreeRead);
+	tracks.clear();
+
+	std::size_t bytes = 0;
+	while (next_ < ntrack_ and (int) tracks.size() < max_tracks) {
+		if (max_bytes > 0 and !tracks.empty() and bytes >= max_bytes) break;
+
+		long entry = use_entries_ ? entries_[next_] : list_ ? list_ -> GetEntry(next_) : next_;
+		EdbTrackP* track = ReadTrack(entry);
+		tracks.push_back(track);
+		bytes += TrackBytes(track);
+		next_++;
+	}
+
+	return tracks.size();
+}
+
+// ----------------------------------------------------
+
+std::size_t LinkedTracksReader::TrackBytes(EdbTrackP* track) {
+	return sizeof(EdbTrackP) + (track -> N() + track -> NF()) * sizeof(EdbSegP);
+}
+
+// ----------------------------------------------------
+
+void LinkedTracksReader::DeleteTrack(EdbTrackP* track) {
+	// segments are not owned by EdbTrackP
+	for (int i=0; i<track -> N(); i++) delete track -> GetSegment(i);
+	for (int i=0; i<track -> NF(); i++) delete track -> GetSegmentF(i);
+	track -> Clear();
+	delete track;
+}
+
+// ----------------------------------------------------
+
+LinkedTracksLiteReader::LinkedTracksLiteReader(std::string path) {
+	FnuMomScopedTimer timer(kTimeFileOpen);
+
+	file_ = TFile::Open(path.c_str(), "READ");
+	if (!file_ or file_ -> IsZombie()) throw std::runtime_error("Cannot open the file: " + path);
+
+	tree_ = (TTree*) file_ -> Get("tracks");
+	if (!tree_) throw std::runtime_error("No tracks tree in the file: " + path);
+
+	// TTreeReader reads a branch only when it is accessed, the cache prefetches only these branches.
+	const char* branches[] = {"t.eID", "t.eP", "npl", "s.eX", "s.eY", "s.eZ", "s.eTX", "s.eTY", "s.ePlate", "s.eID", "s.eMCEvt", "s.eScanID.ePlate"};
+	tree_ -> SetCacheSize(16*1024*1024);
+	for (const char* branch: branches) tree_ -> AddBranchToCache(branch, true);
+
+	reader_ = new TTreeReader(tree_);
+	trk_id_ = new TTreeReaderValue<Int_t>(*reader_, "t.eID");
+	trk_p_ = new TTreeReaderValue<Float_t>(*reader_, "t.eP");
+	npl_ = new TTreeReaderValue<Int_t>(*reader_, "npl");
+	x_ = new TTreeReaderArray<Float_t>(*reader_, "s.eX");
+	y_ = new TTreeReaderArray<Float_t>(*reader_, "s.eY");
+	z_ = new TTreeReaderArray<Float_t>(*reader_, "s.eZ");
+	tx_ = new TTreeReaderArray<Float_t>(*reader_, "s.eTX");
+	ty_ = new TTreeReaderArray<Float_t>(*reader_, "s.eTY");
+	plate_ = new TTreeReaderArray<Int_t>(*reader_, "s.ePlate");
+	seg_id_ = new TTreeReaderArray<Int_t>(*reader_, "s.eID");
+	mcevt_ = new TTreeReaderArray<Int_t>(*reader_, "s.eMCEvt");
+	scan_plate_ = new TTreeReaderArray<Int_t>(*reader_, "s.eScanID.ePlate");
+}
+
+// ----------------------------------------------------
+
+LinkedTracksLiteReader::~LinkedTracksLiteReader() {
+	delete trk_id_;
+	delete trk_p_;
+	delete npl_;
+	delete x_;
+	delete y_;
+	delete z_;
+	delete tx_;
+	delete ty_;
+	delete plate_;
+	delete seg_id_;
+	delete mcevt_;
+	delete scan_plate_;
+	delete reader_;
+	file_ -> Close();
+	delete file_;
+}
+
+// ----------------------------------------------------
+
+long LinkedTracksLiteReader::ReadTracks(const std::vector<int>& event_ids, std::vector<FnuMomTrackData>& tracks) {
+	FnuMomScopedTimer timer(kTimeTreeRead);
+	std::vector<int> ids = event_ids;
+	std::sort(ids.begin(), ids.end());
+
+	long ntrack = 0;
+	reader_ -> Restart();
+	while (reader_ -> Next()) {
+		std::size_t nseg = mcevt_ -> GetSize();
+		if (!ids.empty()) {
+			bool selected = false;
+			for (std::size_t i=0; i<nseg and !selected; i++) selected = std::binary_search(ids.begin(), ids.end(), (*mcevt_)[i]);
+			if (!selected) continue;
+		}
+
+		AddTrack(tracks);
+		ntrack++;
+	}
+
+	if (reader_ -> GetEntryStatus() != TTreeReader::kEntryNotFound and reader_ -> GetEntryStatus() != TTreeReader::kEntryBeyondEnd) {
+		throw std::runtime_error(std::string("Failed to read the tracks tree: ") + file_ -> GetName());
+	}
+
+	return ntrack;
+}
+
+// ----------------------------------------------------
+
+long LinkedTracksLiteReader::ReadEntries(const std::vector<long>& entries, std::vector<FnuMomTrackData>& tracks) {
+	FnuMomScopedTimer timer(kTimeTreeRead);
+	for (long entry: entries) {
+		if (reader_ -> SetEntry(entry) != TTreeReader::kEntryValid) {
+			throw std::runtime_error(std::string("Failed to read the entry ") + std::to_string(entry) + " of " + file_ -> GetName());
+		}
+		AddTrack(tracks);
+	}
+
+	return entries.size();
+}
+
+// ----------------------------------------------------
+
+void LinkedTracksLiteReader::AddTrack(std::vector<FnuMomTrackData>& tracks) {
+	std::size_t nseg = mcevt_ -> GetSize();
+
+	tracks.emplace_back();
+	FnuMomTrackData& track = tracks.back();
+	track.id = **trk_id_;
+	track.p = **trk_p_;
+	track.npl = **npl_;
+	for (std::size_t i=0; i<nseg; i++) {
+		track.AddSegment((*x_)[i], (*y_)[i], (*z_)[i], (*tx_)[i], (*ty_)[i], (*plate_)[i], (*seg_id_)[i], (*mcevt_)[i], (*scan_plate_)[i]);
+	}
+}
+
+// ----------------------------------------------------
+
+LinkedTracksWriter::LinkedTracksWriter(std::string path, long auto_flush_bytes, float xv, float yv) : ntrack_(0), trid_(0), nseg_(0), npl_(0), n0_(0), xv_(xv), yv_(yv), w_(0) {
+
+	file_ = TFile::Open(path.c_str(), "RECREATE");
+	if (!file_ or file_ -> IsZombie()) throw std::runtime_error("Cannot create the file: " + path);
+
+	tree_ = new TTree("tracks", "tracks");
+	tree_ -> SetDirectory(file_);
+	if (auto_flush_bytes > 0) tree_ -> SetAutoFlush(-auto_flush_bytes);
+
+	trk_ = nullptr;
+	seg_ = new TClonesArray("EdbSegP");
+	segf_ = new TClonesArray("EdbSegP");
+
+	tree_ -> Branch("trid", &trid_, "trid/I");
+	tree_ -> Branch("nseg", &nseg_, "nseg/I");
+	tree_ -> Branch("npl", &npl_, "npl/I");
+	tree_ -> Branch("n0", &n0_, "n0/I");
+	tree_ -> Branch("xv", &xv_, "xv/F");
+	tree_ -> Branch("yv", &yv_, "yv/F");
+	tree_ -> Branch("w", &w_, "w/F");
+	tree_ -> Branch("t.", "EdbSegP", &trk_, 32000, 99);
+	tree_ -> Branch("s", &seg_);
+	tree_ -> Branch("sf", &segf_);
+}
+
+// ----------------------------------------------------
+
+LinkedTracksWriter::~LinkedTracksWriter() {
+	Close();
+	delete seg_;
+	delete segf_;
+}
+
+// ----------------------------------------------------
+
+void LinkedTracksWriter::Fill(EdbTrackP* track) {
+	FnuMomScopedTimer timer(kTimeOutput);
+	trid_ = track -> ID();
+	nseg_ = track -> N();
+	npl_ = track -> Npl();
+	n0_ = track -> N0();
+	w_ = track -> Wgrains();
+	trk_ = (EdbSegP*) track;
+
+	seg_ -> Clear("C");
+	segf_ -> Clear("C");
+	for (int i=0; i<nseg_; i++) {
+		EdbSegP* s = track -> GetSegment(i);
+		if (s) new((*seg_)[i]) EdbSegP(*s);
+		EdbSegP* sf = track -> GetSegmentF(i);
+		if (sf) new((*segf_)[i]) EdbSegP(*sf);
+	}
+
+	tree_ -> Fill();
+	trk_ = nullptr;
+	ntrack_++;
+}
+
+// ----------------------------------------------------
+
+void LinkedTracksWriter::Close() {
+	if (!file_) return;
+
+	FnuMomScopedTimer timer(kTimeOutput);
+	file_ -> cd();
+	tree_ -> Write();
+	file_ -> Close();
+	delete file_; // the tree is deleted with the file
+	file_ = nullptr;
+	tree_ = nullptr;
+}
@@ -0,0 +1,182 @@
+#include "LinkedTracksIndex.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderArray.h>
+
+#include "FnuMomProfile.hpp"
+
+namespace {
+
+const char kMagic[8] = {'F', 'N', 'U', 'M', 'C', 'I', 'X', '\0'};
+
+std::size_t Align8(std::size_t n) {
+	return (n + 7) & ~static_cast<std::size_t>(7);
+}
+
+} // namespace
+
+// ----------------------------------------------------
+
+LinkedTracksIndex::LinkedTracksIndex(std::string path, bool save) : nentries_(0), built_(false) {
+	FnuMomScopedTimer timer(kTimeIndex);
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) throw std::runtime_error("Cannot stat the file: " + path);
+	uint64_t file_size = st.st_size;
+	int64_t file_mtime = st.st_mtime;
+
+	std::string sidecar = SidecarPath(path);
+	if (Load(sidecar, file_size, file_mtime)) return;
+
+	Build(path);
+	built_ = true;
+	if (save) Save(sidecar, file_size, file_mtime);
+}
+
+// ----------------------------------------------------
+
+std::vector<long> LinkedTracksIndex::Entries(const std::vector<int>& mcevts) const {
+	std::vector<long> entries;
+	for (int mcevt: mcevts) {
+		auto range = std::equal_range(mcevt_.begin(), mcevt_.end(), mcevt);
+		for (auto iter = range.first; iter != range.second; ++iter) entries.push_back(entry_[iter - mcevt_.begin()]);
+	}
+
+	// an entry with segments of several of the events is read once
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+	return entries;
+}
+
+// ----------------------------------------------------
+
+std::vector<long> LinkedTracksIndex::EntriesMod(int event_id, int mod) const {
+	// only a few MCEvt per file, walk over the distinct ones
+	std::vector<int> mcevts;
+	for (std::size_t i=0; i<mcevt_.size(); i++) {
+		if (i > 0 and mcevt_[i] == mcevt_[i-1]) continue;
+		if (mcevt_[i] % mod == event_id) mcevts.push_back(mcevt_[i]);
+	}
+	return Entries(mcevts);
+}
+
+// ----------------------------------------------------
+
+bool LinkedTracksIndex::Load(std::string sidecar, uint64_t file_size, int64_t file_mtime) {
+	std::ifstream ifs(sidecar, std::ios::binary);
+	if (ifs.fail()) return false;
+
+	struct stat st;
+	if (stat(sidecar.c_str(), &st) != 0) return false;
+	uint64_t sidecar_size = st.st_size;
+
+	Header header;
+	ifs.read(reinterpret_cast<char*>(&header), sizeof(Header));
+	if (ifs.gcount() != sizeof(Header)) return false;
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 or header.version != kVersion) return false;
+	if (header.file_size != file_size or header.file_mtime != file_mtime) return false; // stale
+
+	// a corrupt or truncated sidecar is rebuilt, npair is checked before it is used to allocate
+	if (header.npair > sidecar_size / (sizeof(int32_t) + sizeof(int64_t))) return false;
+	std::size_t entry_offset = Align8(sizeof(Header) + header.npair * sizeof(int32_t));
+	if (entry_offset + header.npair * sizeof(int64_t) != sidecar_size) return false;
+
+	mcevt_.resize(header.npair);
+	entry_.resize(header.npair);
+	ifs.read(reinterpret_cast<char*>(mcevt_.data()), header.npair * sizeof(int32_t));
+	bool ok = ifs.gcount() == (std::streamsize) (header.npair * sizeof(int32_t));
+	ifs.seekg(entry_offset);
+	ifs.read(reinterpret_cast<char*>(entry_.data()), header.npair * sizeof(int64_t));
+	ok = ok and ifs.gcount() == (std::streamsize) (header.npair * sizeof(int64_t));
+	if (!ok or ifs.fail()) {
+		mcevt_.clear();
+		entry_.clear();
+		return false;
+	}
+
+	nentries_ = header.nentries;
+	return true;
+}
+
+// ----------------------------------------------------
+
+void LinkedTracksIndex::Build(std::string path) {
+	std::unique_ptr<TFile> file(TFile::Open(path.c_str(), "READ"));
+	if (!file or file -> IsZombie()) throw std::runtime_error("Cannot open the file: " + path);
+
+	TTree* tree = (TTree*) file -> Get("tracks");
+	if (!tree) throw std::runtime_error("No tracks tree in the file: " + path);
+	nentries_ = tree -> GetEntries();
+
+	// only s.eMCEvt is read
+	std::vector<std::pair<int32_t, int64_t>> pairs;
+	std::vector<int32_t> mcevts;
+	TTreeReader reader(tree);
+	TTreeReaderArray<Int_t> mcevt(reader, "s.eMCEvt");
+	while (reader.Next()) {
+		mcevts.assign(mcevt.begin(), mcevt.end());
+		std::sort(mcevts.begin(), mcevts.end());
+		mcevts.erase(std::unique(mcevts.begin(), mcevts.end()), mcevts.end());
+		for (int32_t ev: mcevts) pairs.push_back(std::make_pair(ev, (int64_t) reader.GetCurrentEntry()));
+	}
+	if (reader.GetEntryStatus() != TTreeReader::kEntryNotFound and reader.GetEntryStatus() != TTreeReader::kEntryBeyondEnd) {
+		throw std::runtime_error("Failed to read s.eMCEvt: " + path);
+	}
+
+	std::sort(pairs.begin(), pairs.end());
+	mcevt_.resize(pairs.size());
+	entry_.resize(pairs.size());
+	for (std::size_t i=0; i<pairs.size(); i++) {
+		mcevt_[i] = pairs[i].first;
+		entry_[i] = pairs[i].second;
+	}
+}
+
+// ----------------------------------------------------
+
+void LinkedTracksIndex::Save(std::string sidecar, uint64_t file_size, int64_t file_mtime) const {
+	Header header;
+	std::memset(&header, 0, sizeof(Header));
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.file_size = file_size;
+	header.file_mtime = file_mtime;
+	header.nentries = nentries_;
+	header.npair = mcevt_.size();
+
+	std::size_t entry_offset = Align8(sizeof(Header) + mcevt_.size() * sizeof(int32_t));
+	std::vector<char> image(entry_offset + entry_.size() * sizeof(int64_t), 0);
+	std::memcpy(image.data(), &header, sizeof(Header));
+	std::memcpy(image.data() + sizeof(Header), mcevt_.data(), mcevt_.size() * sizeof(int32_t));
+	std::memcpy(image.data() + entry_offset, entry_.data(), entry_.size() * sizeof(int64_t));
+
+	// written to a temporary file and renamed, so a reader never sees a partial sidecar.
+	// The directory of linked_tracks.root may be read-only, the index is then used only in memory.
+	std::string tmp = sidecar + ".tmp" + std::to_string(getpid());
+	std::ofstream ofs(tmp, std::ios::binary);
+	if (ofs.fail()) {
+		std::cerr << "Warning: Cannot write the index " << sidecar << ", it is not saved." << std::endl;
+		return;
+	}
+	ofs.write(image.data(), image.size());
+	ofs.close();
+	if (ofs.fail() or std::rename(tmp.c_str(), sidecar.c_str()) != 0) {
+		std::cerr << "Warning: Failed to write the index " << sidecar << ", it is not saved." << std::endl;
+		std::remove(tmp.c_str());
+	}
+}
@@ -1,19 +1,50 @@
 #include "TruthManager.hpp"
+#include "ThreadPool.hpp"
 
 #include <string>
 #include <fstream>
 #include <vector>
-#include <map>
+#include <algorithm>
+#include <utility>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TROOT.h>
 
 #include <EdbDataSet.h>
 
-TruthManager::TruthManager() : is_read_hadron_(false) {};
+#include "FnuMomProfile.hpp"
+
+namespace {
+
+const char kMagic[8] = {'F', 'N', 'U', 'T', 'R', 'I', 'X', '\0'};
+
+std::size_t Align8(std::size_t n) {
+	return (n + 7) & ~static_cast<std::size_t>(7);
+}
+
+} // namespace
+
+TruthManager::TruthManager() : uniqueID_(nullptr), npair_(0), events_(nullptr), nevent_(0), is_read_hadron_(false), map_(nullptr), map_size_(0) {};
 
 // ----------------------------------------------------
 
-TruthManager::TruthManager(std::string input_file_path) {
+TruthManager::~TruthManager() {
+	Close();
+}
+
+// ----------------------------------------------------
 
-  is_read_hadron_ = false;
+TruthManager::TruthManager(std::string input_file_path, int nthreads, bool use_index) : TruthManager() {
 
   std::ifstream ifs;
 	ifs.open(input_file_path);
@@ -23,9 +54,61 @@ TruthManager::TruthManager(std::string input_file_path) {
 		exit(1);
 	}
 
+	std::vector<std::string> paths;
 	std::string line_buf;
 	while (std::getline(ifs, line_buf)) {
-		ReadTruthFile(line_buf);
+		if (line_buf.empty()) continue;
+		paths.push_back(line_buf);
+	}
+
+	std::string index_path = IndexPath(input_file_path);
+	if (use_index and ReadIndex(index_path)) {
+		// the index must be built from the same files in the same mode
+		bool same = sources_.size() == paths.size();
+		for (std::size_t i=0; same and i<paths.size(); i++) same = sources_[i].path == paths[i] and sources_[i].read_hadron == is_read_hadron_;
+		if (same) {
+			std::cout << "Truth index " << index_path << ": " << npair_ << " particles of " << nevent_ << " events." << std::endl;
+			return;
+		}
+		Close();
+	}
+
+	// One file per thread, each with its own TFile. The partial indices are merged at the end.
+	if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+	if (nthreads > (int) paths.size()) nthreads = paths.size();
+	if (nthreads > 1) ROOT::EnableThreadSafety();
+
+	std::vector<Source> sources(paths.size());
+	std::vector<std::vector<std::pair<int, int>>> pairs(paths.size());
+	std::vector<std::vector<int>> events(paths.size());
+	std::vector<std::string> errors(paths.size());
+	ThreadPool pool(nthreads);
+	pool.ParallelFor(paths.size(), [&](int i, int worker) {
+		// errors are reported by this thread after all the files are read, a worker must not exit
+		try {
+			sources[i] = StatSource(paths[i], is_read_hadron_); // before reading, a file changed while reading makes the index stale
+			ReadTruthEntries(paths[i], pairs[i], events[i]);
+		} catch (const std::exception& e) {
+			errors[i] = e.what();
+		}
+	});
+
+	bool failed = false;
+	for (const std::string& error: errors) {
+		if (error.empty()) continue;
+		std::cerr << error << std::endl;
+		failed = true;
+	}
+	if (failed) exit(1);
+	Merge(sources, pairs, events);
+
+	std::cout << paths.size() << " truth files: " << npair_ << " particles of " << nevent_ << " events are read." << std::endl;
+
+	if (!use_index) return;
+	try {
+		WriteIndex(index_path);
+	} catch (const std::exception& e) {
+		std::cerr << "Warning: " << e.what() << ", the truth index is not saved." << std::endl;
 	}
 };
 
@@ -36,69 +119,300 @@ void TruthManager::ReadTruthFile(std::string path) {
 	std::cout << "Read " << path << std::endl;
 	if (is_read_hadron_) std::cout << "2ry particles are also read." << std::endl;
 
+	std::vector<Source> sources(1, StatSource(path, is_read_hadron_));
+	std::vector<std::vector<std::pair<int, int>>> pairs(1);
+	std::vector<std::vector<int>> events(1);
+	try {
+		ReadTruthEntries(path, pairs[0], events[0]);
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+	Merge(sources, pairs, events);
+
+	std::cout << npair_ << " particles of " << nevent_ << " events are read." << std::endl;
+}
+
+// ----------------------------------------------------
+
+void TruthManager::ReadTruthEntries(std::string path, std::vector<std::pair<int, int>>& pairs, std::vector<int>& events) const {
+
 	TFile* file = new TFile(path.c_str(), "READ");
 	TTree* tree = (TTree*) file -> Get("m_NuMCTruth_tree");
+	if (file -> IsZombie() or !tree) {
+		delete file;
+		throw std::runtime_error("Invalid truth file: " + path);
+	}
 
 	int event_id, pdg_id;
-	float vz_decay;
 	std::vector<int> *trackid_out_particle = 0;
-	std::vector<int> *pdg_out_particle= 0;
 	std::vector<int> *pdg_in_particle= 0;
 
+	// Only the branches used for the selection are read.
+	tree -> SetBranchStatus("*", 0);
+	tree -> SetBranchStatus("m_event_id_MC", 1);
+	tree -> SetBranchStatus("m_pdg_id", 1);
+	tree -> SetBranchStatus("m_trackid_out_particle", 1);
 	tree -> SetBranchAddress("m_event_id_MC", &event_id);
 	tree -> SetBranchAddress("m_pdg_id", &pdg_id);
 	tree -> SetBranchAddress("m_trackid_out_particle", &trackid_out_particle);
-	tree -> SetBranchAddress("m_pdg_out_particle", &pdg_out_particle);
-	tree -> SetBranchAddress("m_vz_decay", &vz_decay);
-	tree -> SetBranchAddress("m_pdg_in_particle", &pdg_in_particle);
+	if (is_read_hadron_) {
+		tree -> SetBranchStatus("m_pdg_in_particle", 1);
+		tree -> SetBranchAddress("m_pdg_in_particle", &pdg_in_particle);
+	}
 
 	// To adopt FEDRA format.
 	int added_MCEvt = 100000;
 
-	for (int i=0; i<tree->GetEntries(); i++) {
+	long nentries = tree -> GetEntries();
+	for (long i=0; i<nentries; i++) {
 		tree -> GetEntry(i);
 
-		std::vector<int> trackid_buf;
 		// select 1ry particle and 2ry particle.
-	    bool is_2ry = std::find(pdg_in_particle->begin(), pdg_in_particle->end(), 14) != pdg_in_particle->end() or std::find(pdg_in_particle->begin(), pdg_in_particle->end(), -14) != pdg_in_particle->end(); // check whether parent particle is numu.
-		if (abs(pdg_id) == 14 or (is_read_hadron_ and is_2ry)) {
+		bool is_2ry = false;
+		if (is_read_hadron_) {
+			is_2ry = std::find(pdg_in_particle->begin(), pdg_in_particle->end(), 14) != pdg_in_particle->end() or std::find(pdg_in_particle->begin(), pdg_in_particle->end(), -14) != pdg_in_particle->end(); // check whether parent particle is numu.
+		}
+		if (abs(pdg_id) == 14 or is_2ry) {
 			// fill daughter particle.
-			for (int j=0; j<trackid_out_particle->size(); j++) {
-				trackid_buf.push_back(trackid_out_particle->at(j));
-			}
-
-			if (uniqueID_.find(event_id+added_MCEvt) == uniqueID_.end()) {
-				uniqueID_[event_id+added_MCEvt] = trackid_buf;
-			} else {
-				uniqueID_[event_id+added_MCEvt].insert(uniqueID_[event_id+added_MCEvt].end(), trackid_buf.begin(), trackid_buf.end());
-			}
+			events.push_back(event_id+added_MCEvt);
+			for (int trackid: *trackid_out_particle) pairs.push_back(std::make_pair(event_id+added_MCEvt, trackid));
 		}
+	}
 
+	// closed here, not at the end of the job
+	tree -> ResetBranchAddresses();
+	delete trackid_out_particle;
+	delete pdg_in_particle;
+	file -> Close();
+	delete file;
+
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+	std::sort(events.begin(), events.end());
+	events.erase(std::unique(events.begin(), events.end()), events.end());
+}
 
+// ----------------------------------------------------
+
+void TruthManager::Merge(const std::vector<Source>& sources, const std::vector<std::vector<std::pair<int, int>>>& pairs, const std::vector<std::vector<int>>& events) {
+	std::vector<Source> all_sources = sources_;
+	all_sources.insert(all_sources.end(), sources.begin(), sources.end());
+
+	// the current pairs may be in the mapped index, they are copied before it is closed
+	std::size_t npair = npair_;
+	std::size_t nevent = nevent_;
+	for (const auto& v: pairs) npair += v.size();
+	for (const auto& v: events) nevent += v.size();
+
+	std::vector<std::pair<int, int>> all_pairs;
+	all_pairs.reserve(npair);
+	for (std::size_t i=0; i<npair_; i++) all_pairs.push_back(std::make_pair(uniqueID_[i].event_id, uniqueID_[i].track_id));
+	for (const auto& v: pairs) all_pairs.insert(all_pairs.end(), v.begin(), v.end());
+	std::sort(all_pairs.begin(), all_pairs.end());
+	all_pairs.erase(std::unique(all_pairs.begin(), all_pairs.end()), all_pairs.end());
+
+	std::vector<int> all_events(events_, events_ + nevent_);
+	all_events.reserve(nevent);
+	for (const auto& v: events) all_events.insert(all_events.end(), v.begin(), v.end());
+	std::sort(all_events.begin(), all_events.end());
+	all_events.erase(std::unique(all_events.begin(), all_events.end()), all_events.end());
+
+	std::vector<char> image = Serialize(all_sources, all_pairs, all_events);
+	Close();
+	buffer_.swap(image);
+	Attach(buffer_.data(), buffer_.size(), "(memory)");
+}
+
+// ----------------------------------------------------
+
+TruthManager::Source TruthManager::StatSource(std::string path, bool read_hadron) {
+	Source source;
+	source.path = path;
+	source.size = 0;
+	source.mtime = 0;
+	source.read_hadron = read_hadron;
+
+	struct stat st;
+	if (stat(path.c_str(), &st) == 0) {
+		source.size = st.st_size;
+		source.mtime = st.st_mtime;
 	}
+	return source;
+}
 
-	std::cout << event_id << "\t" << uniqueID_.end()->second.size() << std::endl;
-	std::cout << uniqueID_.size() << " events are read." << std::endl;
+// ----------------------------------------------------
+
+std::vector<char> TruthManager::Serialize(const std::vector<Source>& sources, const std::vector<std::pair<int, int>>& pairs, const std::vector<int>& events) {
+	std::size_t size = sizeof(Header);
+	for (const Source& source: sources) size += Align8(sizeof(uint64_t) + sizeof(int64_t) + 2*sizeof(uint32_t) + source.path.size());
+
+	Header header;
+	std::memset(&header, 0, sizeof(Header));
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.nsource = sources.size();
+	header.npair = pairs.size();
+	header.nevent = events.size();
+	header.pair_offset = size;
+	header.event_offset = Align8(header.pair_offset + pairs.size()*sizeof(TruthID));
+
+	std::vector<char> image(Align8(header.event_offset + events.size()*sizeof(int32_t)), 0);
+	std::memcpy(image.data(), &header, sizeof(Header));
+
+	char* p = image.data() + sizeof(Header);
+	for (const Source& source: sources) {
+		uint32_t read_hadron = source.read_hadron;
+		uint32_t length = source.path.size();
+		char* begin = p;
+		std::memcpy(p, &source.size, sizeof(uint64_t)); p += sizeof(uint64_t);
+		std::memcpy(p, &source.mtime, sizeof(int64_t)); p += sizeof(int64_t);
+		std::memcpy(p, &read_hadron, sizeof(uint32_t)); p += sizeof(uint32_t);
+		std::memcpy(p, &length, sizeof(uint32_t)); p += sizeof(uint32_t);
+		std::memcpy(p, source.path.data(), length);
+		p = begin + Align8(p + length - begin);
+	}
+
+	TruthID* ids = reinterpret_cast<TruthID*>(image.data() + header.pair_offset);
+	for (std::size_t i=0; i<pairs.size(); i++) {
+		ids[i].event_id = pairs[i].first;
+		ids[i].track_id = pairs[i].second;
+	}
+	int32_t* evts = reinterpret_cast<int32_t*>(image.data() + header.event_offset);
+	for (std::size_t i=0; i<events.size(); i++) evts[i] = events[i];
+
+	return image;
 }
 
+// ----------------------------------------------------
+
+void TruthManager::Attach(const char* data, std::size_t size, std::string path) {
+	if (size < sizeof(Header)) throw std::runtime_error("Broken truth index: " + path);
+
+	Header header;
+	std::memcpy(&header, data, sizeof(Header));
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) throw std::runtime_error("Not a truth index: " + path);
+	if (header.version != kVersion) throw std::runtime_error("Unsupported truth index version: " + path);
+	if (header.pair_offset % 8 != 0 or header.event_offset % 8 != 0 or header.pair_offset > size or header.event_offset > size
+			or header.npair > (size - header.pair_offset) / sizeof(TruthID) or header.nevent > (size - header.event_offset) / sizeof(int32_t)) {
+		throw std::runtime_error("Broken truth index: " + path);
+	}
+
+	std::vector<Source> sources;
+	const char* p = data + sizeof(Header);
+	for (uint32_t i=0; i<header.nsource; i++) {
+		const char* begin = p;
+		if (p + sizeof(uint64_t) + sizeof(int64_t) + 2*sizeof(uint32_t) > data + header.pair_offset) throw std::runtime_error("Broken truth index: " + path);
+		Source source;
+		uint32_t read_hadron, length;
+		std::memcpy(&source.size, p, sizeof(uint64_t)); p += sizeof(uint64_t);
+		std::memcpy(&source.mtime, p, sizeof(int64_t)); p += sizeof(int64_t);
+		std::memcpy(&read_hadron, p, sizeof(uint32_t)); p += sizeof(uint32_t);
+		std::memcpy(&length, p, sizeof(uint32_t)); p += sizeof(uint32_t);
+		if (length > (std::size_t) (data + header.pair_offset - p)) throw std::runtime_error("Broken truth index: " + path);
+		source.path.assign(p, length);
+		source.read_hadron = read_hadron != 0;
+		sources.push_back(source);
+		p = begin + Align8(p + length - begin);
+	}
+
+	sources_.swap(sources);
+	uniqueID_ = reinterpret_cast<const TruthID*>(data + header.pair_offset);
+	npair_ = header.npair;
+	events_ = reinterpret_cast<const int32_t*>(data + header.event_offset);
+	nevent_ = header.nevent;
+}
+
+// ----------------------------------------------------
+
+void TruthManager::Close() {
+	if (map_ != nullptr) munmap(map_, map_size_);
+	map_ = nullptr;
+	map_size_ = 0;
+	std::vector<char>().swap(buffer_);
+
+	sources_.clear();
+	uniqueID_ = nullptr;
+	npair_ = 0;
+	events_ = nullptr;
+	nevent_ = 0;
+}
+
+// ----------------------------------------------------
+
+void TruthManager::WriteIndex(std::string path) const {
+	// the image is rebuilt from the current state, whether it is in buffer_ or mapped
+	std::vector<std::pair<int, int>> pairs(npair_);
+	for (std::size_t i=0; i<npair_; i++) pairs[i] = std::make_pair(uniqueID_[i].event_id, uniqueID_[i].track_id);
+	std::vector<int> events(events_, events_ + nevent_);
+	std::vector<char> image = Serialize(sources_, pairs, events);
+
+	// written to a temporary file and renamed, so a reader never maps a partial index
+	std::string tmp = path + ".tmp" + std::to_string(getpid());
+	std::ofstream ofs(tmp, std::ios::binary);
+	if (ofs.fail()) throw std::runtime_error("Cannot open the file: " + tmp);
+	ofs.write(image.data(), image.size());
+	ofs.close();
+	if (ofs.fail() or std::rename(tmp.c_str(), path.c_str()) != 0) {
+		std::remove(tmp.c_str());
+		throw std::runtime_error("Failed to write the file: " + path);
+	}
+}
+
+// ----------------------------------------------------
+
+bool TruthManager::ReadIndex(std::string path) {
+	Close();
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 or st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return false;
+
+	map_ = map;
+	map_size_ = st.st_size;
+	try {
+		Attach(static_cast<const char*>(map_), map_size_, path);
+	} catch (const std::exception& e) {
+		std::cerr << "Warning: " << e.what() << std::endl;
+		Close();
+		return false;
+	}
+
+	// stale if a source file has changed since the index was built
+	for (const Source& source: sources_) {
+		Source current = StatSource(source.path, source.read_hadron);
+		if (current.size != source.size or current.mtime != source.mtime) {
+			std::cout << "Truth index " << path << " is stale (" << source.path << " has changed)." << std::endl;
+			Close();
+			return false;
+		}
+	}
+
+	return true;
+}
 
 // ----------------------------------------------------
 
 bool TruthManager::IsTrack(EdbTrackP* track) {
+	FnuMomScopedTimer timer(kTimeMatch);
 	int event_id = track -> GetSegmentFirst() -> MCEvt();
 	int track_id = track -> GetSegmentFirst() -> Volume();
-	double z = track -> GetSegmentFirst() -> Z();
 
 	//std::cout << "event id: " << event_id << "\ttrack id: " << track_id << std::endl;
 
-	auto iter = uniqueID_.find(event_id);
-
-	if (iter == uniqueID_.end()) {
-		return false;
-	} else {
-		std::vector<int> v_trackid = iter -> second;
-		if (std::find(v_trackid.begin(), v_trackid.end(), track_id) == v_trackid.end()) return false;
-	}
+	TruthID id;
+	id.event_id = event_id;
+	id.track_id = track_id;
+	if (!std::binary_search(uniqueID_, uniqueID_ + npair_, id)) return false;
 
 	std::cout << "matching event ID, track ID: " << event_id << ", " << track_id << std::endl;
 	return true;
@@ -108,21 +422,19 @@ bool TruthManager::IsTrack(EdbTrackP* track) {
 
 bool TruthManager::IsNumu(int event_id) {
 
-  auto iter = uniqueID_.find(event_id);
-
-  if (iter == uniqueID_.end()) return false;
-
-  return true;
+  return std::binary_search(events_, events_ + nevent_, event_id);
 
 }
 
 // ----------------------------------------------------
 
 void TruthManager::PrintUniqueID() {
-	for (auto iter : uniqueID_) {
-		std::cout << "Event ID:" << iter.first << "\tTrack ID:";
-		for (auto track : iter.second) {
-			std::cout << " " << track;
+	std::size_t i = 0;
+	for (std::size_t j=0; j<nevent_; j++) {
+		int event_id = events_[j];
+		std::cout << "Event ID:" << event_id << "\tTrack ID:";
+		for (; i < npair_ and uniqueID_[i].event_id == event_id; i++) {
+			std::cout << " " << uniqueID_[i].track_id;
 		}
 		std::cout << std::endl;
 	}
@@ -0,0 +1,498 @@
+#include "VertexFile.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char kMagic[8] = {'F', 'N', 'U', 'V', 'T', 'X', 'B', '\0'};
+
+// Size of one element of each column.
+const std::size_t kColumnSize[VertexFile::kNColumn] = {
+	4, 8, 8, 4, 4, 8,					// vertices
+	4, 4, 4, 4, 8, 8, 4, 4, 4, 8, 8		// tracks
+};
+
+std::size_t ColumnLength(int column, uint64_t nvertex, uint64_t ntrack) {
+	if (column == VertexFile::kVtxTrackOffset) return nvertex + 1;
+	if (column < VertexFile::kTrkIVertex) return nvertex;
+	return ntrack;
+}
+
+std::size_t Align8(std::size_t n) {
+	return (n + 7) & ~static_cast<std::size_t>(7);
+}
+
+// fields of a 1ry_trk line after the tag
+void ParseTrack(const char* p, int ivertex, VertexFile::Track& track) {
+	char* end;
+	track.plate_id = std::strtol(p, &end, 10); p = end;
+	track.seg_id = std::strtol(p, &end, 10); p = end;
+	track.x_first = std::strtof(p, &end); p = end;
+	track.y_first = std::strtof(p, &end); p = end;
+	track.plate_id_last = std::strtol(p, &end, 10); p = end;
+	track.npl = std::strtol(p, &end, 10); p = end;
+	track.pdg_id = std::strtol(p, &end, 10); p = end;
+	track.p_true = std::strtof(p, &end); p = end;
+	track.p_reco = std::strtof(p, &end); p = end;
+	track.event_id = std::strtol(p, &end, 10); p = end;
+	track.ivertex = ivertex;
+}
+
+// fields of a 1ry_vtx line after the tag
+void ParseVertex(const char* p, int ivertex, VertexFile::Vertex& vertex) {
+	char* end;
+	vertex.area_id = std::strtol(p, &end, 10); p = end;
+	vertex.vx = std::strtod(p, &end); p = end;
+	vertex.vy = std::strtod(p, &end); p = end;
+	vertex.plate = std::strtol(p, &end, 10); p = end;
+	vertex.ntrk = std::strtol(p, &end, 10); p = end;
+	vertex.ivertex = ivertex;
+}
+
+} // namespace
+
+// ----------------------------------------------------
+
+VertexFile::VertexFile() : map_(nullptr), map_size_(0), nvertex_(0), ntrack_(0) {
+	static const int64_t zero = 0;
+	offset_ = &zero;
+}
+
+// ----------------------------------------------------
+
+VertexFile::VertexFile(std::string path) : VertexFile() {
+	Open(path);
+}
+
+// ----------------------------------------------------
+
+VertexFile::~VertexFile() {
+	Close();
+}
+
+// ----------------------------------------------------
+
+void VertexFile::Open(std::string path) {
+	Close();
+
+	if (!IsBinaryFile(path)) {
+		std::vector<Vertex> verteces;
+		std::vector<Track> tracks;
+		ReadText(path, verteces, tracks);
+		buffer_ = Serialize(verteces, tracks);
+		Attach(buffer_.data(), buffer_.size(), path);
+		return;
+	}
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw std::runtime_error("Cannot open the file: " + path);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw std::runtime_error("Cannot stat the file: " + path);
+	}
+
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) throw std::runtime_error("Cannot mmap the file: " + path);
+
+	map_ = map;
+	map_size_ = st.st_size;
+	Attach(static_cast<const char*>(map_), map_size_, path);
+}
+
+// ----------------------------------------------------
+
+void VertexFile::Close() {
+	if (map_ != nullptr) munmap(map_, map_size_);
+	map_ = nullptr;
+	map_size_ = 0;
+	std::vector<char>().swap(buffer_);
+
+	static const int64_t zero = 0;
+	nvertex_ = 0;
+	ntrack_ = 0;
+	offset_ = &zero;
+}
+
+// ----------------------------------------------------
+
+void VertexFile::Attach(const char* data, std::size_t size, std::string path) {
+	if (size < sizeof(Header)) throw std::runtime_error("Broken vertex file: " + path);
+
+	Header header;
+	std::memcpy(&header, data, sizeof(Header));
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) throw std::runtime_error("Not a binary vertex file: " + path);
+	if (header.version != kVersion) throw std::runtime_error("Unsupported vertex file version: " + path);
+	if (header.ncolumn < kNColumn) throw std::runtime_error("Missing columns in the vertex file: " + path);
+	if (size < sizeof(Header) + header.ncolumn*sizeof(uint64_t)) throw std::runtime_error("Broken vertex file: " + path);
+	// Every vertex and track takes at least 4 bytes (and the track offsets 8), so the counts of a file are bounded
+	// by its size. This keeps nvertex+1 and the lengths below from overflowing with a broken header.
+	if (header.nvertex >= size / sizeof(int64_t) or header.ntrack > size / sizeof(int32_t)) throw std::runtime_error("Broken vertex file: " + path);
+
+	const char* column[kNColumn];
+	for (int i=0; i<kNColumn; i++) {
+		uint64_t offset;
+		std::memcpy(&offset, data + sizeof(Header) + i*sizeof(uint64_t), sizeof(uint64_t));
+		std::size_t count = ColumnLength(i, header.nvertex, header.ntrack);
+		if (offset % 8 != 0 or offset > size or count > (size - offset) / kColumnSize[i]) throw std::runtime_error("Broken vertex file: " + path);
+		column[i] = data + offset;
+	}
+
+	nvertex_ = header.nvertex;
+	ntrack_ = header.ntrack;
+	offset_ = reinterpret_cast<const int64_t*>(column[kVtxTrackOffset]);
+	vtx_area_id_ = reinterpret_cast<const int*>(column[kVtxAreaID]);
+	vtx_x_ = reinterpret_cast<const double*>(column[kVtxX]);
+	vtx_y_ = reinterpret_cast<const double*>(column[kVtxY]);
+	vtx_plate_ = reinterpret_cast<const int*>(column[kVtxPlate]);
+	vtx_ntrk_ = reinterpret_cast<const int*>(column[kVtxNtrk]);
+	trk_ivertex_ = reinterpret_cast<const int*>(column[kTrkIVertex]);
+	trk_event_id_ = reinterpret_cast<const int*>(column[kTrkEventID]);
+	trk_plate_id_ = reinterpret_cast<const int*>(column[kTrkPlateID]);
+	trk_seg_id_ = reinterpret_cast<const int*>(column[kTrkSegID]);
+	trk_x_ = reinterpret_cast<const double*>(column[kTrkX]);
+	trk_y_ = reinterpret_cast<const double*>(column[kTrkY]);
+	trk_plate_id_last_ = reinterpret_cast<const int*>(column[kTrkPlateIDLast]);
+	trk_npl_ = reinterpret_cast<const int*>(column[kTrkNpl]);
+	trk_pdg_id_ = reinterpret_cast<const int*>(column[kTrkPdgID]);
+	trk_p_true_ = reinterpret_cast<const double*>(column[kTrkPTrue]);
+	trk_p_reco_ = reinterpret_cast<const double*>(column[kTrkPReco]);
+
+	// Tracks before offset_[0] belong to no vertex (see Serialize).
+	if (offset_[0] < 0 or offset_[nvertex_] != ntrack_) throw std::runtime_error("Broken vertex file: " + path);
+	for (long i=0; i<nvertex_; i++) {
+		if (offset_[i] > offset_[i+1]) throw std::runtime_error("Broken vertex file: " + path);
+	}
+}
+
+// ----------------------------------------------------
+
+VertexFile::Vertex VertexFile::GetVertex(long i) const {
+	Vertex vertex;
+	vertex.area_id = vtx_area_id_[i];
+	vertex.vx = vtx_x_[i];
+	vertex.vy = vtx_y_[i];
+	vertex.plate = vtx_plate_[i];
+	vertex.ntrk = vtx_ntrk_[i];
+	vertex.ivertex = i;
+	return vertex;
+}
+
+// ----------------------------------------------------
+
+VertexFile::Track VertexFile::GetTrack(long j) const {
+	Track track;
+	track.event_id = trk_event_id_[j];
+	track.plate_id = trk_plate_id_[j];
+	track.seg_id = trk_seg_id_[j];
+	track.x_first = trk_x_[j];
+	track.y_first = trk_y_[j];
+	track.plate_id_last = trk_plate_id_last_[j];
+	track.npl = trk_npl_[j];
+	track.pdg_id = trk_pdg_id_[j];
+	track.p_true = trk_p_true_[j];
+	track.p_reco = trk_p_reco_[j];
+	track.ivertex = trk_ivertex_[j];
+	return track;
+}
+
+// ----------------------------------------------------
+
+void VertexFile::ToVectors(std::vector<Vertex>& verteces, std::vector<Track>& tracks) const {
+	verteces.clear();
+	tracks.clear();
+	verteces.reserve(nvertex_);
+	tracks.reserve(ntrack_);
+	for (long i=0; i<nvertex_; i++) verteces.push_back(GetVertex(i));
+	for (long j=0; j<ntrack_; j++) tracks.push_back(GetTrack(j));
+}
+
+// ----------------------------------------------------
+
+void VertexFile::Write(std::string path) const {
+	std::vector<Vertex> verteces;
+	std::vector<Track> tracks;
+	ToVectors(verteces, tracks);
+	Write(path, verteces, tracks);
+}
+
+// ----------------------------------------------------
+
+int VertexFile::ShardOf(long ivertex, int nshard) const {
+	if (TrackBegin(ivertex) == TrackEnd(ivertex)) return 0; // No track, nothing to measure.
+	return ShardOfEvent(trk_event_id_[TrackBegin(ivertex)], nshard);
+}
+
+// ----------------------------------------------------
+
+/**
+*	Multiplicative hash of the event ID, so that the events of one MC run (consecutive IDs) are spread over the shards.
+*	It must not change, the shards written by calc_momentum are merged with it by merge_vertex.
+*/
+int VertexFile::ShardOfEvent(int event_id, int nshard) {
+	if (nshard <= 1) return 0;
+	uint32_t h = static_cast<uint32_t>(event_id) * 2654435761u;
+	return static_cast<int>((static_cast<uint64_t>(h) * nshard) >> 32);
+}
+
+// ----------------------------------------------------
+
+bool VertexFile::IsBinaryFile(std::string path) {
+	std::ifstream ifs(path, std::ios::binary);
+	if (ifs.fail()) throw std::runtime_error("Cannot open the file: " + path);
+
+	char magic[8];
+	ifs.read(magic, sizeof(magic));
+	return ifs.gcount() == sizeof(magic) and std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+// ----------------------------------------------------
+
+bool VertexFile::IsBinaryPath(std::string path) {
+	const std::string ext = ".vtxb";
+	return path.size() >= ext.size() and path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+// ----------------------------------------------------
+
+/**
+*	Tracks before the first 1ry_vtx line get ivertex = -1.
+*	Positions and momenta of the tracks are read as float like the old ReadVertexFile of the tools.
+*/
+void VertexFile::ReadText(std::string path, std::vector<Vertex>& verteces, std::vector<Track>& tracks) {
+	std::ifstream ifs(path);
+	if (ifs.fail()) throw std::runtime_error("Cannot open the file: " + path);
+
+	verteces.clear();
+	tracks.clear();
+
+	int ivertex = -1;
+	std::string line_buf;
+	while (std::getline(ifs, line_buf)) {
+		const char* p = line_buf.c_str();
+		while (*p == ' ' or *p == '\t') p++;
+
+		if (std::strncmp(p, "1ry_trk", 7) == 0) {
+			Track track;
+			ParseTrack(p + 7, ivertex, track);
+			tracks.push_back(track);
+		} else if (std::strncmp(p, "1ry_vtx", 7) == 0) {
+			ivertex++;
+			Vertex vertex;
+			ParseVertex(p + 7, ivertex, vertex);
+			verteces.push_back(vertex);
+		}
+	}
+}
+
+// ----------------------------------------------------
+
+void VertexFile::Write(std::string path, const std::vector<Vertex>& verteces, const std::vector<Track>& tracks) {
+	if (IsBinaryPath(path)) {
+		WriteBinary(path, verteces, tracks);
+	} else {
+		WriteText(path, verteces, tracks);
+	}
+}
+
+// ----------------------------------------------------
+
+/**
+*	Same format as WriteVertexFile of calc_momentum. Tracks are written after their vertex.
+*/
+void VertexFile::WriteText(std::string path, const std::vector<Vertex>& verteces, const std::vector<Track>& tracks) {
+	std::vector<char> image = Serialize(verteces, tracks);
+	VertexFile vf;
+	vf.Attach(image.data(), image.size(), path);
+
+	std::ofstream ofs(path);
+	if (ofs.fail()) throw std::runtime_error("Cannot open the file: " + path);
+
+	auto write_track = [&ofs, &vf](long j) {
+		ofs << "1ry_trk" << "\t" << vf.trk_plate_id_[j] << "\t" << vf.trk_seg_id_[j] << "\t" << vf.trk_x_[j] << "\t" << vf.trk_y_[j] << "\t" << vf.trk_plate_id_last_[j] << "\t" << vf.trk_npl_[j] << "\t" << vf.trk_pdg_id_[j] << "\t" << vf.trk_p_true_[j] << "\t" << vf.trk_p_reco_[j] << "\t" << vf.trk_event_id_[j] << "\n";
+	};
+
+	// Tracks of no vertex are written first, ReadText gives them ivertex = -1 again.
+	for (long j=0; j<vf.TrackBegin(0); j++) write_track(j);
+
+	for (long i=0; i<vf.NVertex(); i++) {
+		ofs << "1ry_vtx\t" << vf.vtx_area_id_[i] << "\t" << vf.vtx_x_[i] << "\t" << vf.vtx_y_[i] << "\t" << vf.vtx_plate_[i] << "\t" << vf.vtx_ntrk_[i] << "\n";
+
+		for (long j=vf.TrackBegin(i); j<vf.TrackEnd(i); j++) write_track(j);
+	}
+
+	if (ofs.fail()) throw std::runtime_error("Failed to write the file: " + path);
+}
+
+// ----------------------------------------------------
+
+void VertexFile::WriteBinary(std::string path, const std::vector<Vertex>& verteces, const std::vector<Track>& tracks) {
+	std::vector<char> image = Serialize(verteces, tracks);
+
+	std::ofstream ofs(path, std::ios::binary);
+	if (ofs.fail()) throw std::runtime_error("Cannot open the file: " + path);
+	ofs.write(image.data(), image.size());
+	if (ofs.fail()) throw std::runtime_error("Failed to write the file: " + path);
+}
+
+// ----------------------------------------------------
+
+/**
+*	Binary image of the vertices and the tracks.
+*	ivertex of a track is the index of its vertex in verteces (as given by ReadText).
+*	Tracks are grouped with their ivertex keeping the input order.
+*	Tracks whose ivertex is not in [0, verteces.size()) (e.g. 1ry_trk lines before the first 1ry_vtx) are kept
+*	in [0, TrackBegin(0)) with ivertex = -1, outside the range of any vertex.
+*/
+std::vector<char> VertexFile::Serialize(const std::vector<Vertex>& verteces, const std::vector<Track>& tracks) {
+	const long nvertex = verteces.size();
+
+	// Counting sort with ivertex. Bucket 0 holds the tracks of no vertex, bucket i+1 the tracks of vertex i.
+	auto bucket = [nvertex](const Track& track) -> long {
+		return track.ivertex >= 0 and track.ivertex < nvertex ? track.ivertex + 1 : 0;
+	};
+	std::vector<int64_t> start(nvertex + 2, 0);
+	for (const Track& track: tracks) start[bucket(track) + 1]++;
+	for (long k=0; k<=nvertex; k++) start[k+1] += start[k];
+	const long ntrack = tracks.size();
+
+	std::vector<long> order(ntrack);
+	std::vector<int64_t> next(start.begin(), start.end() - 1);
+	for (long j=0; j<ntrack; j++) order[next[bucket(tracks[j])]++] = j;
+
+	// Track offset of each vertex.
+	std::vector<int64_t> offset(start.begin() + 1, start.end());
+
+	// Layout.
+	uint64_t column_offset[kNColumn];
+	std::size_t size = Align8(sizeof(Header) + kNColumn*sizeof(uint64_t));
+	for (int i=0; i<kNColumn; i++) {
+		column_offset[i] = size;
+		size = Align8(size + ColumnLength(i, nvertex, ntrack) * kColumnSize[i]);
+	}
+
+	std::vector<char> image(size, 0);
+
+	Header header;
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.ncolumn = kNColumn;
+	header.nvertex = nvertex;
+	header.ntrack = ntrack;
+	std::memcpy(image.data(), &header, sizeof(Header));
+	std::memcpy(image.data() + sizeof(Header), column_offset, sizeof(column_offset));
+
+	char* data = image.data();
+	int* vtx_area_id = reinterpret_cast<int*>(data + column_offset[kVtxAreaID]);
+	double* vtx_x = reinterpret_cast<double*>(data + column_offset[kVtxX]);
+	double* vtx_y = reinterpret_cast<double*>(data + column_offset[kVtxY]);
+	int* vtx_plate = reinterpret_cast<int*>(data + column_offset[kVtxPlate]);
+	int* vtx_ntrk = reinterpret_cast<int*>(data + column_offset[kVtxNtrk]);
+	int64_t* vtx_offset = reinterpret_cast<int64_t*>(data + column_offset[kVtxTrackOffset]);
+	for (long i=0; i<nvertex; i++) {
+		vtx_area_id[i] = verteces[i].area_id;
+		vtx_x[i] = verteces[i].vx;
+		vtx_y[i] = verteces[i].vy;
+		vtx_plate[i] = verteces[i].plate;
+		vtx_ntrk[i] = verteces[i].ntrk;
+	}
+	std::memcpy(vtx_offset, offset.data(), offset.size()*sizeof(int64_t));
+
+	int* trk_ivertex = reinterpret_cast<int*>(data + column_offset[kTrkIVertex]);
+	int* trk_event_id = reinterpret_cast<int*>(data + column_offset[kTrkEventID]);
+	int* trk_plate_id = reinterpret_cast<int*>(data + column_offset[kTrkPlateID]);
+	int* trk_seg_id = reinterpret_cast<int*>(data + column_offset[kTrkSegID]);
+	double* trk_x = reinterpret_cast<double*>(data + column_offset[kTrkX]);
+	double* trk_y = reinterpret_cast<double*>(data + column_offset[kTrkY]);
+	int* trk_plate_id_last = reinterpret_cast<int*>(data + column_offset[kTrkPlateIDLast]);
+	int* trk_npl = reinterpret_cast<int*>(data + column_offset[kTrkNpl]);
+	int* trk_pdg_id = reinterpret_cast<int*>(data + column_offset[kTrkPdgID]);
+	double* trk_p_true = reinterpret_cast<double*>(data + column_offset[kTrkPTrue]);
+	double* trk_p_reco = reinterpret_cast<double*>(data + column_offset[kTrkPReco]);
+	for (long k=0; k<ntrack; k++) {
+		const Track& track = tracks[order[k]];
+		trk_ivertex[k] = k < offset[0] ? -1 : track.ivertex;
+		trk_event_id[k] = track.event_id;
+		trk_plate_id[k] = track.plate_id;
+		trk_seg_id[k] = track.seg_id;
+		trk_x[k] = track.x_first;
+		trk_y[k] = track.y_first;
+		trk_plate_id_last[k] = track.plate_id_last;
+		trk_npl[k] = track.npl;
+		trk_pdg_id[k] = track.pdg_id;
+		trk_p_true[k] = track.p_true;
+		trk_p_reco[k] = track.p_reco;
+	}
+
+	return image;
+}
+
+// ----------------------------------------------------
+
+VertexStream::VertexStream(std::string path) : is_binary_(VertexFile::IsBinaryFile(path)), has_vertex_(false), nread_(0) {
+	if (is_binary_) {
+		binary_.Open(path);
+		return;
+	}
+
+	ifs_.open(path);
+	if (ifs_.fail()) throw std::runtime_error("Cannot open the file: " + path);
+}
+
+// ----------------------------------------------------
+
+bool VertexStream::Next(VertexFile::Vertex& vertex, std::vector<VertexFile::Track>& tracks) {
+	tracks.clear();
+
+	if (is_binary_) {
+		if (nread_ >= binary_.NVertex()) return false;
+		vertex = binary_.GetVertex(nread_);
+		for (long j=binary_.TrackBegin(nread_); j<binary_.TrackEnd(nread_); j++) tracks.push_back(binary_.GetTrack(j));
+		nread_++;
+		return true;
+	}
+
+	// The 1ry_vtx line of a vertex is read at the end of the previous one and kept in next_vertex_.
+	// Tracks before the first vertex are skipped as they belong to no vertex.
+	while (std::getline(ifs_, line_)) {
+		const char* p = line_.c_str();
+		while (*p == ' ' or *p == '\t') p++;
+
+		if (std::strncmp(p, "1ry_trk", 7) == 0) {
+			if (!has_vertex_) continue;
+			tracks.emplace_back();
+			ParseTrack(p + 7, next_vertex_.ivertex, tracks.back());
+		} else if (std::strncmp(p, "1ry_vtx", 7) == 0) {
+			// next_vertex_ (if any) is returned before this one, which is then the vertex nread_+1
+			VertexFile::Vertex v;
+			ParseVertex(p + 7, nread_ + (has_vertex_ ? 1 : 0), v);
+			if (has_vertex_) {
+				vertex = next_vertex_;
+				next_vertex_ = v;
+				nread_++;
+				return true;
+			}
+			next_vertex_ = v;
+			has_vertex_ = true;
+		}
+	}
+
+	if (!has_vertex_) return false;
+	vertex = next_vertex_;
+	has_vertex_ = false;
+	nread_++;
+	return true;
+}